@@ -0,0 +1,456 @@
+/* Microbenchmarks for the nexus.h primitives, built and run by ./build --bench.
+ *
+ * Every benchmark runs at each size up to --max and reports the best ns/op of a few repetitions,
+ * the allocations made through nx_malloc and friends, and the peak RSS of the process so far.
+ * With --baseline the results are compared against a file written by --save, and the run fails
+ * when any benchmark got slower than the threshold allows or makes more allocations */
+#include <stddef.h>
+
+/* Counts the allocations nexus makes, nexus.h picks these up since NX_DEBUG is not defined */
+static void *bench_malloc(size_t size);
+static void *bench_calloc(size_t num, size_t size);
+static void *bench_realloc(void *ptr, size_t size);
+
+#define nx_malloc(size) bench_malloc(size)
+#define nx_calloc(num, size) bench_calloc(num, size)
+#define nx_realloc(ptr, size) bench_realloc(ptr, size)
+
+#define NEXUS_IMPLEMENTATION
+#include "nexus.h"
+
+#include <sys/resource.h>
+
+#define BENCH_MAX_RESULTS 256
+#define BENCH_LOG_FILE "bench_log.txt"
+#define BENCH_READ_FILE "bench_read.bin"
+
+typedef struct {
+    char   name[64];
+    double ns_per_op;
+    size_t allocations;
+    long   peak_rss_kb;
+} BenchResult;
+
+typedef void (*BenchFunc)(size_t n);
+
+typedef struct {
+    const char *name;
+    BenchFunc   func;
+    size_t      max_n; /* past this the benchmark needs too much memory or time */
+} Benchmark;
+
+static size_t          bench_allocations = 0;
+static size_t          bench_allocations_started;
+static struct timespec bench_started;
+static double          bench_ns_per_op;
+static size_t          bench_op_allocations;
+static unsigned long   bench_seed = 88172645463325252UL;
+
+/* The async logger's writer thread allocates too */
+#define bench_count_allocation()                                                                   \
+    ((void) __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED))
+
+static void *bench_malloc(size_t size) {
+    bench_count_allocation();
+    return malloc(size);
+}
+
+static void *bench_calloc(size_t num, size_t size) {
+    bench_count_allocation();
+    return calloc(num, size);
+}
+
+static void *bench_realloc(void *ptr, size_t size) {
+    bench_count_allocation();
+    return realloc(ptr, size);
+}
+
+static unsigned long bench_random(void) {
+    bench_seed ^= bench_seed << 13;
+    bench_seed ^= bench_seed >> 7;
+    bench_seed ^= bench_seed << 17;
+    return bench_seed;
+}
+
+/* Timing only covers what is between bench_start and bench_stop, so setup is not measured */
+static void bench_start(void) {
+    bench_allocations_started = __atomic_load_n(&bench_allocations, __ATOMIC_RELAXED);
+    clock_gettime(CLOCK_MONOTONIC, &bench_started);
+}
+
+static void bench_stop(size_t ops) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    bench_ns_per_op = ((double) (now.tv_sec - bench_started.tv_sec) * 1e9 +
+                       (double) (now.tv_nsec - bench_started.tv_nsec)) /
+                      (double) nx_max(ops, (size_t) 1);
+    bench_op_allocations =
+        __atomic_load_n(&bench_allocations, __ATOMIC_RELAXED) - bench_allocations_started;
+}
+
+/* Keys are the decimal ids of a random permutation, so insertion order is not sorted */
+static char **bench_make_keys(size_t n, NXArena *arena) {
+    char **keys = (char **) nx_arena_alloc(arena, n * sizeof(char *));
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        keys[i] = (char *) nx_arena_alloc(arena, 24);
+        nx_snprintf(keys[i], 24, "key:%lu", (unsigned long) i);
+    }
+    for (i = n; i > 1; i--) {
+        size_t j    = bench_random() % i;
+        char  *swap = keys[i - 1];
+        keys[i - 1] = keys[j];
+        keys[j]     = swap;
+    }
+    return keys;
+}
+
+static void bench_hashmap(size_t n, bool flat, int lookup) {
+    NXArena   *arena = nx_arena_create();
+    char     **keys  = bench_make_keys(n, arena);
+    size_t    *order = (size_t *) nx_arena_alloc(arena, n * sizeof(size_t));
+    char     **miss  = NULL;
+    NXHashMap *map   = flat ? nx_hashmap_create_flat(NULL, NULL) : nx_hashmap_create(NULL, NULL);
+    size_t     i, found = 0;
+
+    for (i = 0; i < n; i++) {
+        double skew = (double) (bench_random() % 1000000) / 1000000.0;
+        /* 0: uniform hits, 1: skewed hits where a few keys take most lookups, 2: misses */
+        order[i] = lookup == 1 ? (size_t) (skew * skew * skew * (double) n) : bench_random() % n;
+    }
+    if (lookup == 2) {
+        miss = (char **) nx_arena_alloc(arena, n * sizeof(char *));
+        for (i = 0; i < n; i++) {
+            miss[i] = (char *) nx_arena_alloc(arena, 24);
+            nx_snprintf(miss[i], 24, "miss:%lu", (unsigned long) i);
+        }
+    }
+
+    if (lookup < 0) {
+        bench_start();
+        for (i = 0; i < n; i++) {
+            nx_hashmap_insert(map, keys[i], keys[i]);
+        }
+        bench_stop(n);
+    } else {
+        for (i = 0; i < n; i++) {
+            nx_hashmap_insert(map, keys[i], keys[i]);
+        }
+        bench_start();
+        for (i = 0; i < n; i++) {
+            found += nx_hashmap_get(map, lookup == 2 ? miss[i] : keys[order[i]]) != NULL;
+        }
+        bench_stop(n);
+        if (found != (lookup == 2 ? 0 : n)) {
+            nx_die2("hashmap lookups found %lu of %lu keys", (unsigned long) found,
+                    (unsigned long) n);
+        }
+    }
+
+    nx_hashmap_destroy(map);
+    nx_arena_destroy(arena);
+}
+
+static void bench_hashmap_insert(size_t n) {
+    bench_hashmap(n, false, -1);
+}
+
+static void bench_hashmap_get_uniform(size_t n) {
+    bench_hashmap(n, false, 0);
+}
+
+static void bench_hashmap_get_skewed(size_t n) {
+    bench_hashmap(n, false, 1);
+}
+
+static void bench_hashmap_get_miss(size_t n) {
+    bench_hashmap(n, false, 2);
+}
+
+static void bench_flat_hashmap_insert(size_t n) {
+    bench_hashmap(n, true, -1);
+}
+
+static void bench_flat_hashmap_get_uniform(size_t n) {
+    bench_hashmap(n, true, 0);
+}
+
+static void bench_flat_hashmap_get_skewed(size_t n) {
+    bench_hashmap(n, true, 1);
+}
+
+static void bench_flat_hashmap_get_miss(size_t n) {
+    bench_hashmap(n, true, 2);
+}
+
+/* Sizes between 8 and 256 bytes, the range most arena users allocate in */
+static void bench_arena_alloc(size_t n) {
+    NXArena *arena = nx_arena_create();
+    size_t  *sizes = (size_t *) malloc(n * sizeof(size_t));
+    size_t   i;
+
+    for (i = 0; i < n; i++) {
+        sizes[i] = 8 + bench_random() % 249;
+    }
+    bench_start();
+    for (i = 0; i < n; i++) {
+        nx_arena_alloc(arena, sizes[i]);
+    }
+    bench_stop(n);
+
+    free(sizes);
+    nx_arena_destroy(arena);
+}
+
+static void bench_string_builder_append(size_t n) {
+    static const char *words[] = {"a", "nexus", "string builder ", "append\n", "0123456789"};
+    NXStringBuilder   *sb      = nx_string_builder_create();
+    size_t             i;
+
+    bench_start();
+    for (i = 0; i < n; i++) {
+        nx_string_builder_append(sb, words[i % nx_len(words)]);
+    }
+    bench_stop(n);
+    nx_string_builder_destroy(sb);
+}
+
+static void bench_logger(size_t n, bool async) {
+    NXLogger *logger = async ? nx_logger_create_async(BENCH_LOG_FILE, false, true, NX_LOG_INFO,
+                                                      NX_LOG_OVERFLOW_BLOCK)
+                             : nx_logger_create(BENCH_LOG_FILE, false, true, NX_LOG_INFO);
+    size_t    i;
+
+    bench_start();
+    for (i = 0; i < n; i++) {
+        nx_logger_log(logger, NX_LOG_INFO, "request %lu took %d ms", (unsigned long) i,
+                      (int) (i % 100));
+    }
+    nx_logger_flush(logger);
+    bench_stop(n);
+
+    nx_logger_destroy(logger);
+    remove(BENCH_LOG_FILE);
+}
+
+static void bench_logger_log(size_t n) {
+    bench_logger(n, false);
+}
+
+static void bench_logger_log_async(size_t n) {
+    bench_logger(n, true);
+}
+
+/* n is the file size in bytes, one op is one nx_file_read_all */
+static void bench_file_read_all(size_t n) {
+    char  *data  = (char *) malloc(n);
+    size_t reads = nx_max((size_t) 1, (size_t) 100000000 / n / 10);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        data[i] = (char) ('a' + (int) (bench_random() % 26));
+    }
+    if (nx_file_write_n(BENCH_READ_FILE, data, n) != 0) {
+        nx_die1("Failed to write %s", BENCH_READ_FILE);
+    }
+    free(data);
+
+    bench_start();
+    for (i = 0; i < reads; i++) {
+        nx_free(nx_file_read_all(BENCH_READ_FILE));
+    }
+    bench_stop(reads);
+    remove(BENCH_READ_FILE);
+}
+
+static const Benchmark benchmarks[] = {
+    {"hashmap_insert", bench_hashmap_insert, 10000000},
+    {"hashmap_get_uniform", bench_hashmap_get_uniform, 10000000},
+    {"hashmap_get_skewed", bench_hashmap_get_skewed, 10000000},
+    {"hashmap_get_miss", bench_hashmap_get_miss, 10000000},
+    {"flat_hashmap_insert", bench_flat_hashmap_insert, 10000000},
+    {"flat_hashmap_get_uniform", bench_flat_hashmap_get_uniform, 10000000},
+    {"flat_hashmap_get_skewed", bench_flat_hashmap_get_skewed, 10000000},
+    {"flat_hashmap_get_miss", bench_flat_hashmap_get_miss, 10000000},
+    {"arena_alloc", bench_arena_alloc, 10000000},
+    {"string_builder_append", bench_string_builder_append, 100000000},
+    {"logger_log", bench_logger_log, 10000000},
+    {"logger_log_async", bench_logger_log_async, 10000000},
+    {"file_read_all", bench_file_read_all, 100000000},
+};
+
+static const size_t sizes[] = {1000, 100000, 1000000, 10000000, 100000000};
+
+static long bench_peak_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static bool bench_save(const char *filename, const BenchResult *results, size_t count) {
+    FILE  *file = fopen(filename, "w");
+    size_t i;
+
+    if (!file) {
+        perror(filename);
+        return false;
+    }
+    fprintf(file, "{\n");
+    for (i = 0; i < count; i++) {
+        fprintf(file, "  \"%s\": {\"ns_per_op\": %.3f, \"allocations\": %lu, ", results[i].name,
+                results[i].ns_per_op, (unsigned long) results[i].allocations);
+        fprintf(file, "\"peak_rss_kb\": %ld}%s\n", results[i].peak_rss_kb,
+                i + 1 < count ? "," : "");
+    }
+    fprintf(file, "}\n");
+    return fclose(file) == 0;
+}
+
+/* Only reads the layout bench_save writes, one benchmark per line */
+static size_t bench_load(const char *filename, BenchResult *results, size_t capacity) {
+    char  *text = nx_file_read_all(filename);
+    char  *line;
+    size_t count = 0;
+
+    if (!text) {
+        return 0;
+    }
+    for (line = strtok(text, "\n"); line && count < capacity; line = strtok(NULL, "\n")) {
+        BenchResult  *result = &results[count];
+        unsigned long allocations;
+        if (sscanf(line, " \"%63[^\"]\": {\"ns_per_op\": %lf, \"allocations\": %lu", result->name,
+                   &result->ns_per_op, &allocations) == 3) {
+            result->allocations = (size_t) allocations;
+            count++;
+        }
+    }
+    nx_free(text);
+    return count;
+}
+
+static const BenchResult *bench_find(const BenchResult *results, size_t count, const char *name) {
+    size_t i;
+    for (i = 0; i < count; i++) {
+        if (strcmp(results[i].name, name) == 0) {
+            return &results[i];
+        }
+    }
+    return NULL;
+}
+
+static void print_help(void) {
+    printf("Usage: bench [options]\n\n");
+    printf("Options:\n");
+    printf("  --help, -h           Show this help menu\n");
+    printf("  --max N              Largest size to run, default 1000000 (up to 100000000)\n");
+    printf("  --filter NAME        Only run benchmarks whose name contains NAME\n");
+    printf("  --repeat N           Minimum runs per benchmark, the best is kept, default 3\n");
+    printf("  --save FILE          Write the results as JSON\n");
+    printf("  --baseline FILE      Compare against results written by --save\n");
+    printf("  --threshold PERCENT  Allowed slowdown against the baseline, default 20\n");
+    printf("                       any increase in allocations fails regardless\n");
+}
+
+int main(int argc, char **argv) {
+    static BenchResult results[BENCH_MAX_RESULTS];
+    static BenchResult baseline[BENCH_MAX_RESULTS];
+    size_t             result_count = 0, baseline_count = 0;
+    size_t             max_n = 1000000, repeat = 3;
+    double             threshold     = 20.0;
+    const char        *filter        = NULL;
+    const char        *save_file     = NULL;
+    const char        *baseline_file = NULL;
+    int                regressions   = 0;
+    int                i;
+    size_t             b, s, r;
+
+    for (i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
+            print_help();
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "--max") && has_value) {
+            max_n = (size_t) strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--filter") && has_value) {
+            filter = argv[++i];
+        } else if (!strcmp(argv[i], "--repeat") && has_value) {
+            repeat = nx_max((size_t) strtoul(argv[++i], NULL, 10), (size_t) 1);
+        } else if (!strcmp(argv[i], "--save") && has_value) {
+            save_file = argv[++i];
+        } else if (!strcmp(argv[i], "--baseline") && has_value) {
+            baseline_file = argv[++i];
+        } else if (!strcmp(argv[i], "--threshold") && has_value) {
+            threshold = strtod(argv[++i], NULL);
+        } else {
+            fprintf(stderr, "Unknown option %s, see --help\n", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (baseline_file) {
+        baseline_count = bench_load(baseline_file, baseline, BENCH_MAX_RESULTS);
+        if (baseline_count == 0) {
+            printf("%sNo baseline in %s, run with --save %s to create one.%s\n", COLOR_YELLOW,
+                   baseline_file, baseline_file, COLOR_RESET);
+        }
+    }
+
+    for (b = 0; b < nx_len(benchmarks); b++) {
+        if (filter && !strstr(benchmarks[b].name, filter)) {
+            continue;
+        }
+        for (s = 0; s < nx_len(sizes) && sizes[s] <= nx_min(max_n, benchmarks[b].max_n); s++) {
+            BenchResult       *result = &results[result_count];
+            const BenchResult *base;
+            double             change;
+            /* Small sizes finish in microseconds, more runs keep their best from being noise */
+            size_t runs = nx_max(repeat, nx_min((size_t) 100, (size_t) 100000 / sizes[s]));
+
+            nx_snprintf(result->name, sizeof(result->name), "%s/%lu", benchmarks[b].name,
+                        (unsigned long) sizes[s]);
+            result->ns_per_op = MAX_DOUBLE;
+            for (r = 0; r < runs; r++) {
+                benchmarks[b].func(sizes[s]);
+                if (bench_ns_per_op < result->ns_per_op) {
+                    result->ns_per_op   = bench_ns_per_op;
+                    result->allocations = bench_op_allocations;
+                }
+            }
+            result->peak_rss_kb = bench_peak_rss_kb();
+            result_count++;
+
+            printf("%-36s %12.2f ns/op %10lu allocs %10ld KB peak rss", result->name,
+                   result->ns_per_op, (unsigned long) result->allocations, result->peak_rss_kb);
+            base = bench_find(baseline, baseline_count, result->name);
+            if (base && base->ns_per_op > 0.0) {
+                change = (result->ns_per_op / base->ns_per_op - 1.0) * 100.0;
+                if (change > threshold) {
+                    printf("  %s%+.1f%%%s", COLOR_RED, change, COLOR_RESET);
+                    regressions++;
+                } else {
+                    printf("  %+.1f%%", change);
+                }
+            }
+            /* Allocation counts are deterministic, so any increase is a regression */
+            if (base && result->allocations > base->allocations) {
+                printf("  %s+%lu allocs%s", COLOR_RED,
+                       (unsigned long) (result->allocations - base->allocations), COLOR_RESET);
+                regressions++;
+            }
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+
+    if (save_file && !bench_save(save_file, results, result_count)) {
+        return EXIT_FAILURE;
+    }
+    if (regressions > 0) {
+        printf("%s%d regressions against the baseline, more than %.0f%% slower or more "
+               "allocations.%s\n",
+               COLOR_RED, regressions, threshold, COLOR_RESET);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
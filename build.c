@@ -16,11 +16,12 @@ static void print_help(void) {
     printf("Options:\n");
     printf("  --help, -h       Show this help menu\n");
     printf("  --clean, -c      Remove generated files\n");
+    printf("  --bench, -b      Build and run bench.c, remaining options go to the benchmark\n");
 }
 
 static int clean(const char *files[], size_t file_count) {
     for (size_t i = 0; i < file_count; i++) {
-        if (remove(files[i]) != 0) {
+        if (remove(files[i]) != 0 && errno != ENOENT) {
             perror(files[i]);
             return EXIT_FAILURE;
         }
@@ -28,10 +29,56 @@ static int clean(const char *files[], size_t file_count) {
     return EXIT_SUCCESS;
 }
 
+static int bench(int argc, char **argv) {
+    /* clang-format off */
+    const char *bench_args[] = {
+        "cc",
+        "bench.c",
+        "-o",
+        "bench",
+        "-pthread",
+        "-lm",
+        COMMON_FLAGS
+    };
+    /* clang-format on */
+
+    int result = nx_compile_command("bench", bench_args, nx_len(bench_args), true);
+    if (result != 0) {
+        return result;
+    }
+
+    NXCR *cr = nx_cr_create();
+    if (!cr) {
+        return EXIT_FAILURE;
+    }
+
+    bool has_baseline = false;
+    for (int i = 0; i < argc; i++) {
+        if (!nx_strcmp(argv[i], "--baseline") || !nx_strcmp(argv[i], "--save")) {
+            has_baseline = true;
+        }
+    }
+
+    cr->capture_output = 0;
+    nx_cr_arg(cr, "./bench");
+    if (!has_baseline && nx_file_exists("bench_baseline.json")) {
+        nx_cr_arg(cr, "--baseline");
+        nx_cr_arg(cr, "bench_baseline.json");
+    }
+    for (int i = 0; i < argc; i++) {
+        nx_cr_arg(cr, argv[i]);
+    }
+
+    result = nx_cr_execute(cr);
+    nx_cr_destroy(cr);
+    return result;
+}
+
 int main(int argc, char **argv) {
     NX_REBUILD(argc, argv);
 
-    const char *files_to_remove[] = {"glad.o", "nexus"};
+    const char *files_to_remove[] = {"glad.o", "glad.o.d", "main.o",  "main.o.d", "nexus",
+                                     "bench",  "bench.d",  "build.d", NX_BUILD_CACHE};
 
     for (int i = 1; i < argc; i++) {
         if (!nx_strcmp(argv[i], "--help") || !nx_strcmp(argv[i], "-h")) {
@@ -42,6 +89,10 @@ int main(int argc, char **argv) {
         if (!nx_strcmp(argv[i], "--clean") || !nx_strcmp(argv[i], "-c")) {
             return clean(files_to_remove, nx_len(files_to_remove));
         }
+
+        if (!nx_strcmp(argv[i], "--bench") || !nx_strcmp(argv[i], "-b")) {
+            return bench(argc - i - 1, argv + i + 1);
+        }
     }
 
     /* clang-format off */
@@ -53,26 +104,44 @@ int main(int argc, char **argv) {
         "glad.o"
     };
 
-    const char *nexus_args[] = {
+    const char *main_args[] = {
         "cc",
+        "-c",
         "main.c",
+        "-o",
+        "main.o",
+        "-pthread",
+        COMMON_FLAGS
+    };
+
+    const char *nexus_args[] = {
+        "cc",
+        "main.o",
         "glad.o",
         "-o",
         "nexus",
         "-lglfw",
         "-lm",
+        "-pthread",
         COMMON_FLAGS
     };
     /* clang-format on */
 
-    int glad_result = nx_compile_command("glad", glad_args, nx_len(glad_args), false);
-    if (glad_result != 0) {
-        return glad_result;
+    NXCRPool *pool = nx_cr_pool_create(0);
+    if (!pool) {
+        return EXIT_FAILURE;
     }
 
-    int nexus_result = nx_compile_command("nexus", nexus_args, nx_len(nexus_args), true);
-    if (nexus_result != 0) {
-        return nexus_result;
+    size_t glad   = nx_cr_pool_compile(pool, "glad", glad_args, nx_len(glad_args), false);
+    size_t main_o = nx_cr_pool_compile(pool, "main", main_args, nx_len(main_args), true);
+    size_t nexus  = nx_cr_pool_compile(pool, "nexus", nexus_args, nx_len(nexus_args), false);
+    nx_cr_pool_depend(pool, nexus, glad);
+    nx_cr_pool_depend(pool, nexus, main_o);
+
+    int result = nx_cr_pool_run(pool);
+    nx_cr_pool_destroy(pool);
+    if (result != 0) {
+        return result;
     }
 
     return EXIT_SUCCESS;
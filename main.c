@@ -1,4 +1,5 @@
 #define NX_DEBUG
+#define NX_STATS
 
 #define NXUI_IMPLEMENTATION
 #include "nxui.h"
@@ -39,6 +40,156 @@ static float test_vertices[] = {
 
 static unsigned int test_indices[] = {0, 1, 2};
 
+typedef struct {
+    int   id;
+    float weight;
+} TestItem;
+
+static size_t test_identity_hash(void *key) {
+    return (size_t) key;
+}
+
+static bool test_pointer_equal(void *a, void *b) {
+    return a == b;
+}
+
+#define TEST_INT_HASH(key) ((size_t) (key) * 2654435761u)
+#define TEST_INT_EQUAL(a, b) ((a) == (b))
+#define TEST_ID_HASH(key) ((size_t) (key))
+
+NX_VEC_DEFINE(TestItemVec, TestItem)
+NX_VEC_DEFINE_SMALL(TestSmallVec, int, 4)
+NX_HASHMAP_DEFINE(TestIntMap, int, double, TEST_INT_HASH, TEST_INT_EQUAL)
+NX_HASHMAP_DEFINE(TestIdMap, size_t, size_t, TEST_ID_HASH, TEST_INT_EQUAL)
+
+typedef struct {
+    int        id;
+    NXListLink link;
+} TestListItem;
+
+static void *test_tracker_worker(void *arg) {
+    void *ptrs[1000];
+    int   round, i;
+
+    for (round = 0; round < 10; round++) {
+        for (i = 0; i < 1000; i++) {
+            ptrs[i] = nx_malloc((size_t) i + 1);
+        }
+        for (i = 0; i < 1000; i++) {
+            nx_free(ptrs[i]);
+        }
+    }
+    return arg;
+}
+
+typedef struct {
+    NXArena      *arena;
+    unsigned char id;
+    void         *ptrs[2000];
+    NXArena      *main_scratch;
+} TestArenaJob;
+
+static void *test_arena_worker(void *arg) {
+    TestArenaJob *job = (TestArenaJob *) arg;
+    int           i;
+
+    for (i = 0; i < 2000; i++) {
+        job->ptrs[i] = nx_arena_alloc_aligned(job->arena, 40, (size_t) 8 << (i % 3));
+        if (!job->ptrs[i]) {
+            return NULL;
+        }
+        memset(job->ptrs[i], job->id, 40);
+    }
+    if (nx_scratch_arena() == job->main_scratch || nx_scratch_arena() != nx_scratch_arena()) {
+        return NULL;
+    }
+    nx_arena_alloc(nx_scratch_arena(), 64);
+    return job;
+}
+
+static void *test_pool_worker(void *arg) {
+    NXPool *pool = (NXPool *) arg;
+    void   *blocks[500];
+    int     round, i;
+
+    for (round = 0; round < 20; round++) {
+        for (i = 0; i < 500; i++) {
+            blocks[i] = nx_pool_alloc(pool);
+            if (!blocks[i]) {
+                return NULL;
+            }
+            memset(blocks[i], i & 0xFF, pool->block_size);
+        }
+        for (i = 0; i < 500; i++) {
+            nx_pool_free(pool, blocks[i]);
+        }
+    }
+    return pool;
+}
+
+static void *test_logger_worker(void *arg) {
+    NXLogger *logger = (NXLogger *) arg;
+    int       i;
+
+    for (i = 0; i < 500; i++) {
+        nx_logger_info1(logger, "async line %d", i);
+    }
+    return logger;
+}
+
+#define TEST_ATOMIC_FILE "test_atomic_race.bin"
+
+/* Each thread writes a file filled with its own byte, readers must never see a mix */
+static void *test_atomic_write_worker(void *arg) {
+    static char  data[4][65536];
+    size_t       id = (size_t) arg;
+    NXFileBuffer buffer;
+    int          i;
+
+    memset(data[id], 'a' + (int) id, sizeof(data[id]));
+    buffer.data   = data[id];
+    buffer.length = sizeof(data[id]);
+    for (i = 0; i < 20; i++) {
+        if (nx_file_writev(TEST_ATOMIC_FILE, &buffer, 1, NX_FILE_WRITE_ATOMIC) != 0) {
+            return data[id];
+        }
+    }
+    return NULL;
+}
+
+typedef struct {
+    NXThreadPool *pool;
+    size_t        counter;
+    unsigned char visited[10000];
+} TestParallelJob;
+
+static void test_parallel_visit(size_t begin, size_t end, void *arg) {
+    TestParallelJob *job = (TestParallelJob *) arg;
+    size_t           i;
+
+    for (i = begin; i < end; i++) {
+        job->visited[i]++;
+    }
+    nx_arena_alloc(nx_scratch_arena(), 64);
+    nx_atomic_fetch_add(&job->counter, end - begin);
+}
+
+static void test_parallel_count(size_t begin, size_t end, void *arg) {
+    TestParallelJob *job = (TestParallelJob *) arg;
+    nx_atomic_fetch_add(&job->counter, end - begin);
+}
+
+static void test_parallel_task(void *arg) {
+    TestParallelJob *job = (TestParallelJob *) arg;
+    nx_atomic_fetch_add(&job->counter, 1);
+}
+
+/* Waits on a nested parallel loop from inside a task */
+static void test_parallel_nested(void *arg) {
+    TestParallelJob *job = (TestParallelJob *) arg;
+    nx_parallel_for(job->pool, 0, 1000, 10, test_parallel_count, job);
+}
+
 int main(void) {
     /*************************************************************************
      * 1) Nexus tests
@@ -138,6 +289,43 @@ int main(void) {
             nx_assert((b || b) == false, "(false || false) failed");
         }
 
+        /* Memory tracker: hash index, callsite counters and thread safety */
+        {
+            void     *ptrs[3000];
+            void     *result;
+            pthread_t threads[4];
+            size_t    live = memoryBlockCount;
+            int       i;
+
+            for (i = 0; i < 3000; i++) {
+                ptrs[i] = nx_malloc(16);
+                nx_assert(ptrs[i] != NULL, "nx_malloc failed");
+            }
+            nx_assert(memoryBlockCount == live + 3000, "tracker missed allocations");
+
+            for (i = 0; i < 3000; i += 2) {
+                nx_free(ptrs[i]);
+            }
+            for (i = 1; i < 3000; i += 2) {
+                ptrs[i] = nx_realloc(ptrs[i], 64);
+                nx_assert(ptrs[i] != NULL, "nx_realloc failed");
+            }
+            nx_assert(memoryBlockCount == live + 1500, "tracker lost count after free/realloc");
+            for (i = 1; i < 3000; i += 2) {
+                nx_free(ptrs[i]);
+            }
+            nx_assert(memoryBlockCount == live, "tracker kept freed blocks");
+
+            for (i = 0; i < 4; i++) {
+                nx_assert(pthread_create(&threads[i], NULL, test_tracker_worker, NULL) == 0,
+                          "pthread_create failed");
+            }
+            for (i = 0; i < 4; i++) {
+                pthread_join(threads[i], &result);
+            }
+            nx_assert(memoryBlockCount == live, "concurrent tracking lost blocks");
+        }
+
         /* Arena allocator tests */
         {
             void    *ptr1, *ptr2, *ptr3;
@@ -159,6 +347,235 @@ int main(void) {
             nx_arena_destroy(arena);
         }
 
+        /* Arena alignment, oversized allocations and markers */
+        {
+            void         *small, *large, *ptr;
+            NXArenaMark   mark;
+            NXArenaBlock *block;
+            int           i;
+            NXArena      *arena = nx_arena_create();
+            nx_assert(arena != NULL, "arena_create failed");
+
+            nx_arena_alloc(arena, 3);
+            ptr = nx_arena_alloc_aligned(arena, 128, 64);
+            nx_assert(ptr != NULL && (size_t) ptr % 64 == 0, "arena_alloc_aligned misaligned");
+            nx_assert(nx_arena_alloc_aligned(arena, 8, 24) == NULL, "accepted a bad alignment");
+
+            /* An oversized allocation must not abandon the current block */
+            small = nx_arena_alloc(arena, 16);
+            large = nx_arena_alloc(arena, NX_ARENA_BLOCK_SIZE * 4);
+            nx_assert(large != NULL && arena->large != NULL, "oversized alloc not on large list");
+            ptr = nx_arena_alloc(arena, 16);
+            nx_assert((char *) ptr == (char *) small + 16, "oversized alloc wasted the block");
+
+            mark = nx_arena_mark(arena);
+            for (i = 0; i < 100; i++) {
+                nx_arena_alloc(arena, 256);
+            }
+            nx_arena_alloc(arena, NX_ARENA_BLOCK_SIZE * 2);
+            nx_arena_rewind(arena, mark);
+            nx_assert(arena->large == mark.large, "rewind kept oversized allocations");
+            ptr = nx_arena_alloc(arena, 16);
+            nx_assert((char *) ptr == (char *) small + 32, "rewind did not restore the offset");
+
+            /* Blocks grow geometrically and are reused after a reset */
+            nx_arena_alloc(arena, 256);
+            nx_assert(arena->first->next == NULL || arena->first->next->size > NX_ARENA_BLOCK_SIZE,
+                      "arena blocks did not grow");
+            nx_arena_reset(arena);
+            nx_assert(arena->large == NULL, "reset kept oversized allocations");
+            for (i = 0; i < 100; i++) {
+                nx_arena_alloc(arena, 256);
+            }
+            for (i = 0, block = arena->first; block; block = block->next) {
+                i++;
+            }
+            nx_assert(i <= 4, "reset did not reuse the existing blocks");
+
+            nx_arena_destroy(arena);
+        }
+
+        /* Pool allocator tests */
+        {
+            void   *ptr1, *ptr2, *ptr3;
+            int     i;
+            NXPool *pool = nx_pool_create(24, 4);
+            nx_assert(pool != NULL, "pool_create failed");
+
+            ptr1 = nx_pool_alloc(pool);
+            ptr2 = nx_pool_alloc(pool);
+            nx_assert(ptr1 != NULL && ptr2 != NULL && ptr1 != ptr2, "pool_alloc failed");
+
+            nx_pool_free(pool, ptr1);
+            ptr3 = nx_pool_alloc(pool);
+            nx_assert(ptr3 == ptr1, "pool_alloc did not reuse the freed block");
+
+            /* Spill over into more slabs */
+            for (i = 0; i < 10; i++) {
+                nx_assert(nx_pool_alloc(pool) != NULL, "pool_alloc failed on a new slab");
+            }
+
+            nx_pool_reset(pool);
+            nx_assert(nx_pool_alloc(pool) == ptr1, "pool_reset did not rewind to the first slab");
+            nx_assert((size_t) ptr1 % NX_CACHE_LINE_SIZE == 0, "pool slab is not cache aligned");
+
+            nx_pool_destroy(pool);
+        }
+
+        /* Concurrent pool with per-thread caches */
+        {
+            pthread_t threads[4];
+            void     *result;
+            int       i;
+            NXPool   *pool = nx_pool_create_concurrent(48, 0);
+            nx_assert(pool != NULL, "pool_create_concurrent failed");
+
+            for (i = 0; i < 4; i++) {
+                nx_assert(pthread_create(&threads[i], NULL, test_pool_worker, pool) == 0,
+                          "pthread_create failed");
+            }
+            for (i = 0; i < 4; i++) {
+                pthread_join(threads[i], &result);
+                nx_assert(result == pool, "concurrent pool worker failed");
+            }
+            nx_assert(pool->caches == NULL, "thread caches were not released on exit");
+
+            /* The main thread gets a cache of its own, destroy must free it */
+            nx_pool_free(pool, nx_pool_alloc(pool));
+            nx_pool_destroy(pool);
+        }
+
+        /* Arena and pool backed containers */
+        {
+            NXArena            *arena = nx_arena_create();
+            NXPool             *pool  = nx_pool_create(sizeof(NXDLLNode), 0);
+            NXSinglyLinkedList *sll;
+            NXDoublyLinkedList *dll;
+            NXHashMap          *map;
+            int                 a = 1, b = 2, c = 3;
+            char                keys[100][8];
+            int                 i;
+
+            nx_assert(arena != NULL && pool != NULL, "allocator creation failed");
+
+            sll = nx_sll_create_ex(arena, NULL);
+            nx_assert(sll != NULL, "nx_sll_create_ex failed");
+            nx_sll_append(sll, &a);
+            nx_sll_append(sll, &b);
+            nx_sll_remove(sll, &a);
+            nx_assert(sll->head->data == &b && sll->tail->data == &b, "arena sll failed");
+            nx_sll_destroy(sll);
+
+            dll = nx_dll_create_ex(NULL, pool);
+            nx_assert(dll != NULL, "nx_dll_create_ex failed");
+            nx_dll_append(dll, &a);
+            nx_dll_append(dll, &b);
+            nx_dll_prepend(dll, &c);
+            nx_dll_remove(dll, &a);
+            nx_assert(dll->head->data == &c && dll->head->next->data == &b, "pool dll failed");
+            nx_dll_destroy(dll);
+
+            nx_assert(nx_hashmap_create_ex(NULL, NULL, NULL, pool) == NULL,
+                      "hashmap accepted a pool with too small blocks");
+
+            map = nx_hashmap_create_ex(NULL, NULL, arena, NULL);
+            nx_assert(map != NULL, "nx_hashmap_create_ex failed");
+            for (i = 0; i < 100; i++) {
+                nx_snprintf(keys[i], sizeof(keys[i]), "k%d", i);
+                nx_assert(nx_hashmap_insert(map, keys[i], &keys[i]), "arena map insert failed");
+            }
+            nx_assert(nx_hashmap_get(map, keys[42]) == &keys[42], "arena map get failed");
+            nx_assert(nx_hashmap_remove(map, keys[42]), "arena map remove failed");
+            nx_hashmap_destroy(map);
+
+            /* Releases the list and the map in one go */
+            nx_arena_reset(arena);
+
+            nx_pool_destroy(pool);
+            nx_arena_destroy(arena);
+        }
+
+        /* Concurrent arena and per-thread scratch arenas */
+        {
+            pthread_t     threads[4];
+            TestArenaJob *jobs;
+            void         *result;
+            int           i, j, k;
+            NXArena      *arena = nx_arena_create_concurrent();
+            nx_assert(arena != NULL, "arena_create_concurrent failed");
+
+            jobs = (TestArenaJob *) nx_malloc(sizeof(TestArenaJob) * 4);
+            nx_assert(jobs != NULL, "failed to allocate arena jobs");
+            for (i = 0; i < 4; i++) {
+                jobs[i].arena        = arena;
+                jobs[i].id           = (unsigned char) (i + 1);
+                jobs[i].main_scratch = nx_scratch_arena();
+                nx_assert(pthread_create(&threads[i], NULL, test_arena_worker, &jobs[i]) == 0,
+                          "pthread_create failed");
+            }
+            for (i = 0; i < 4; i++) {
+                pthread_join(threads[i], &result);
+                nx_assert(result == &jobs[i], "concurrent arena worker failed");
+            }
+
+            /* No two threads may have been handed overlapping memory */
+            for (i = 0; i < 4; i++) {
+                for (j = 0; j < 2000; j++) {
+                    unsigned char *bytes = (unsigned char *) jobs[i].ptrs[j];
+                    nx_assert((size_t) bytes % ((size_t) 8 << (j % 3)) == 0,
+                              "concurrent arena misaligned");
+                    for (k = 0; k < 40; k++) {
+                        nx_assert(bytes[k] == jobs[i].id, "concurrent arena overlap");
+                    }
+                }
+            }
+            nx_arena_alloc(nx_scratch_arena(), 128);
+            nx_scratch_reset();
+            nx_assert(nx_scratch_arena()->first->used == 0, "nx_scratch_reset failed");
+
+            nx_free(jobs);
+            nx_arena_destroy(arena);
+        }
+
+        /* Work-stealing thread pool */
+        {
+            NXThreadPool    *pool = nx_thread_pool_create(4);
+            TestParallelJob *job  = (TestParallelJob *) nx_calloc(1, sizeof(TestParallelJob));
+            NXTaskGroup      group;
+            size_t           i;
+
+            nx_assert(pool != NULL && pool->worker_count == 4, "nx_thread_pool_create failed");
+            nx_assert(nx_cpu_count() >= 1, "nx_cpu_count failed");
+            job->pool = pool;
+
+            group.pending = 0;
+            for (i = 0; i < 5000; i++) {
+                nx_thread_pool_submit(pool, &group, test_parallel_task, job);
+            }
+            nx_task_group_wait(pool, &group);
+            nx_assert(group.pending == 0 && job->counter == 5000, "thread pool lost tasks");
+
+            job->counter = 0;
+            nx_parallel_for(pool, 0, 10000, 64, test_parallel_visit, job);
+            nx_assert(job->counter == 10000, "nx_parallel_for count mismatch");
+            for (i = 0; i < 10000; i++) {
+                nx_assert(job->visited[i] == 1, "nx_parallel_for visited an index twice");
+            }
+            nx_parallel_for(pool, 5, 5, 64, test_parallel_visit, job);
+            nx_assert(job->counter == 10000, "nx_parallel_for ran an empty range");
+
+            /* Tasks that wait on their own loops help run them instead of deadlocking */
+            job->counter = 0;
+            for (i = 0; i < 16; i++) {
+                nx_thread_pool_submit(pool, &group, test_parallel_nested, job);
+            }
+            nx_task_group_wait(pool, &group);
+            nx_assert(job->counter == 16000, "nested nx_parallel_for count mismatch");
+
+            nx_thread_pool_destroy(pool);
+            nx_free(job);
+        }
+
         /* Single Linked List Tests */
         {
             NXSinglyLinkedList *list = nx_sll_create();
@@ -177,6 +594,10 @@ int main(void) {
             nx_sll_remove(list, &b);
             nx_assert(*(int *) list->tail->data == 1, "nx_sll_remove failed");
 
+            nx_assert(nx_sll_pop_front(list) == &c && list->head->data == &a,
+                      "nx_sll_pop_front failed");
+            nx_assert(nx_sll_prepend(list, &b) == list->head, "prepend did not return the node");
+
             nx_sll_destroy(list);
         }
 
@@ -201,6 +622,70 @@ int main(void) {
             nx_dll_destroy(list);
         }
 
+        /* Doubly Linked List Node Handles */
+        {
+            NXDoublyLinkedList *list = nx_dll_create();
+            NXDLLNode          *na, *nb, *nc;
+            int                 a = 1, b = 2, c = 3;
+
+            na = nx_dll_append(list, &a);
+            nb = nx_dll_append(list, &b);
+            nc = nx_dll_append(list, &c);
+            nx_assert(na && nb && nc && nb->data == &b, "append did not return the node");
+
+            nx_dll_move_to_front(list, nc);
+            nx_assert(list->head == nc && nc->next == na && list->tail == nb,
+                      "nx_dll_move_to_front failed");
+            nx_dll_move_to_front(list, nb);
+            nx_assert(list->head == nb && list->tail == na && na->prev == nc,
+                      "nx_dll_move_to_front of the tail failed");
+
+            nx_dll_remove_node(list, nc);
+            nx_assert(nb->next == na && na->prev == nb, "nx_dll_remove_node failed");
+
+            nx_assert(nx_dll_pop_back(list) == &a && list->tail == nb, "nx_dll_pop_back failed");
+            nx_assert(nx_dll_pop_front(list) == &b, "nx_dll_pop_front failed");
+            nx_assert(!list->head && !list->tail && !nx_dll_pop_back(list),
+                      "popping an empty list failed");
+
+            nx_dll_destroy(list);
+        }
+
+        /* Intrusive List */
+        {
+            TestListItem items[4];
+            NXListLink   head;
+            NXListLink  *link, *tmp;
+            int          sum = 0;
+            int          i;
+
+            nx_list_init(&head);
+            nx_assert(nx_list_empty(&head) && !nx_list_first(&head), "nx_list_init failed");
+
+            for (i = 0; i < 4; i++) {
+                items[i].id = i;
+                nx_list_push_back(&head, &items[i].link);
+            }
+            nx_assert(nx_list_entry(nx_list_first(&head), TestListItem, link)->id == 0,
+                      "nx_list_push_back failed");
+
+            nx_list_move_to_front(&head, &items[2].link);
+            nx_list_remove(&items[0].link);
+            nx_list_remove(&items[0].link);
+            nx_assert(nx_list_entry(head.next, TestListItem, link)->id == 2 &&
+                          nx_list_entry(head.next->next, TestListItem, link)->id == 1,
+                      "nx_list_move_to_front failed");
+
+            link = nx_list_pop_back(&head);
+            nx_assert(link == &items[3].link, "nx_list_pop_back failed");
+
+            nx_list_foreach(link, tmp, &head) {
+                sum += nx_list_entry(link, TestListItem, link)->id;
+                nx_list_remove(link);
+            }
+            nx_assert(sum == 3 && nx_list_empty(&head), "nx_list_foreach failed");
+        }
+
         /* Hashmap Tests */
         {
             char *key1, *key2, *key3;
@@ -234,6 +719,245 @@ int main(void) {
             nx_hashmap_destroy(map);
         }
 
+        /* nx_hash_bytes: word-at-a-time hash with a byte-wise tail */
+        {
+            const char *text = "the quick brown fox";
+            nx_assert(nx_hash_bytes(text, strlen(text)) == nx_hash_bytes(text, strlen(text)),
+                      "nx_hash_bytes is not deterministic");
+            nx_assert(nx_hash_bytes("abcdefghi", 9) != nx_hash_bytes("abcdefghj", 9),
+                      "nx_hash_bytes ignored a tail byte");
+            nx_assert(nx_hash_bytes("", 0) != nx_hash_bytes("\0", 1),
+                      "nx_hash_bytes ignored the length");
+        }
+
+        /* Incremental Hashmap Tests */
+        {
+            char keys[1000][16];
+            int  values[1000];
+            int *result;
+            int  i;
+            bool saw_resize = false;
+
+            NXHashMap *map = nx_hashmap_create(NULL, NULL);
+            nx_assert(map != NULL, "nx_hashmap_create failed");
+            nx_hashmap_set_incremental(map, true);
+
+            for (i = 0; i < 1000; i++) {
+                nx_snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+                values[i] = i;
+                nx_assert(nx_hashmap_insert(map, keys[i], &values[i]), "incremental insert failed");
+                if (map->old_buckets) {
+                    saw_resize = true;
+                    /* Every key must stay reachable while both tables are live */
+                    result = (int *) nx_hashmap_get(map, keys[i / 2]);
+                    nx_assert(result && *result == i / 2, "get failed during resize");
+                }
+            }
+            nx_assert(saw_resize, "incremental resize never started");
+            nx_assert(map->size == 1000, "incremental size mismatch");
+            nx_assert((map->capacity & (map->capacity - 1)) == 0, "capacity not a power of two");
+
+            for (i = 0; i < 1000; i += 2) {
+                nx_assert(nx_hashmap_remove(map, keys[i]), "incremental remove failed");
+            }
+            for (i = 0; i < 1000; i++) {
+                result = (int *) nx_hashmap_get(map, keys[i]);
+                nx_assert((i % 2 == 0) == (result == NULL), "incremental get after remove");
+            }
+
+            nx_hashmap_set_incremental(map, false);
+            nx_assert(map->old_buckets == NULL, "disabling incremental left a resize pending");
+
+            nx_hashmap_destroy(map);
+        }
+
+        /* Flat Hashmap Tests */
+        {
+            char keys[1000][16];
+            int  values[1000];
+            int *result;
+            int  i;
+
+            NXHashMap *map = nx_hashmap_create_flat(NULL, NULL);
+            nx_assert(map != NULL, "nx_hashmap_create_flat failed");
+
+            for (i = 0; i < 1000; i++) {
+                nx_snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+                values[i] = i;
+                nx_assert(nx_hashmap_insert(map, keys[i], &values[i]), "flat insert failed");
+            }
+            nx_assert(map->size == 1000, "flat size mismatch after insert");
+
+            for (i = 0; i < 1000; i++) {
+                result = (int *) nx_hashmap_get(map, keys[i]);
+                nx_assert(result && *result == i, "flat get failed");
+            }
+            nx_assert(nx_hashmap_get(map, "missing") == NULL, "flat get found missing key");
+
+            nx_assert(nx_hashmap_insert(map, keys[7], &values[8]), "flat overwrite failed");
+            result = (int *) nx_hashmap_get(map, keys[7]);
+            nx_assert(result && *result == 8, "flat overwrite not visible");
+            nx_assert(map->size == 1000, "flat overwrite changed size");
+
+            for (i = 0; i < 1000; i += 2) {
+                nx_assert(nx_hashmap_remove(map, keys[i]), "flat remove failed");
+            }
+            nx_assert(!nx_hashmap_remove(map, keys[0]), "flat double remove succeeded");
+            nx_assert(map->size == 500, "flat size mismatch after remove");
+
+            for (i = 0; i < 1000; i++) {
+                result = (int *) nx_hashmap_get(map, keys[i]);
+                nx_assert((i % 2 == 0) == (result == NULL), "flat get after remove failed");
+            }
+
+            /* Reinserting reuses the tombstones */
+            for (i = 0; i < 1000; i += 2) {
+                nx_assert(nx_hashmap_insert(map, keys[i], &values[i]), "flat reinsert failed");
+            }
+            result = (int *) nx_hashmap_get(map, keys[998]);
+            nx_assert(result && *result == 998, "flat get after reinsert failed");
+
+            nx_hashmap_destroy(map);
+        }
+
+        /* Flat Hashmap With An Identity Hash */
+        {
+            NXHashMap *map = nx_hashmap_create_flat(test_identity_hash, test_pointer_equal);
+            size_t     i;
+
+            nx_assert(map != NULL, "nx_hashmap_create_flat failed");
+            for (i = 1; i <= 4096; i++) {
+                nx_assert(nx_hashmap_insert(map, (void *) i, (void *) i), "identity insert failed");
+            }
+            nx_stats_reset();
+            for (i = 1; i <= 4096; i++) {
+                nx_assert(nx_hashmap_get(map, (void *) i) == (void *) i, "identity get failed");
+            }
+            nx_assert(nx_stats.hashmap_max_probe <= 8, "sequential keys share probe chains");
+            nx_hashmap_destroy(map);
+        }
+
+        /* Typed vectors */
+        {
+            TestItemVec  items;
+            TestSmallVec small;
+            TestItem     item;
+            NXArena     *arena = nx_arena_create();
+            int          i;
+
+            TestItemVec_init(&items);
+            for (i = 0; i < 100; i++) {
+                item.id     = i;
+                item.weight = (float) i * 0.5f;
+                TestItemVec_push(&items, item);
+            }
+            nx_assert(items.size == 100 && items.capacity >= 100, "vector push size mismatch");
+            nx_assert(items.data[42].id == 42 && items.data[42].weight == 21.0f,
+                      "vector element mismatch");
+
+            item.id = -1;
+            TestItemVec_insert(&items, 0, item);
+            TestItemVec_insert(&items, items.size, item);
+            nx_assert(items.data[0].id == -1 && items.data[1].id == 0 && items.data[101].id == -1,
+                      "vector insert mismatch");
+            TestItemVec_erase(&items, 0);
+            nx_assert(TestItemVec_pop(&items).id == -1 && items.size == 100,
+                      "vector erase or pop mismatch");
+            nx_assert(items.data[0].id == 0 && items.data[99].id == 99, "vector order mismatch");
+
+            TestItemVec_clear(&items);
+            TestItemVec_reserve(&items, 1000);
+            nx_assert(items.size == 0 && items.capacity == 1000, "vector reserve mismatch");
+            TestItemVec_destroy(&items);
+
+            /* Small vectors only leave their inline storage once it is full */
+            TestSmallVec_init(&small);
+            for (i = 0; i < 4; i++) {
+                TestSmallVec_push(&small, i);
+            }
+            nx_assert(small.data == small.inline_data && !small.owned, "small vector allocated");
+            TestSmallVec_push(&small, 4);
+            nx_assert(small.data != small.inline_data && small.owned, "small vector did not grow");
+            for (i = 0; i < 5; i++) {
+                nx_assert(small.data[i] == i, "small vector lost elements when growing");
+            }
+            TestSmallVec_destroy(&small);
+
+            TestSmallVec_init_arena(&small, arena);
+            for (i = 0; i < 50; i++) {
+                TestSmallVec_push(&small, i);
+            }
+            nx_assert(!small.owned && small.data[49] == 49, "arena vector mismatch");
+            TestSmallVec_destroy(&small);
+            nx_arena_destroy(arena);
+        }
+
+        /* Typed hashmap */
+        {
+            TestIntMap map;
+            double    *value;
+            int        i;
+
+            TestIntMap_init(&map);
+            nx_assert(TestIntMap_get(&map, 1) == NULL, "empty typed map found a key");
+            nx_assert(!TestIntMap_remove(&map, 1), "empty typed map removed a key");
+
+            for (i = 0; i < 1000; i++) {
+                nx_assert(TestIntMap_insert(&map, i, (double) i / 2.0), "typed insert failed");
+            }
+            nx_assert(map.size == 1000, "typed map size mismatch");
+            for (i = 0; i < 1000; i++) {
+                value = TestIntMap_get(&map, i);
+                nx_assert(value && *value == (double) i / 2.0, "typed get failed");
+            }
+            nx_assert(TestIntMap_get(&map, 1000) == NULL, "typed get found missing key");
+
+            nx_assert(TestIntMap_insert(&map, 7, -1.0), "typed overwrite failed");
+            nx_assert(*TestIntMap_get(&map, 7) == -1.0 && map.size == 1000,
+                      "typed overwrite mismatch");
+
+            for (i = 0; i < 1000; i += 2) {
+                nx_assert(TestIntMap_remove(&map, i), "typed remove failed");
+            }
+            nx_assert(map.size == 500, "typed map size mismatch after remove");
+            for (i = 0; i < 1000; i++) {
+                nx_assert((i % 2 == 0) == (TestIntMap_get(&map, i) == NULL),
+                          "typed get after remove failed");
+            }
+            for (i = 0; i < 1000; i += 2) {
+                nx_assert(TestIntMap_insert(&map, i, 0.0), "typed reinsert failed");
+            }
+            nx_assert(map.size == 1000, "typed map size mismatch after reinsert");
+            TestIntMap_destroy(&map);
+        }
+
+        /* Typed hashmap with an identity hash */
+        {
+            TestIdMap map;
+            size_t    group_mask, group, step, max_step = 0;
+            size_t    i;
+
+            TestIdMap_init(&map);
+            for (i = 0; i < 4096; i++) {
+                nx_assert(TestIdMap_insert(&map, i, i), "identity typed insert failed");
+            }
+            /* Walk each key's probe sequence from its home group to the group it ended up in */
+            group_mask = map.capacity / NX_HASHMAP_GROUP_WIDTH - 1;
+            for (i = 0; i < 4096; i++) {
+                size_t         *hit   = TestIdMap_get(&map, i);
+                TestIdMap_slot *slot  = nx_container_of(hit, TestIdMap_slot, value);
+                size_t          found = (size_t) (slot - map.slots) / NX_HASHMAP_GROUP_WIDTH;
+
+                group = (_TestIdMap_hash(i) >> 7) & group_mask;
+                for (step = 0; group != found && step <= group_mask; step++) {
+                    group = (group + step + 1) & group_mask;
+                }
+                max_step = nx_max(max_step, step);
+            }
+            nx_assert(max_step <= 8, "sequential keys share typed probe chains");
+            TestIdMap_destroy(&map);
+        }
+
         /* String Builder Tests */
         {
             NXStringBuilder *sb = nx_string_builder_create();
@@ -283,6 +1007,38 @@ int main(void) {
             nx_string_builder_destroy(sb);
         }
 
+        /* String Builder append_n / appendf / reserve / detach Tests */
+        {
+            char             big[1000];
+            char            *detached;
+            NXStringBuilder *sb = nx_string_builder_create();
+            nx_assert(sb != NULL, "Failed to create NXStringBuilder");
+
+            nx_string_builder_append_n(sb, "Hello, World", 5);
+            nx_assert(sb->length == 5, "append_n length mismatch");
+            nx_assert(strcmp(nx_string_builder_to_cstring(sb), "Hello") == 0, "append_n failed");
+
+            nx_string_builder_appendf(sb, " %d-%s", 42, "nexus");
+            nx_assert(strcmp(nx_string_builder_to_cstring(sb), "Hello 42-nexus") == 0,
+                      "appendf failed");
+
+            /* Forces the second formatting pass past the initial capacity */
+            memset(big, 'x', sizeof(big) - 1);
+            big[sizeof(big) - 1] = '\0';
+            nx_string_builder_appendf(sb, "[%s]", big);
+            nx_assert(sb->length == 14 + 2 + 999, "appendf growth length mismatch");
+            nx_assert(sb->buffer[15] == 'x' && sb->buffer[sb->length - 1] == ']',
+                      "appendf growth content mismatch");
+            nx_assert(sb->buffer[sb->length] == '\0', "appendf missing terminator");
+
+            nx_string_builder_reserve(sb, 10000);
+            nx_assert(sb->capacity > sb->length + 10000, "reserve did not grow");
+
+            detached = nx_string_builder_detach(sb);
+            nx_assert(strncmp(detached, "Hello 42-nexus[x", 16) == 0, "detach lost contents");
+            nx_free(detached);
+        }
+
         /* FileIO Tests */
         {
             /* nx_file_open / nx_file_close */
@@ -374,6 +1130,200 @@ int main(void) {
                 remove(empty_filename);
             }
 
+            /* nx_file_write_n / nx_file_writev */
+            {
+                const char   *test_filename = "test_writev.bin";
+                unsigned char body[]        = {'b', 0x00, 'o', 0x00, 'd', 'y'};
+                NXFileBuffer  buffers[2];
+                NXFileMap    *map;
+                struct stat   mode_stat;
+                int           result;
+
+                nx_assert(nx_file_write_n(test_filename, body, sizeof(body)) == 0,
+                          "nx_file_write_n failed");
+                nx_assert(nx_file_size(test_filename) == (long) sizeof(body),
+                          "nx_file_write_n stopped at a NUL byte");
+
+                buffers[0].data   = "header:";
+                buffers[0].length = 7;
+                buffers[1].data   = body;
+                buffers[1].length = sizeof(body);
+                nx_assert(nx_file_writev(test_filename, buffers, 2,
+                                         NX_FILE_WRITE_ATOMIC | NX_FILE_WRITE_SYNC) == 0,
+                          "atomic nx_file_writev failed");
+
+                map = nx_file_map(test_filename, 0);
+                nx_assert(map && map->length == 7 + sizeof(body), "nx_file_writev length mismatch");
+                nx_assert(memcmp(map->data, "header:", 7) == 0 &&
+                              memcmp(map->data + 7, body, sizeof(body)) == 0,
+                          "nx_file_writev contents mismatch");
+                nx_file_unmap(map);
+
+                nx_assert(chmod(test_filename, 0750) == 0, "chmod failed");
+                nx_assert(nx_file_writev(test_filename, buffers, 1, NX_FILE_WRITE_ATOMIC) == 0,
+                          "atomic nx_file_writev over an existing file failed");
+                nx_assert(stat(test_filename, &mode_stat) == 0, "stat failed");
+                nx_assert((mode_stat.st_mode & 0777) == 0750,
+                          "atomic nx_file_writev dropped the file mode");
+
+                result = nx_file_writev("no_such_dir/file.bin", buffers, 2, NX_FILE_WRITE_ATOMIC);
+                nx_assert(result == -1, "nx_file_writev into missing directory should fail");
+                remove(test_filename);
+            }
+
+            /* Concurrent atomic writes to one path */
+            {
+                pthread_t threads[4];
+                void     *failed;
+                char     *contents;
+                size_t    i;
+
+                for (i = 0; i < 4; i++) {
+                    nx_assert(pthread_create(&threads[i], NULL, test_atomic_write_worker,
+                                             (void *) i) == 0,
+                              "pthread_create failed");
+                }
+                for (i = 0; i < 4; i++) {
+                    pthread_join(threads[i], &failed);
+                    nx_assert(failed == NULL, "concurrent atomic write failed");
+                }
+
+                contents = nx_file_read_all(TEST_ATOMIC_FILE);
+                nx_assert(contents != NULL && strlen(contents) == 65536,
+                          "concurrent atomic write left a partial file");
+                for (i = 1; i < 65536; i++) {
+                    nx_assert(contents[i] == contents[0], "concurrent atomic writes were mixed");
+                }
+                nx_free(contents);
+                remove(TEST_ATOMIC_FILE);
+            }
+
+            /* nx_file_map / nx_file_unmap */
+            {
+                const char *test_filename  = "test_map.txt";
+                const char *empty_filename = "test_map_empty.txt";
+                NXFileMap  *map;
+                char       *contents;
+
+                nx_assert(nx_file_write_all(test_filename, "mapped contents") == 0,
+                          "nx_file_write_all failed for map test");
+
+                map = nx_file_map(test_filename, NX_FILE_MAP_SEQUENTIAL);
+                nx_assert(map != NULL, "nx_file_map failed");
+                nx_assert(map->length == 15, "nx_file_map length mismatch");
+                nx_assert(memcmp(map->data, "mapped contents", 15) == 0,
+                          "nx_file_map data mismatch");
+                nx_file_unmap(map);
+
+                map = nx_file_map(test_filename, NX_FILE_MAP_COPY_ON_WRITE | NX_FILE_MAP_RANDOM);
+                nx_assert(map != NULL, "nx_file_map copy-on-write failed");
+                map->data[0] = 'M';
+                nx_file_unmap(map);
+                contents = nx_file_read_all(test_filename);
+                nx_assert(contents && contents[0] == 'm', "copy-on-write map modified the file");
+                nx_free(contents);
+
+                nx_assert(nx_file_write_all(empty_filename, "") == 0,
+                          "failed to create empty file");
+                map = nx_file_map(empty_filename, 0);
+                nx_assert(map != NULL && map->length == 0 && !map->mapped,
+                          "empty file should use the read fallback");
+                nx_file_unmap(map);
+
+                nx_assert(nx_file_map("no_such_file.txt", 0) == NULL, "nx_file_map missing file");
+
+                remove(test_filename);
+                remove(empty_filename);
+            }
+
+            /* NXFileReader chunks and lines */
+            {
+                const char      *test_filename = "test_reader.txt";
+                NXStringBuilder *sb            = nx_string_builder_create();
+                NXFile          *file;
+                NXFileReader    *reader;
+                const char      *line;
+                const char      *chunk;
+                size_t           length, total;
+                int              count;
+
+                nx_string_builder_append(sb, "short\n\n");
+                for (count = 0; count < 300; count++) {
+                    nx_string_builder_append_char(sb, (char) ('a' + count % 26));
+                }
+                nx_string_builder_append(sb, "\nlast line without newline");
+                nx_assert(nx_file_write_all(test_filename, sb->buffer) == 0,
+                          "nx_file_write_all failed for reader test");
+
+                file   = nx_file_open(test_filename, "rb");
+                reader = nx_file_reader_create(file, 16);
+                nx_assert(reader != NULL, "nx_file_reader_create failed");
+
+                nx_assert(nx_file_next_line(reader, &line, &length), "missing first line");
+                nx_assert(length == 5 && memcmp(line, "short", 5) == 0, "first line mismatch");
+                nx_assert(nx_file_next_line(reader, &line, &length) && length == 0,
+                          "empty line mismatch");
+                nx_assert(nx_file_next_line(reader, &line, &length), "missing long line");
+                nx_assert(length == 300 && line[0] == 'a' && line[299] == 'n',
+                          "long line mismatch");
+                nx_assert(nx_file_next_line(reader, &line, &length), "missing last line");
+                nx_assert(length == 25 && memcmp(line, "last line without newline", 25) == 0,
+                          "last line mismatch");
+                nx_assert(!nx_file_next_line(reader, &line, &length), "read past end of file");
+                nx_file_reader_destroy(reader);
+                nx_file_close(file);
+
+                file   = nx_file_open(test_filename, "rb");
+                reader = nx_file_reader_create(file, 0);
+                total  = 0;
+                while ((length = nx_file_read_chunk(reader, &chunk)) > 0) {
+                    nx_assert(memcmp(chunk, sb->buffer + total, length) == 0, "chunk mismatch");
+                    total += length;
+                }
+                nx_assert(total == sb->length, "chunked read length mismatch");
+                nx_file_reader_destroy(reader);
+                nx_file_close(file);
+
+                nx_string_builder_destroy(sb);
+                remove(test_filename);
+            }
+
+            /* nx_file_stat / nx_file_stat_batch */
+            {
+                const char *names[3];
+                NXFileStat  stats[3];
+                NXFileStat  st;
+
+                nx_assert(nx_file_write_all("test_stat.txt", "12345") == 0,
+                          "nx_file_write_all failed for stat test");
+
+                nx_assert(nx_file_stat("test_stat.txt", &st) == 0, "nx_file_stat failed");
+                nx_assert(st.type == NX_FILE_TYPE_REGULAR && st.size == 5,
+                          "nx_file_stat type or size mismatch");
+                nx_assert(st.mtime_sec > 0 && st.mtime_nsec >= 0 && st.mtime_nsec < 1000000000L,
+                          "nx_file_stat mtime out of range");
+                nx_assert(nx_file_stat("no_such_file.txt", &st) == -1 &&
+                              st.type == NX_FILE_TYPE_NONE,
+                          "nx_file_stat missing file");
+
+                names[0] = "test_stat.txt";
+                names[1] = "no_such_file.txt";
+                names[2] = ".";
+                nx_assert(nx_file_stat_batch(AT_FDCWD, names, 3, stats) == 2,
+                          "nx_file_stat_batch found count mismatch");
+                nx_assert(stats[0].type == NX_FILE_TYPE_REGULAR && stats[0].size == 5,
+                          "nx_file_stat_batch regular file mismatch");
+                nx_assert(stats[1].type == NX_FILE_TYPE_NONE, "nx_file_stat_batch missing file");
+                nx_assert(stats[2].type == NX_FILE_TYPE_DIRECTORY, "nx_file_stat_batch directory");
+
+                st = stats[0];
+                st.mtime_nsec++;
+                nx_assert(nx_file_stat_newer(&st, &stats[0]) && !nx_file_stat_newer(&stats[0], &st),
+                          "nx_file_stat_newer ignored nanoseconds");
+
+                remove("test_stat.txt");
+            }
+
             /* nx_file_read_all with binary data */
             {
                 const char   *test_filename = "test_binary.bin";
@@ -465,6 +1415,344 @@ int main(void) {
             remove("log.txt");
             nx_logger_destroy(logger);
         }
+
+        /* Logging timestamps and flush policy */
+        {
+            NXLogger *logger;
+            char     *log_contents;
+            char     *dot;
+
+            remove("policy.txt");
+            logger = nx_logger_create("policy.txt", false, true, NX_LOG_TRACE);
+            nx_assert(logger != NULL, "nx_logger_create failed");
+            nx_logger_set_time_precision(logger, NX_LOG_TIME_MILLIS);
+            nx_logger_set_flush_policy(logger, NX_LOG_FLUSH_LINES, 3);
+
+            nx_logger_info(logger, "first");
+            nx_logger_info(logger, "second");
+            log_contents = nx_file_read_all("policy.txt");
+            nx_assert(log_contents && log_contents[0] == '\0', "flushed before policy allowed");
+            nx_free(log_contents);
+
+            nx_logger_info(logger, "third");
+            log_contents = nx_file_read_all("policy.txt");
+            nx_assert(log_contents && strstr(log_contents, "] [INFO] third\n"),
+                      "line policy did not flush");
+            dot = strchr(log_contents, '.');
+            nx_assert(dot && dot[4] == ']' && dot[1] >= '0' && dot[1] <= '9',
+                      "millisecond timestamp malformed");
+            nx_free(log_contents);
+
+            nx_logger_set_flush_policy(logger, NX_LOG_FLUSH_ERROR, 0);
+            nx_logger_info(logger, "buffered");
+            nx_logger_error(logger, "urgent");
+            log_contents = nx_file_read_all("policy.txt");
+            nx_assert(log_contents && strstr(log_contents, "[ERROR] urgent\n"),
+                      "error did not flush");
+            nx_free(log_contents);
+
+            nx_logger_destroy(logger);
+            remove("policy.txt");
+        }
+
+        /* NXCR argv execution and no-capture mode */
+        {
+            NXCR *cr = nx_cr_create();
+            nx_assert(cr != NULL, "nx_cr_create failed");
+
+            /* No shell, so the quote and the $ reach printf untouched */
+            nx_cr_arg(cr, "printf");
+            nx_cr_arg(cr, "%s|%s");
+            nx_cr_arg(cr, "it's");
+            nx_cr_arg(cr, "$HOME two");
+            nx_assert(nx_cr_execute(cr) == 0, "argv execution failed");
+            nx_assert(strcmp(nx_cr_get_output(cr), "it's|$HOME two") == 0,
+                      "argv arguments were not passed verbatim");
+            nx_assert(cr->argc == 0, "argv not cleared after execution");
+
+            nx_cr_arg_split(cr, "  sh -c   true ");
+            nx_assert(cr->argc == 3 && strcmp(cr->argv[2], "true") == 0, "nx_cr_arg_split failed");
+            nx_assert(nx_cr_execute(cr) == 0, "split argv execution failed");
+
+            nx_cr_arg(cr, "no_such_program_nexus");
+            nx_assert(nx_cr_execute(cr) != 0, "missing program should fail");
+
+            cr->capture_output = 0;
+            nx_cr_arg(cr, "sh");
+            nx_cr_arg(cr, "-c");
+            nx_cr_arg(cr, "exit 4");
+            nx_assert(nx_cr_execute(cr) == 4, "no-capture exit code mismatch");
+            nx_assert(cr->output == NULL, "no-capture mode captured output");
+
+            nx_cr_destroy(cr);
+        }
+
+        /* NXCRPool */
+        {
+            NXCRPool   *pool;
+            NXCR       *cr;
+            const char *output;
+            size_t      first, second, joined, failing, skipped;
+            int         result;
+
+            pool = nx_cr_pool_create(4);
+            nx_assert(pool != NULL, "nx_cr_pool_create failed");
+
+            cr = nx_cr_create();
+            nx_cr_append(cr, "echo first > pool_a.txt");
+            first = nx_cr_pool_submit(pool, cr, NULL);
+            cr    = nx_cr_create();
+            nx_cr_append(cr, "echo second > pool_b.txt");
+            second = nx_cr_pool_submit(pool, cr, NULL);
+            cr     = nx_cr_create();
+            nx_cr_append(cr, "cat pool_a.txt pool_b.txt");
+            joined = nx_cr_pool_submit(pool, cr, NULL);
+            cr     = nx_cr_create();
+            nx_cr_append(cr, "exit 3");
+            failing = nx_cr_pool_submit(pool, cr, NULL);
+            cr      = nx_cr_create();
+            nx_cr_append(cr, "echo never");
+            skipped = nx_cr_pool_submit(pool, cr, NULL);
+
+            nx_assert(nx_cr_pool_depend(pool, joined, first), "nx_cr_pool_depend failed");
+            nx_assert(nx_cr_pool_depend(pool, joined, second), "nx_cr_pool_depend failed");
+            nx_assert(nx_cr_pool_depend(pool, skipped, failing), "nx_cr_pool_depend failed");
+            nx_assert(!nx_cr_pool_depend(pool, joined, joined), "self dependency accepted");
+
+            result = nx_cr_pool_run(pool);
+            nx_assert(result == 3, "nx_cr_pool_run should report the failing exit code");
+            output = nx_cr_get_output(nx_cr_pool_get(pool, joined));
+            nx_assert(strcmp(output, "first\nsecond\n") == 0,
+                      "dependent job ran before its dependencies");
+            nx_assert(nx_cr_get_exit_code(nx_cr_pool_get(pool, failing)) == 3,
+                      "failing job exit code mismatch");
+            nx_assert(pool->jobs[skipped].state == NX_CR_JOB_SKIPPED,
+                      "job depending on a failure was not skipped");
+            nx_assert(nx_cr_get_output(nx_cr_pool_get(pool, skipped))[0] == '\0',
+                      "skipped job produced output");
+
+            nx_cr_pool_destroy(pool);
+            remove("pool_a.txt");
+            remove("pool_b.txt");
+        }
+
+        /* Build cache */
+        {
+            NXBuildCache *cache;
+            NXCR         *cr;
+
+            nx_assert(nx_file_write_all("cache_in.c", "int x;\n") == 0, "write failed");
+            nx_assert(nx_file_write_all("cache_in.h", "int y;\n") == 0, "write failed");
+            nx_assert(nx_file_write_all("cache_out", "binary") == 0, "write failed");
+            nx_assert(nx_file_write_all("cache_out.d", "cache_out: cache_in.c \\\n cache_in.h\n"
+                                                       "\ncache_in.h:\n") == 0,
+                      "write failed");
+
+            cr = nx_cr_create();
+            nx_cr_arg_split(cr, "cc cache_in.c -o cache_out -MMD -MF cache_out.d");
+
+            remove("test_cache.txt");
+            cache = nx_build_cache_load("test_cache.txt");
+            nx_assert(cache != NULL, "nx_build_cache_load failed");
+            nx_assert(!nx_build_cache_fresh(cache, cr), "unrecorded target reported fresh");
+            nx_assert(nx_build_cache_record(cache, cr), "nx_build_cache_record failed");
+            nx_assert(cache->list[0]->input_count == 2, "depfile headers were not recorded");
+            nx_assert(nx_build_cache_fresh(cache, cr), "recorded target reported stale");
+            nx_assert(nx_build_cache_save(cache), "nx_build_cache_save failed");
+            nx_build_cache_destroy(cache);
+
+            /* Rewriting a header with the same content keeps the target fresh */
+            nx_assert(nx_file_write_all("cache_in.h", "int y;\n") == 0, "write failed");
+            cache = nx_build_cache_load("test_cache.txt");
+            nx_assert(nx_build_cache_fresh(cache, cr), "loaded record reported stale");
+
+            nx_assert(nx_file_write_all("cache_in.h", "int z;\n") == 0, "write failed");
+            nx_assert(!nx_build_cache_fresh(cache, cr), "changed header not detected");
+            nx_build_cache_destroy(cache);
+
+            nx_cr_destroy(cr);
+            cr = nx_cr_create();
+            nx_cr_arg_split(cr, "cc cache_in.c -o cache_out -O2 -MMD -MF cache_out.d");
+            nx_assert(nx_file_write_all("cache_in.h", "int y;\n") == 0, "write failed");
+            cache = nx_build_cache_load("test_cache.txt");
+            nx_assert(!nx_build_cache_fresh(cache, cr), "changed command not detected");
+            nx_build_cache_destroy(cache);
+            nx_cr_destroy(cr);
+
+            remove("cache_in.c");
+            remove("cache_in.h");
+            remove("cache_out");
+            remove("cache_out.d");
+            remove("test_cache.txt");
+        }
+
+        /* Async Logging */
+        {
+            NXLogger  *logger;
+            pthread_t  threads[4];
+            char      *log_contents;
+            char      *line;
+            size_t     lines;
+            size_t     dropped;
+            int        i;
+
+            remove("async.txt");
+            logger = nx_logger_create_async("async.txt", false, false, NX_LOG_INFO,
+                                            NX_LOG_OVERFLOW_BLOCK);
+            nx_assert(logger != NULL, "nx_logger_create_async failed");
+
+            for (i = 0; i < 4; i++) {
+                nx_assert(pthread_create(&threads[i], NULL, test_logger_worker, logger) == 0,
+                          "pthread_create failed");
+            }
+            for (i = 0; i < 4; i++) {
+                pthread_join(threads[i], NULL);
+            }
+            nx_logger_debug(logger, "filtered out");
+            nx_logger_flush(logger);
+
+            log_contents = nx_file_read_all("async.txt");
+            nx_assert(log_contents != NULL, "nx_file_read_all failed");
+            lines = 0;
+            for (line = strchr(log_contents, '\n'); line; line = strchr(line + 1, '\n')) {
+                lines++;
+            }
+            nx_assert(lines == 2000, "async logger lost lines");
+            nx_assert(strstr(log_contents, "[INFO] async line 499\n") != NULL,
+                      "missing async line");
+            nx_assert(strstr(log_contents, "filtered out") == NULL, "async min level ignored");
+            nx_free(log_contents);
+            nx_logger_destroy(logger);
+
+            remove("async.txt");
+            logger = nx_logger_create_async("async.txt", false, false, NX_LOG_TRACE,
+                                            NX_LOG_OVERFLOW_DROP);
+            nx_assert(logger != NULL, "nx_logger_create_async failed");
+            for (i = 0; i < 5000; i++) {
+                nx_logger_info1(logger, "drop line %d", i);
+            }
+            nx_logger_flush(logger);
+            dropped = logger->dropped;
+            nx_logger_destroy(logger);
+
+            log_contents = nx_file_read_all("async.txt");
+            nx_assert(log_contents != NULL, "nx_file_read_all failed");
+            lines = 0;
+            for (line = strchr(log_contents, '\n'); line; line = strchr(line + 1, '\n')) {
+                lines++;
+            }
+            nx_assert(lines + dropped == 5000, "dropped lines not accounted for");
+            nx_free(log_contents);
+            remove("async.txt");
+        }
+
+        /* Deferred Logging */
+        {
+            NXLogger *logger;
+            char     *log_contents;
+            char      name[16];
+            char      long_a[600], long_b[600];
+            char     *line;
+            int       evaluated = 0;
+
+            remove("deferred.txt");
+            logger = nx_logger_create_async("deferred.txt", false, false, NX_LOG_INFO,
+                                            NX_LOG_OVERFLOW_BLOCK);
+            nx_assert(logger != NULL, "nx_logger_create_async failed");
+            nx_logger_set_deferred(logger, true);
+
+            strcpy(name, "nexus");
+            nx_logger_info3(logger, "%s=%d %5.2f", name, 42, 3.14159);
+            strcpy(name, "changed");
+            nx_logger_warn3(logger, "%lu %*d|", 7UL, 4, 9);
+            nx_logger_error2(logger, "%c%% %x", 'z', 255U);
+            nx_logger_debug1(logger, "not evaluated %d", ++evaluated);
+            memset(long_a, 'a', sizeof(long_a) - 1);
+            memset(long_b, 'b', sizeof(long_b) - 1);
+            long_a[sizeof(long_a) - 1] = long_b[sizeof(long_b) - 1] = '\0';
+            nx_logger_info2(logger, "%s|%s", long_a, long_b);
+            nx_logger_info1(logger, "after %d", 1);
+            nx_logger_info2(logger, "%400d|%400d", 1, 2);
+            nx_logger_flush(logger);
+            nx_assert(evaluated == 0, "filtered log arguments were evaluated");
+
+            log_contents = nx_file_read_all("deferred.txt");
+            nx_assert(log_contents != NULL, "nx_file_read_all failed");
+            nx_assert(strstr(log_contents, "[INFO] nexus=42  3.14\n") != NULL,
+                      "deferred string or float mismatch");
+            nx_assert(strstr(log_contents, "[WARN] 7    9|\n") != NULL,
+                      "deferred star width mismatch");
+            nx_assert(strstr(log_contents, "[ERROR] z% ff\n") != NULL,
+                      "deferred char/hex mismatch");
+            nx_assert(strstr(log_contents, "[INFO] after 1\n") != NULL,
+                      "record after over-long strings was corrupted");
+            for (line = log_contents; *line; line++) {
+                char *end = strchr(line, '\n');
+                nx_assert(end && end - line <= NX_LOG_RECORD_SIZE - 2, "deferred line overflowed");
+                line = end;
+            }
+            nx_free(log_contents);
+            nx_logger_destroy(logger);
+            remove("deferred.txt");
+        }
+
+        /* Stats */
+        {
+            NXLogger        *logger;
+            NXArena         *arena;
+            NXHashMap       *map;
+            NXStringBuilder *sb;
+            char            *log_contents;
+            char             keys[100][16];
+            size_t           used, reserved;
+            int              i;
+
+            nx_stats_reset();
+
+            map = nx_hashmap_create(NULL, NULL);
+            for (i = 0; i < 100; i++) {
+                nx_snprintf(keys[i], sizeof(keys[i]), "key%d", i);
+                nx_hashmap_insert(map, keys[i], keys[i]);
+            }
+            for (i = 0; i < 100; i++) {
+                nx_assert(nx_hashmap_get(map, keys[i]) == keys[i], "stats hashmap get failed");
+            }
+            nx_assert(nx_stats.hashmap_lookups >= 100, "hashmap lookups not counted");
+            nx_assert(nx_stats.hashmap_probes >= 100, "hashmap probes not counted");
+            nx_assert(nx_stats.hashmap_max_probe >= 1, "hashmap max probe not tracked");
+            nx_assert(nx_stats.hashmap_resizes > 0, "hashmap resizes not counted");
+            nx_hashmap_destroy(map);
+
+            arena = nx_arena_create();
+            nx_arena_alloc(arena, 100);
+            nx_arena_usage(arena, &used, &reserved);
+            nx_assert(used >= 100 && reserved >= used, "nx_arena_usage mismatch");
+            nx_assert(nx_stats.arena_blocks == 1, "arena blocks not counted");
+            nx_assert(nx_stats.arena_bytes_reserved == reserved, "arena bytes reserved mismatch");
+            nx_arena_destroy(arena);
+            nx_assert(nx_stats.arena_blocks == 0, "arena blocks not released");
+
+            sb = nx_string_builder_create();
+            for (i = 0; i < 100; i++) {
+                nx_string_builder_append(sb, "0123456789");
+            }
+            nx_assert(nx_stats.string_builder_reallocs > 0, "string builder reallocs not counted");
+            nx_assert(nx_stats.string_builder_bytes_reserved == sb->capacity,
+                      "string builder bytes reserved mismatch");
+
+            remove("stats.txt");
+            logger = nx_logger_create("stats.txt", false, false, NX_LOG_TRACE);
+            nx_stats_dump(logger);
+            nx_logger_destroy(logger);
+            nx_string_builder_destroy(sb);
+
+            log_contents = nx_file_read_all("stats.txt");
+            nx_assert(log_contents != NULL, "nx_file_read_all failed");
+            nx_assert(strstr(log_contents, "[INFO] hashmap: ") != NULL, "missing hashmap stats");
+            nx_assert(strstr(log_contents, "[INFO] arena: ") != NULL, "missing arena stats");
+            nx_free(log_contents);
+            remove("stats.txt");
+        }
     }
 
     /*************************************************************************
@@ -502,7 +1790,9 @@ int main(void) {
                     nxui_create_shader_program(test_vertex_src, test_fragment_src);
                 nx_assert(shader.program_id != 0, "nxui_create_shader_program failed");
 
-                nxui_context_add_shader(context, shader);
+                nx_assert(nxui_context_add_shader(context, shader) ==
+                              nxui_context_shader(context, 0),
+                          "nxui_context_add_shader did not return the stored shader");
                 nx_assert(context->shader_count == 1, "nxui_context_add_shader count != 1");
             }
 
@@ -525,20 +1815,63 @@ int main(void) {
                 nx_assert(mesh.index_count == 3, "nxui_create_mesh failed (idx_count!=3)");
 
                 /* Assign the first (and only) shader in context to this mesh. */
-                mesh.shader = &context->shaders[0];
+                mesh.shader = nxui_context_shader(context, 0);
                 nxui_context_add_mesh(context, mesh);
                 nx_assert(context->mesh_count == 1, "nxui_context_add_mesh count!=1");
             }
 
             /* Test uniform setting on the single available shader. */
             {
-                nxui_use_shader_program(&context->shaders[0]);
-                nxui_set_uniform_float(&context->shaders[0], "testFloat", 3.14f);
-                nxui_set_uniform_int(&context->shaders[0], "testInt", 42);
-                nxui_set_uniform_vec4(&context->shaders[0], "testVec4", 1.0f, 0.0f, 1.0f, 1.0f);
+                nxui_use_shader_program(nxui_context_shader(context, 0));
+                nxui_set_uniform_float(nxui_context_shader(context, 0), "testFloat", 3.14f);
+                nxui_set_uniform_int(nxui_context_shader(context, 0), "testInt", 42);
+                nxui_set_uniform_vec4(nxui_context_shader(context, 0), "testVec4", 1.0f, 0.0f, 1.0f,
+                                      1.0f);
                 /* nx_die() is called if the uniform is unused or missing in the shader. */
             }
 
+            /* Cached uniform locations */
+            {
+                NXUIShaderProgram *shader = nxui_context_shader(context, 0);
+                GLint              location;
+
+                nx_assert(shader->uniform_count >= 3, "active uniforms were not cached");
+                location = nxui_uniform_location(shader, "testVec4");
+                nx_assert(location == glGetUniformLocation(shader->program_id, "testVec4"),
+                          "cached uniform location mismatch");
+                nx_assert(nxui_uniform_location(shader, "missing") == -1,
+                          "missing uniform has a location");
+                nxui_set_uniform_vec4_loc(location, 0.0f, 1.0f, 0.0f, 1.0f);
+                nxui_set_uniform_float_loc(nxui_uniform_location(shader, "testFloat"), 1.0f);
+                nxui_set_uniform_int_loc(nxui_uniform_location(shader, "testInt"), 7);
+            }
+
+            /* Shader binary cache */
+            {
+                NXUIShaderCache  *cache;
+                NXUIShaderProgram first, second;
+
+                cache = nxui_shader_cache_create("test_shader_cache",
+                                                 (GLADloadproc) glfwGetProcAddress);
+                first =
+                    nxui_create_shader_program_cached(cache, test_vertex_src, test_fragment_src);
+                nx_assert(cache->misses == 1 && cache->hits == 0, "empty shader cache hit");
+
+                /* Drivers without binary formats miss again, either way the program works */
+                second = nxui_shader_program_begin(cache, test_vertex_src, test_fragment_src);
+                while (!nxui_shader_program_ready(cache, &second)) {
+                }
+                nxui_shader_program_finish(cache, &second);
+                nx_assert(cache->hits + cache->misses == 2, "shader cache lookup count mismatch");
+                nx_assert(nxui_uniform_location(&second, "testFloat") != -1,
+                          "uniforms of a cached program are missing");
+
+                nxui_delete_shader_program(&first);
+                nxui_delete_shader_program(&second);
+                nxui_shader_cache_destroy(cache);
+                nx_cr_run("rm -rf test_shader_cache");
+            }
+
             /* Attempt a quick single-pass render with our NXUI context. */
             {
                 glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
@@ -549,6 +1882,162 @@ int main(void) {
                 glfwSwapBuffers(window);
             }
 
+            /* Frame profiler */
+            {
+                NXUIProfiler *profiler = nxui_profiler_create();
+                NXLogger     *logger;
+                size_t        i;
+
+                for (i = 0; i < 2 * NXUI_PROFILER_LATENCY; i++) {
+                    nxui_profiler_begin_frame(profiler);
+                    nxui_profiler_begin_pass(profiler, "clear");
+                    glClear(GL_COLOR_BUFFER_BIT);
+                    nxui_profiler_end_pass(profiler);
+                    nxui_render_ui(context);
+                    nxui_profiler_end_frame(profiler);
+                }
+                nx_assert(profiler->history_count > 0, "no profiled frames were collected");
+                nx_assert(profiler->last_pass_count == 2 &&
+                              strcmp(profiler->last_passes[1].name, "ui") == 0,
+                          "nxui_render_ui did not time its own pass");
+                nx_assert(nxui_profiler_percentile(profiler, NXUI_PROFILE_DRAW_CALLS, 50.0) >= 1.0,
+                          "profiled frames have no draw calls");
+                nx_assert(nxui_profiler_percentile(profiler, NXUI_PROFILE_TRIANGLES, 99.0) >= 1.0,
+                          "profiled frames have no triangles");
+
+                logger = nx_logger_create("profile.txt", false, false, NX_LOG_INFO);
+                nxui_profiler_log(profiler, logger);
+                nx_logger_destroy(logger);
+                remove("profile.txt");
+                nxui_profiler_destroy(profiler);
+            }
+
+            /* Draw list sorting and state caching */
+            {
+                NXUIDrawList     *list = nxui_draw_list_create();
+                NXUIShaderProgram other;
+                NXUIMesh         *mesh = &context->meshes[0];
+                size_t            i;
+
+                other.program_id = nxui_context_shader(context, 0)->program_id + 1;
+                nxui_draw_list_submit(list, &other, mesh->vao, 0, GL_TRIANGLES, 0, 0);
+                nxui_draw_list_submit_mesh(list, mesh, 0);
+                nxui_draw_list_submit(list, &other, mesh->vao, 0, GL_TRIANGLES, 0, 0);
+                nxui_draw_list_submit_mesh(list, mesh, 0);
+                nxui_draw_list_sort(list);
+                for (i = 0; i < 2; i++) {
+                    nx_assert(list->items[list->entries[i].item].program ==
+                                  nxui_context_shader(context, 0)->program_id,
+                              "draw list not sorted by program");
+                }
+                nx_assert(list->entries[0].item == 1 && list->entries[1].item == 3,
+                          "draw list sort is not stable");
+
+                /* Only the mesh's own program is drawn, the other one does not exist */
+                nxui_draw_list_clear(list);
+                for (i = 0; i < 100; i++) {
+                    nxui_draw_list_submit_mesh(list, mesh, 0);
+                }
+                nxui_draw_list_render(list);
+                nx_assert(list->draw_calls == 100, "draw list draw call count mismatch");
+                nx_assert(list->state_changes == 2, "draw list rebound unchanged state");
+                nx_assert(list->count == 0, "draw list not cleared after render");
+                nxui_draw_list_destroy(list);
+            }
+
+            /* Streaming batch and instancing */
+            {
+                NXUIBatch    *batch = nxui_batch_create(8, 12);
+                NXUIMesh     *mesh  = &context->meshes[0];
+                NXUIAttribute offset_attribute;
+                float         offsets[8] = {0.0f};
+                float         white[4]   = {1.0f, 1.0f, 1.0f, 1.0f};
+                size_t        frame;
+
+                /* Frame NXUI_BATCH_SEGMENTS reuses the first segment once its fence signaled */
+                for (frame = 0; frame < NXUI_BATCH_SEGMENTS + 1; frame++) {
+                    nxui_batch_set_state(batch, nxui_context_shader(context, 0), 0);
+                    nxui_batch_rect(batch, 0.0f, 0.0f, 0.5f, 0.5f, white);
+                    nxui_batch_rect(batch, 0.5f, 0.5f, 0.5f, 0.5f, white);
+                    nx_assert(nxui_batch_end(batch) == 1, "batched rects took more than a draw");
+                }
+
+                /* Overflowing a segment moves on to the next one */
+                nxui_batch_set_state(batch, nxui_context_shader(context, 0), 0);
+                nxui_batch_rect(batch, 0.0f, 0.0f, 0.1f, 0.1f, white);
+                nxui_batch_rect(batch, 0.1f, 0.0f, 0.1f, 0.1f, white);
+                nxui_batch_rect(batch, 0.2f, 0.0f, 0.1f, 0.1f, white);
+                nx_assert(batch->segment_vertices == 8 && batch->vertex_used == 4,
+                          "batch did not move to the next segment");
+                nx_assert(nxui_batch_end(batch) == 2, "overflowing batch draw count mismatch");
+                nxui_batch_destroy(batch);
+
+                offset_attribute.index      = 1;
+                offset_attribute.size       = 2;
+                offset_attribute.type       = GL_FLOAT;
+                offset_attribute.normalized = GL_FALSE;
+                offset_attribute.stride     = 2 * sizeof(float);
+                offset_attribute.offset     = (void *) 0;
+                nxui_mesh_set_instances(mesh, offsets, sizeof(offsets), 4, 1, &offset_attribute,
+                                        GL_DYNAMIC_DRAW);
+                nx_assert(mesh->instance_vbo != 0, "instance buffer was not created");
+                nxui_mesh_set_instances(mesh, offsets, sizeof(offsets), 3, 1, &offset_attribute,
+                                        GL_DYNAMIC_DRAW);
+                nx_assert(mesh->instance_count == 3, "instance count was not updated");
+                nxui_render_ui(context);
+                nx_assert(context->draw_list->draw_calls == 1, "instanced mesh draw mismatch");
+            }
+
+            /* Context storage and mesh handles */
+            {
+                NXUIShaderProgram  empty[NXUI_SHADER_CHUNK_SIZE + 8];
+                NXUIShaderProgram *first = nxui_context_shader(context, 0);
+                NXUIMesh           meshes[3];
+                NXUIMeshHandle     handles[3], reused, none;
+                NXUIAttribute      attribute;
+                size_t             i;
+
+                memset(empty, 0, sizeof(empty));
+                nxui_context_add_shaders(context, empty, nx_len(empty), NULL);
+                nx_assert(context->shader_count == nx_len(empty) + 1, "bulk shader count mismatch");
+                nx_assert(nxui_context_shader(context, 0) == first, "context shaders moved");
+
+                attribute.index      = 0;
+                attribute.size       = 3;
+                attribute.type       = GL_FLOAT;
+                attribute.normalized = GL_FALSE;
+                attribute.stride     = 3 * sizeof(float);
+                attribute.offset     = (void *) 0;
+                for (i = 0; i < 3; i++) {
+                    meshes[i] = nxui_create_mesh(test_vertices, sizeof(test_vertices), NULL, 0, 1,
+                                                 &attribute, GL_STATIC_DRAW);
+                }
+                nxui_context_add_meshes(context, meshes, 3, handles);
+                nx_assert(context->mesh_count == 4, "bulk mesh count mismatch");
+                nx_assert(nxui_context_mesh(context, handles[2])->vao == meshes[2].vao,
+                          "mesh handle resolves to the wrong mesh");
+
+                /* Removing swaps the last mesh in, its handle follows it */
+                nx_assert(nxui_context_remove_mesh(context, handles[0]), "mesh was not removed");
+                nx_assert(context->mesh_count == 3, "removed mesh count mismatch");
+                nx_assert(nxui_context_mesh(context, handles[0]) == NULL, "stale handle resolves");
+                nx_assert(!nxui_context_remove_mesh(context, handles[0]), "mesh removed twice");
+                nx_assert(nxui_context_mesh(context, handles[2]) == &context->meshes[1],
+                          "moved mesh handle mismatch");
+
+                meshes[0] = nxui_create_mesh(test_vertices, sizeof(test_vertices), NULL, 0, 1,
+                                             &attribute, GL_STATIC_DRAW);
+                reused    = nxui_context_add_mesh(context, meshes[0]);
+                nx_assert(reused.index == handles[0].index &&
+                              reused.generation != handles[0].generation,
+                          "mesh slot was not reused with a new generation");
+                nx_assert(nxui_context_mesh(context, handles[0]) == NULL,
+                          "stale handle resolves to the reused slot");
+
+                memset(&none, 0, sizeof(none));
+                nx_assert(nxui_context_mesh(context, none) == NULL, "zeroed handle resolves");
+            }
+
             nxui_context_destroy(context);
         }
 
@@ -27,25 +27,70 @@
  *    #define NEXUS_IMPLEMENTATION
  *
  * i.e. it should look like this:
- *    #include ...
- *    #include ...
  *    #define NEXUS_IMPLEMENTATION
  *    #include "nexus.h"
+ *    #include ...
+ *    #include ...
+ *
+ * Nexus needs the POSIX.1-2008 interfaces, which glibc hides under -ansi.
+ * It defines _DEFAULT_SOURCE itself, but that only works when nexus.h is
+ * included before any system header. Otherwise define _DEFAULT_SOURCE or
+ * _POSIX_C_SOURCE=200809L yourself, e.g. with -D_DEFAULT_SOURCE.
  *
  * ===== OPTIONS ==========================================================
  *
  *    #define NX_DEBUG
- *        Enables memory leak detection and printing of memory leaks.
+ *        Enables memory leak detection and printing of memory leaks. The
+ *        tracker is thread-safe and also keeps per-callsite counters, see
+ *        nx_print_memory_sites.
+ *
+ *    #define nx_malloc(size), nx_calloc(num, size), nx_realloc(ptr, size),
+ *            nx_free(ptr)
+ *        Replace the allocator used by nexus. Ignored with NX_DEBUG, which
+ *        routes them through the memory tracker.
+ *
+ *    #define NX_STATS
+ *        Enables the allocation and hashmap counters in nx_stats, which can
+ *        be written to a logger with nx_stats_dump. Disabled by default.
  *
  *    #define NX_MATH
  *        Includes math.h. Disabled by default.
  *
  *    #define NX_REBUILD(argc, argv)
- *        Enables rebuilding of the executable when the source file is
- *        modified.
+ *        Enables rebuilding of the executable when the source file or a
+ *        header it includes is modified.
+ *
+ *    #define NX_BUILD_CACHE
+ *        Sets the file in which nx_compile_command and nx_rebuild keep the
+ *        content hashes of the inputs of every target they built. Default
+ *        is ".nexus_cache".
  *
  *    #define NX_ARENA_BLOCK_SIZE
- *        Sets the size of the arena blocks. Default is 4096.
+ *        Sets the size of the first arena block. Default is 4096. Allocations
+ *        that do not fit in a block of this size get a block of their own.
+ *
+ *    #define NX_ARENA_MAX_BLOCK_SIZE
+ *        Sets the size at which the geometric growth of arena blocks stops.
+ *        Default is 256 * NX_ARENA_BLOCK_SIZE.
+ *
+ *    #define NX_ARENA_ALIGNMENT
+ *        Sets the alignment used by nx_arena_alloc. Default is 8.
+ *
+ *    #define NX_POOL_BLOCKS_PER_SLAB
+ *        Sets the default number of blocks per pool slab. Default is 64.
+ *
+ *    #define NX_POOL_CACHE_SIZE
+ *        Sets the maximum number of free blocks a thread keeps in its cache
+ *        of a concurrent pool. Default is 32.
+ *
+ *    #define NX_CACHE_LINE_SIZE
+ *        Sets the alignment of pool slabs. Must be a power of two. Default
+ *        is 64.
+ *
+ *    #define NX_THREAD_POOL_DEQUE_SIZE
+ *        Sets how many tasks each NXThreadPool worker can queue, a worker
+ *        runs tasks it submits past that right away. Must be a power of
+ *        two. Default is 1024.
  *
  *    #define NX_HASHMAP_INITIAL_CAPACITY
  *        Sets the initial capacity of the hashmap. Default is 16.
@@ -53,12 +98,48 @@
  *    #define NX_HASHMAP_LOAD_FACTOR
  *        Sets the load factor of the hashmap. Default is 0.75f.
  *
+ *    #define NX_HASHMAP_LEGACY_HASH
+ *        Uses the old byte-at-a-time polynomial string hash as the default
+ *        hashmap hash instead of the word-at-a-time nx_hash_bytes.
+ *
+ *    #define NX_HASHMAP_REHASH_STEPS
+ *        Sets the number of buckets an incremental hashmap migrates per
+ *        operation while it is resizing. Default is 1.
+ *
+ *    #define NX_NO_SIMD
+ *        Disables the SSE2/NEON group probing of the flat hashmap and
+ *        uses the scalar fallback instead.
+ *
+ *    #define NX_FILE_READER_BUFFER_SIZE
+ *        Sets the buffer size nx_file_reader_create uses when passed 0.
+ *        Default is 65536.
+ *
+ *    #define NX_NO_MMAP
+ *        Makes nx_file_map read the file into memory instead of mapping it.
+ *
  *    #define NX_STRING_BUILDER_INITIAL_CAPACITY
  *        Sets the initial capacity of the string builder. Default is 256.
  *
  *    #define NX_STRING_BUILDER_GROWTH_FACTOR
  *        Sets the growth factor of the string builder. Default is 2.
  *
+ *    #define NX_LOG_RING_SIZE
+ *        Sets the number of records in the ring of an async logger. Must be
+ *        a power of two. Default is 1024.
+ *
+ *    #define NX_LOG_RECORD_SIZE
+ *        Sets the maximum length of one async log line, longer lines are
+ *        truncated. Default is 512.
+ *
+ *    #define NX_LOG_COMPILE_LEVEL
+ *        Removes the nx_logger_<level> macros below this level at compile
+ *        time, their arguments are not evaluated. Uses the NXLogLevel
+ *        numbers, 0 is TRACE and 5 is FATAL. Default is 0.
+ *
+ *    #define NX_LOG_MAX_ARGS
+ *        Sets how many arguments a deferred log record can hold. Calls with
+ *        more are formatted immediately. Default is 8.
+ *
  * ===== VERSIONING =======================================================
  * Version: 0.1.2
  * Release Date: 05-04-2025
@@ -111,15 +192,36 @@
 #ifndef NEXUS_H
 #define NEXUS_H
 
+/* Exposes the POSIX interfaces glibc hides under -ansi, only if no system header came first */
+#ifndef _DEFAULT_SOURCE
+#define _DEFAULT_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <spawn.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#ifndef NX_NO_MMAP
+#include <sys/mman.h>
+#endif
+
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 200809L
+#error "include nexus.h first or define _DEFAULT_SOURCE"
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -140,10 +242,42 @@ typedef int bool;
 #include <math.h>
 #endif
 
+#if !defined(NX_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define NX_SIMD_SSE2
+#elif !defined(NX_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define NX_SIMD_NEON
+#endif
+
 #ifndef NX_ARENA_BLOCK_SIZE
 #define NX_ARENA_BLOCK_SIZE 4096
 #endif
 
+#ifndef NX_ARENA_MAX_BLOCK_SIZE
+#define NX_ARENA_MAX_BLOCK_SIZE (256 * NX_ARENA_BLOCK_SIZE)
+#endif
+
+#ifndef NX_ARENA_ALIGNMENT
+#define NX_ARENA_ALIGNMENT 8
+#endif
+
+#ifndef NX_POOL_BLOCKS_PER_SLAB
+#define NX_POOL_BLOCKS_PER_SLAB 64
+#endif
+
+#ifndef NX_POOL_CACHE_SIZE
+#define NX_POOL_CACHE_SIZE 32
+#endif
+
+#ifndef NX_CACHE_LINE_SIZE
+#define NX_CACHE_LINE_SIZE 64
+#endif
+
+#ifndef NX_THREAD_POOL_DEQUE_SIZE
+#define NX_THREAD_POOL_DEQUE_SIZE 1024
+#endif
+
 #ifndef NX_HASHMAP_INITIAL_CAPACITY
 #define NX_HASHMAP_INITIAL_CAPACITY 16
 #endif
@@ -152,6 +286,10 @@ typedef int bool;
 #define NX_HASHMAP_LOAD_FACTOR 0.75f
 #endif
 
+#ifndef NX_HASHMAP_REHASH_STEPS
+#define NX_HASHMAP_REHASH_STEPS 1
+#endif
+
 #ifndef NX_STRING_BUILDER_INITIAL_CAPACITY
 #define NX_STRING_BUILDER_INITIAL_CAPACITY 256
 #endif
@@ -160,6 +298,30 @@ typedef int bool;
 #define NX_STRING_BUILDER_GROWTH_FACTOR 2
 #endif
 
+#ifndef NX_LOG_RING_SIZE
+#define NX_LOG_RING_SIZE 1024
+#endif
+
+#ifndef NX_LOG_RECORD_SIZE
+#define NX_LOG_RECORD_SIZE 512
+#endif
+
+#ifndef NX_FILE_READER_BUFFER_SIZE
+#define NX_FILE_READER_BUFFER_SIZE 65536
+#endif
+
+#ifndef NX_LOG_COMPILE_LEVEL
+#define NX_LOG_COMPILE_LEVEL 0
+#endif
+
+#ifndef NX_BUILD_CACHE
+#define NX_BUILD_CACHE ".nexus_cache"
+#endif
+
+#ifndef NX_LOG_MAX_ARGS
+#define NX_LOG_MAX_ARGS 8
+#endif
+
 /* Macros {{{ */
 #define nx_join_(a, b) a##b
 #define nx_join(a, b) nx_join_(a, b)
@@ -173,6 +335,13 @@ typedef int bool;
 #define nx_abs(a) ((a) < 0 ? -(a) : (a))
 #define nx_clamp(a, min, max) nx_min(nx_max(a, min), max)
 #define nx_member(T, m) (((T *) 0)->m)
+#define nx_container_of(ptr, T, m) ((T *) (void *) ((char *) (ptr) - offsetof(T, m)))
+/* For functions defined in the header, so translation units that don't use them don't warn */
+#if defined(__GNUC__) || defined(__clang__)
+#define NX_INLINE static __inline__ __attribute__((unused))
+#else
+#define NX_INLINE static
+#endif
 #define nx_statement(code)                                                                         \
     do {                                                                                           \
         code                                                                                       \
@@ -433,64 +602,18 @@ typedef int bool;
 #define nx_fmod fmod
 #endif
 
-#if defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 199901L) || defined(_MSC_VER)
+/* C99, but also part of the POSIX.1-2008 nexus requires */
 #define nx_snprintf snprintf
 #define nx_vsnprintf vsnprintf
-#else
-static int fallback_snprintf(char *str, size_t size, const char *format, ...)
-    __attribute__((unused));
-static int fallback_vsnprintf(char *str, size_t size, const char *format, va_list ap)
-    __attribute__((unused));
-
-static int fallback_snprintf(char *str, size_t size, const char *format, ...) {
-    int     ret;
-    va_list args;
-    char   *buffer;
-    va_start(args, format);
 
-    buffer = (char *) malloc(size);
-    if (buffer == NULL) {
-        va_end(args);
-        return -1;
-    }
-
-    ret = vsprintf(buffer, format, args);
-    if (ret < 0) {
-        free(buffer);
-        va_end(args);
-        return -1;
-    }
-    strncpy(str, buffer, size - 1);
-    str[size - 1] = '\0';
-    free(buffer);
-
-    va_end(args);
-    return ret;
-}
-
-static int fallback_vsnprintf(char *str, size_t size, const char *format, va_list ap) {
-    int   ret;
-    char *buffer;
-
-    buffer = (char *) malloc(size);
-    if (buffer == NULL) {
-        return -1;
-    }
-
-    ret = vsprintf(buffer, format, ap);
-    if (ret < 0) {
-        free(buffer);
-        return -1;
-    }
-    strncpy(str, buffer, size - 1);
-    str[size - 1] = '\0';
-    free(buffer);
-
-    return ret;
-}
-
-#define nx_snprintf fallback_snprintf
-#define nx_vsnprintf fallback_vsnprintf
+#ifndef nx_va_copy
+#if defined(va_copy)
+#define nx_va_copy va_copy
+#elif defined(__va_copy)
+#define nx_va_copy __va_copy
+#else
+#define nx_va_copy(dst, src) memcpy(&(dst), &(src), sizeof(va_list))
+#endif
 #endif
 
 #ifndef nx_strdup
@@ -510,6 +633,16 @@ static int fallback_vsnprintf(char *str, size_t size, const char *format, va_lis
 #endif
 /* }}} */
 
+/* Atomics {{{ */
+/* Thin wrappers around the GCC/Clang __atomic builtins, which also work in C89 mode */
+#define nx_atomic_load(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define nx_atomic_store(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+#define nx_atomic_fetch_add(ptr, value) __atomic_fetch_add(ptr, value, __ATOMIC_ACQ_REL)
+#define nx_atomic_fetch_sub(ptr, value) __atomic_fetch_sub(ptr, value, __ATOMIC_ACQ_REL)
+#define nx_atomic_cas(ptr, expected, desired)                                                      \
+    __atomic_compare_exchange_n(ptr, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+/* }}} */
+
 /* Memory Tracker {{{ */
 #ifdef NX_DEBUG
 void *nx_malloc_debug(size_t size, const char *file, int line);
@@ -517,17 +650,28 @@ void *nx_calloc_debug(size_t num, size_t size, const char *file, int line);
 void *nx_realloc_debug(void *ptr, size_t size, const char *file, int line);
 void  nx_free_debug(void *ptr);
 void  nx_print_memory_leaks(void);
+void  nx_print_memory_sites(void);
 
 #define nx_malloc(size) nx_malloc_debug(size, __FILE__, __LINE__)
 #define nx_calloc(num, size) nx_calloc_debug(num, size, __FILE__, __LINE__)
 #define nx_realloc(ptr, size) nx_realloc_debug(ptr, size, __FILE__, __LINE__)
 #define nx_free(ptr) nx_free_debug(ptr)
 #else
+/* Overwritable without NX_DEBUG, e.g. to count allocations */
+#ifndef nx_malloc
 #define nx_malloc(size) malloc(size)
+#endif
+#ifndef nx_calloc
 #define nx_calloc(num, size) calloc(num, size)
+#endif
+#ifndef nx_realloc
 #define nx_realloc(ptr, size) realloc(ptr, size)
+#endif
+#ifndef nx_free
 #define nx_free(ptr) free(ptr)
+#endif
 #define nx_print_memory_leaks() (void) 0
+#define nx_print_memory_sites() (void) 0
 #endif /* NX_DEBUG */
 /* }}} */
 
@@ -551,12 +695,66 @@ typedef struct NXArenaBlock {
 typedef struct {
     NXArenaBlock *first;
     NXArenaBlock *current;
+    NXArenaBlock *large;
+    size_t        next_block_size;
+    bool          concurrent;
 } NXArena;
 
-NXArena *nx_arena_create(void);
-void    *nx_arena_alloc(NXArena *arena, size_t size);
-void     nx_arena_reset(NXArena *arena);
-void     nx_arena_destroy(NXArena *arena);
+typedef struct {
+    NXArenaBlock *block;
+    size_t        used;
+    NXArenaBlock *large;
+} NXArenaMark;
+
+NXArena    *nx_arena_create(void);
+NXArena    *nx_arena_create_concurrent(void);
+void       *nx_arena_alloc(NXArena *arena, size_t size);
+void       *nx_arena_alloc_aligned(NXArena *arena, size_t size, size_t alignment);
+NXArenaMark nx_arena_mark(NXArena *arena);
+void        nx_arena_usage(NXArena *arena, size_t *used, size_t *reserved);
+void        nx_arena_rewind(NXArena *arena, NXArenaMark mark);
+void        nx_arena_reset(NXArena *arena);
+void        nx_arena_destroy(NXArena *arena);
+
+NXArena *nx_scratch_arena(void);
+void     nx_scratch_reset(void);
+/* }}} */
+
+/* Pool {{{ */
+typedef struct NXPoolSlab {
+    struct NXPoolSlab *next;
+    void              *memory;
+} NXPoolSlab;
+
+struct NXPool;
+
+typedef struct NXPoolCache {
+    struct NXPool      *pool;
+    void               *blocks;
+    size_t              count;
+    struct NXPoolCache *next;
+} NXPoolCache;
+
+typedef struct NXPool {
+    size_t      block_size;
+    size_t      blocks_per_slab;
+    void       *free_list;
+    NXPoolSlab *first;
+    NXPoolSlab *current;
+    size_t      bump;
+    /* Per-thread caches, only used by pools from nx_pool_create_concurrent */
+    bool            concurrent;
+    pthread_mutex_t lock;
+    pthread_key_t   cache_key;
+    NXPoolCache    *caches;
+} NXPool;
+
+NXPool *nx_pool_create(size_t block_size, size_t blocks_per_slab);
+NXPool *nx_pool_create_concurrent(size_t block_size, size_t blocks_per_slab);
+void   *nx_pool_alloc(NXPool *pool);
+void    nx_pool_free(NXPool *pool, void *ptr);
+void    nx_pool_reset(NXPool *pool);
+void    nx_pool_destroy(NXPool *pool);
 /* }}} */
 
 /* Linked Lists {{{ */
@@ -568,13 +766,17 @@ typedef struct NXSSLNode {
 typedef struct {
     NXSLLNode *head;
     NXSLLNode *tail;
+    NXArena   *arena;
+    NXPool    *pool;
 } NXSinglyLinkedList;
 
 NXSinglyLinkedList *nx_sll_create(void);
+NXSinglyLinkedList *nx_sll_create_ex(NXArena *arena, NXPool *pool);
 void                nx_sll_destroy(NXSinglyLinkedList *list);
-void                nx_sll_append(NXSinglyLinkedList *list, void *data);
-void                nx_sll_prepend(NXSinglyLinkedList *list, void *data);
+NXSLLNode          *nx_sll_append(NXSinglyLinkedList *list, void *data);
+NXSLLNode          *nx_sll_prepend(NXSinglyLinkedList *list, void *data);
 void                nx_sll_remove(NXSinglyLinkedList *list, void *data);
+void               *nx_sll_pop_front(NXSinglyLinkedList *list);
 
 typedef struct NXDLLNode {
     void             *data;
@@ -585,36 +787,447 @@ typedef struct NXDLLNode {
 typedef struct {
     NXDLLNode *head;
     NXDLLNode *tail;
+    NXArena   *arena;
+    NXPool    *pool;
 } NXDoublyLinkedList;
 
 NXDoublyLinkedList *nx_dll_create(void);
+NXDoublyLinkedList *nx_dll_create_ex(NXArena *arena, NXPool *pool);
 void                nx_dll_destroy(NXDoublyLinkedList *list);
-void                nx_dll_append(NXDoublyLinkedList *list, void *data);
-void                nx_dll_prepend(NXDoublyLinkedList *list, void *data);
+NXDLLNode          *nx_dll_append(NXDoublyLinkedList *list, void *data);
+NXDLLNode          *nx_dll_prepend(NXDoublyLinkedList *list, void *data);
 void                nx_dll_remove(NXDoublyLinkedList *list, void *data);
+void                nx_dll_remove_node(NXDoublyLinkedList *list, NXDLLNode *node);
+void                nx_dll_move_to_front(NXDoublyLinkedList *list, NXDLLNode *node);
+void               *nx_dll_pop_front(NXDoublyLinkedList *list);
+void               *nx_dll_pop_back(NXDoublyLinkedList *list);
+
+/* Intrusive circular list: embed an NXListLink in your struct and get it back with
+ * nx_list_entry. The list head is a bare NXListLink, nothing is allocated. */
+typedef struct NXListLink {
+    struct NXListLink *next;
+    struct NXListLink *prev;
+} NXListLink;
+
+#define nx_list_entry(link, T, m) nx_container_of(link, T, m)
+#define nx_list_empty(head) ((head)->next == (head))
+#define nx_list_first(head) (nx_list_empty(head) ? NULL : (head)->next)
+#define nx_list_last(head) (nx_list_empty(head) ? NULL : (head)->prev)
+/* Safe against removing the current link, tmp holds the next one */
+#define nx_list_foreach(link, tmp, head)                                                           \
+    for ((link) = (head)->next, (tmp) = (link)->next; (link) != (head);                            \
+         (link) = (tmp), (tmp) = (link)->next)
+
+NX_INLINE void nx_list_init(NXListLink *head) {
+    head->next = head->prev = head;
+}
+
+NX_INLINE void _nx_list_insert(NXListLink *link, NXListLink *prev, NXListLink *next) {
+    link->prev = prev;
+    link->next = next;
+    prev->next = link;
+    next->prev = link;
+}
+
+NX_INLINE void nx_list_push_front(NXListLink *head, NXListLink *link) {
+    _nx_list_insert(link, head, head->next);
+}
+
+NX_INLINE void nx_list_push_back(NXListLink *head, NXListLink *link) {
+    _nx_list_insert(link, head->prev, head);
+}
+
+/* Leaves the link pointing at itself, so removing it twice is harmless */
+NX_INLINE void nx_list_remove(NXListLink *link) {
+    link->prev->next = link->next;
+    link->next->prev = link->prev;
+    link->next       = link->prev = link;
+}
+
+NX_INLINE void nx_list_move_to_front(NXListLink *head, NXListLink *link) {
+    nx_list_remove(link);
+    nx_list_push_front(head, link);
+}
+
+NX_INLINE NXListLink *nx_list_pop_back(NXListLink *head) {
+    NXListLink *link = nx_list_last(head);
+    if (link) {
+        nx_list_remove(link);
+    }
+    return link;
+}
 /* }}} */
 
 /* Hashmap {{{ */
 typedef struct nx_hashmap_entry {
+    size_t                   hash;
     void                    *key;
     void                    *value;
     struct nx_hashmap_entry *next;
 } NXHashMapEntry;
 
+typedef struct nx_hashmap_slot {
+    size_t hash;
+    void  *key;
+    void  *value;
+} NXHashMapSlot;
+
 typedef struct nx_hashmap {
     NXHashMapEntry **buckets;
     size_t           capacity;
     size_t           size;
     size_t (*hash_func)(void *key);
     bool (*key_equal)(void *key1, void *key2);
+    /* Optional node allocators, entries come from the heap when both are NULL */
+    NXArena *arena;
+    NXPool  *pool;
+    /* Incremental resizing, old_buckets is not NULL while a resize is in progress */
+    bool             incremental;
+    NXHashMapEntry **old_buckets;
+    size_t           old_capacity;
+    size_t           rehash_index;
+    /* Flat (open addressing) storage, only used when ctrl is not NULL */
+    unsigned char *ctrl;
+    NXHashMapSlot *slots;
+    size_t         growth_left;
 } NXHashMap;
 
+size_t     nx_hash_bytes(const void *data, size_t len);
 NXHashMap *nx_hashmap_create(size_t (*hash_func)(void *key),
                              bool (*key_equal)(void *key1, void *key2));
+NXHashMap *nx_hashmap_create_flat(size_t (*hash_func)(void *key),
+                                  bool (*key_equal)(void *key1, void *key2));
+NXHashMap *nx_hashmap_create_ex(size_t (*hash_func)(void *key),
+                                bool (*key_equal)(void *key1, void *key2), NXArena *arena,
+                                NXPool *pool);
 void       nx_hashmap_destroy(NXHashMap *map);
+void       nx_hashmap_set_incremental(NXHashMap *map, bool incremental);
 bool       nx_hashmap_insert(NXHashMap *map, void *key, void *value);
 void      *nx_hashmap_get(NXHashMap *map, void *key);
 bool       nx_hashmap_remove(NXHashMap *map, void *key);
+
+#if ULONG_MAX > 0xFFFFFFFFUL
+#define NX_HASH_K1 0x9E3779B97F4A7C15UL
+#define NX_HASH_K2 0xBF58476D1CE4E5B9UL
+#else
+#define NX_HASH_K1 0x9E3779B9UL
+#define NX_HASH_K2 0x85EBCA6BUL
+#endif
+#define NX_HASH_HALF_BITS (sizeof(size_t) * 4)
+
+NX_INLINE size_t _nx_hash_mix(size_t hash, size_t word) {
+    hash = (hash ^ word) * (size_t) NX_HASH_K2;
+    return hash ^ (hash >> NX_HASH_HALF_BITS);
+}
+
+/* Control bytes of flat maps, also used by the maps of NX_HASHMAP_DEFINE */
+#define NX_HASHMAP_GROUP_WIDTH 16
+#define NX_HASHMAP_CTRL_EMPTY ((unsigned char) 0x80)
+#define NX_HASHMAP_CTRL_DELETED ((unsigned char) 0xFE)
+
+NX_INLINE unsigned int _nx_ctz(unsigned int x) {
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned int) __builtin_ctz(x);
+#else
+    unsigned int n = 0;
+    while (!(x & 1U)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+/* Returns a bitmask with bit i set when group[i] == value */
+NX_INLINE unsigned int _nx_hashmap_group_match(const unsigned char *group, unsigned char value) {
+#if defined(NX_SIMD_SSE2)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *) (const void *) group);
+    return (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) value)));
+#elif defined(NX_SIMD_NEON)
+    static const unsigned char bits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                           1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t matched = vandq_u8(vceqq_u8(vld1q_u8(group), vdupq_n_u8(value)), vld1q_u8(bits));
+    return (unsigned int) vaddv_u8(vget_low_u8(matched)) |
+           ((unsigned int) vaddv_u8(vget_high_u8(matched)) << 8);
+#else
+    unsigned int mask = 0;
+    unsigned int i;
+    for (i = 0; i < NX_HASHMAP_GROUP_WIDTH; i++) {
+        if (group[i] == value) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+/* Returns a bitmask of the empty or deleted slots in a group (high bit set) */
+NX_INLINE unsigned int _nx_hashmap_group_match_free(const unsigned char *group) {
+#if defined(NX_SIMD_SSE2)
+    return (unsigned int) _mm_movemask_epi8(
+        _mm_loadu_si128((const __m128i *) (const void *) group));
+#elif defined(NX_SIMD_NEON)
+    static const unsigned char bits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                           1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t matched = vandq_u8(vcgeq_u8(vld1q_u8(group), vdupq_n_u8(0x80)), vld1q_u8(bits));
+    return (unsigned int) vaddv_u8(vget_low_u8(matched)) |
+           ((unsigned int) vaddv_u8(vget_high_u8(matched)) << 8);
+#else
+    unsigned int mask = 0;
+    unsigned int i;
+    for (i = 0; i < NX_HASHMAP_GROUP_WIDTH; i++) {
+        if (group[i] & 0x80) {
+            mask |= 1U << i;
+        }
+    }
+    return mask;
+#endif
+}
+/* }}} */
+
+/* Typed Containers {{{ */
+/* NX_VEC_DEFINE(name, T) defines a vector type name that stores T by value in one contiguous
+ * block, along with name_init, name_init_arena, name_destroy, name_reserve, name_push, name_pop,
+ * name_insert, name_erase and name_clear. NX_VEC_DEFINE_SMALL(name, T, N) keeps up to N elements
+ * inside the vector itself; such a vector must not be copied by value. The storage of a vector
+ * on an arena belongs to the arena and is never freed by the vector */
+#define NX_VEC_DEFINE(name, T)                                                                     \
+    typedef struct {                                                                               \
+        T       *data;                                                                             \
+        size_t   size;                                                                             \
+        size_t   capacity;                                                                         \
+        NXArena *arena;                                                                            \
+        bool     owned; /* data came from nx_malloc */                                             \
+    } name;                                                                                        \
+    _NX_VEC_DEFINE_FUNCTIONS(name, T, NULL, 0)
+
+#define NX_VEC_DEFINE_SMALL(name, T, N)                                                            \
+    typedef struct {                                                                               \
+        T       *data;                                                                             \
+        size_t   size;                                                                             \
+        size_t   capacity;                                                                         \
+        NXArena *arena;                                                                            \
+        bool     owned; /* data came from nx_malloc */                                             \
+        T        inline_data[N];                                                                   \
+    } name;                                                                                        \
+    _NX_VEC_DEFINE_FUNCTIONS(name, T, vec->inline_data, N)
+
+#define _NX_VEC_DEFINE_FUNCTIONS(name, T, initial_data, initial_capacity)                          \
+    NX_INLINE void nx_join(name, _init)(name *vec) {                                               \
+        vec->data     = initial_data;                                                              \
+        vec->size     = 0;                                                                         \
+        vec->capacity = initial_capacity;                                                          \
+        vec->arena    = NULL;                                                                      \
+        vec->owned    = false;                                                                     \
+    }                                                                                              \
+    NX_INLINE void nx_join(name, _init_arena)(name *vec, NXArena *arena) {                         \
+        nx_join(name, _init)(vec);                                                                 \
+        vec->arena = arena;                                                                        \
+    }                                                                                              \
+    NX_INLINE void nx_join(name, _destroy)(name *vec) {                                            \
+        if (vec->owned) {                                                                          \
+            nx_free(vec->data);                                                                    \
+        }                                                                                          \
+        nx_join(name, _init)(vec);                                                                 \
+    }                                                                                              \
+    NX_INLINE void nx_join(name, _reserve)(name *vec, size_t capacity) {                           \
+        T *data;                                                                                   \
+        if (capacity <= vec->capacity) {                                                           \
+            return;                                                                                \
+        }                                                                                          \
+        if (vec->owned) {                                                                          \
+            data = (T *) nx_realloc(vec->data, capacity * sizeof(T));                              \
+        } else {                                                                                   \
+            data = (T *) (vec->arena ? nx_arena_alloc(vec->arena, capacity * sizeof(T))            \
+                                     : nx_malloc(capacity * sizeof(T)));                           \
+            if (data && vec->size) {                                                               \
+                nx_memcpy(data, vec->data, vec->size * sizeof(T));                                 \
+            }                                                                                      \
+        }                                                                                          \
+        if (!data) {                                                                               \
+            nx_die("Failed to allocate memory for vector");                                        \
+        }                                                                                          \
+        vec->data     = data;                                                                      \
+        vec->capacity = capacity;                                                                  \
+        vec->owned    = !vec->arena;                                                               \
+    }                                                                                              \
+    NX_INLINE void nx_join(nx_join(_, name), _grow)(name *vec) {                                   \
+        if (vec->size == vec->capacity) {                                                          \
+            nx_join(name, _reserve)(vec, vec->capacity ? vec->capacity * 2 : 8);                   \
+        }                                                                                          \
+    }                                                                                              \
+    NX_INLINE void nx_join(name, _push)(name *vec, T value) {                                      \
+        nx_join(nx_join(_, name), _grow)(vec);                                                     \
+        vec->data[vec->size++] = value;                                                            \
+    }                                                                                              \
+    /* The vector must not be empty */                                                             \
+    NX_INLINE T nx_join(name, _pop)(name *vec) {                                                   \
+        return vec->data[--vec->size];                                                             \
+    }                                                                                              \
+    /* Shifts the elements from index on up by one, index may be size */                           \
+    NX_INLINE void nx_join(name, _insert)(name *vec, size_t index, T value) {                      \
+        nx_join(nx_join(_, name), _grow)(vec);                                                     \
+        nx_memmove(vec->data + index + 1, vec->data + index, (vec->size - index) * sizeof(T));     \
+        vec->data[index] = value;                                                                  \
+        vec->size++;                                                                               \
+    }                                                                                              \
+    /* Keeps the order of the remaining elements */                                                \
+    NX_INLINE void nx_join(name, _erase)(name *vec, size_t index) {                                \
+        nx_memmove(vec->data + index, vec->data + index + 1, (vec->size - index - 1) * sizeof(T)); \
+        vec->size--;                                                                               \
+    }                                                                                              \
+    NX_INLINE void nx_join(name, _clear)(name *vec) {                                              \
+        vec->size = 0;                                                                             \
+    }
+
+/* NX_HASHMAP_DEFINE(name, K, V, hash_fn, equal_fn) defines a flat hashmap type name from K to V
+ * with the probing of nx_hashmap_create_flat, storing keys and values by value. hash_fn(key)
+ * returns a size_t and equal_fn(a, b) is true for equal keys; both are called directly, so they
+ * can be macros or functions the compiler inlines. Defines name_init, name_destroy, name_get,
+ * name_insert and name_remove. A zeroed map is empty and allocates on its first insert */
+#define NX_HASHMAP_DEFINE(name, K, V, hash_fn, equal_fn)                                           \
+    typedef struct {                                                                               \
+        K key;                                                                                     \
+        V value;                                                                                   \
+    } nx_join(name, _slot);                                                                        \
+    typedef struct {                                                                               \
+        unsigned char *ctrl;                                                                       \
+        nx_join(name, _slot) * slots;                                                              \
+        size_t capacity;                                                                           \
+        size_t size;                                                                               \
+        size_t growth_left;                                                                        \
+    } name;                                                                                        \
+    NX_INLINE void nx_join(name, _init)(name *map) {                                               \
+        map->ctrl        = NULL;                                                                   \
+        map->slots       = NULL;                                                                   \
+        map->capacity    = 0;                                                                      \
+        map->size        = 0;                                                                      \
+        map->growth_left = 0;                                                                      \
+    }                                                                                              \
+    NX_INLINE void nx_join(name, _destroy)(name *map) {                                            \
+        nx_free(map->slots);                                                                       \
+        nx_join(name, _init)(map);                                                                 \
+    }                                                                                              \
+    /* Identity hashes of sequential keys would all land in one group without the mix */           \
+    NX_INLINE size_t nx_join(nx_join(_, name), _hash)(K key) {                                     \
+        return _nx_hash_mix(hash_fn(key), 0);                                                      \
+    }                                                                                              \
+    /* Returns the index of the key's slot, or capacity when the key is missing */                 \
+    NX_INLINE size_t nx_join(nx_join(_, name), _find)(const name *map, K key, size_t key_hash) {   \
+        size_t        group_mask = map->capacity / NX_HASHMAP_GROUP_WIDTH - 1;                     \
+        size_t        group      = (key_hash >> 7) & group_mask;                                   \
+        size_t        step       = 0;                                                              \
+        unsigned char h2         = (unsigned char) (key_hash & 0x7F);                              \
+        if (map->capacity == 0) {                                                                  \
+            return 0;                                                                              \
+        }                                                                                          \
+        for (;;) {                                                                                 \
+            size_t       offset  = group * NX_HASHMAP_GROUP_WIDTH;                                 \
+            unsigned int matches = _nx_hashmap_group_match(map->ctrl + offset, h2);                \
+            while (matches) {                                                                      \
+                size_t index = offset + _nx_ctz(matches);                                          \
+                if (equal_fn(map->slots[index].key, key)) {                                        \
+                    return index;                                                                  \
+                }                                                                                  \
+                matches &= matches - 1;                                                            \
+            }                                                                                      \
+            if (_nx_hashmap_group_match(map->ctrl + offset, NX_HASHMAP_CTRL_EMPTY)) {              \
+                return map->capacity;                                                              \
+            }                                                                                      \
+            step++;                                                                                \
+            group = (group + step) & group_mask;                                                   \
+        }                                                                                          \
+    }                                                                                              \
+    NX_INLINE size_t nx_join(nx_join(_, name), _find_free)(const name *map, size_t key_hash) {     \
+        size_t group_mask = map->capacity / NX_HASHMAP_GROUP_WIDTH - 1;                            \
+        size_t group      = (key_hash >> 7) & group_mask;                                          \
+        size_t step       = 0;                                                                     \
+        for (;;) {                                                                                 \
+            size_t       offset = group * NX_HASHMAP_GROUP_WIDTH;                                  \
+            unsigned int free   = _nx_hashmap_group_match_free(map->ctrl + offset);                \
+            if (free) {                                                                            \
+                return offset + _nx_ctz(free);                                                     \
+            }                                                                                      \
+            step++;                                                                                \
+            group = (group + step) & group_mask;                                                   \
+        }                                                                                          \
+    }                                                                                              \
+    NX_INLINE bool nx_join(nx_join(_, name), _rehash)(name *map, size_t capacity) {                \
+        unsigned char *old_ctrl     = map->ctrl;                                                   \
+        size_t         old_capacity = map->capacity;                                               \
+        size_t         slots_size   = capacity * sizeof(nx_join(name, _slot));                     \
+        char          *memory       = (char *) nx_malloc(slots_size + capacity);                   \
+        nx_join(name, _slot) *old_slots = map->slots;                                              \
+        size_t i;                                                                                  \
+        if (!memory) {                                                                             \
+            return false;                                                                          \
+        }                                                                                          \
+        map->slots       = (nx_join(name, _slot) *) (void *) memory;                               \
+        map->ctrl        = (unsigned char *) memory + slots_size;                                  \
+        map->capacity    = capacity;                                                               \
+        map->growth_left = capacity - capacity / 8;                                                \
+        nx_memset(map->ctrl, NX_HASHMAP_CTRL_EMPTY, capacity);                                     \
+        for (i = 0; i < old_capacity; i++) {                                                       \
+            if (!(old_ctrl[i] & 0x80)) {                                                           \
+                size_t key_hash = nx_join(nx_join(_, name), _hash)(old_slots[i].key);              \
+                size_t index    = nx_join(nx_join(_, name), _find_free)(map, key_hash);            \
+                map->ctrl[index]  = old_ctrl[i];                                                   \
+                map->slots[index] = old_slots[i];                                                  \
+                map->growth_left--;                                                                \
+            }                                                                                      \
+        }                                                                                          \
+        nx_free(old_slots);                                                                        \
+        return true;                                                                               \
+    }                                                                                              \
+    /* Returns NULL when the key is missing */                                                     \
+    NX_INLINE V *nx_join(name, _get)(const name *map, K key) {                                     \
+        size_t key_hash = nx_join(nx_join(_, name), _hash)(key);                                   \
+        size_t index    = nx_join(nx_join(_, name), _find)(map, key, key_hash);                    \
+        return index == map->capacity ? NULL : &map->slots[index].value;                           \
+    }                                                                                              \
+    /* Replaces the value of an existing key. Returns false when growing fails */                  \
+    NX_INLINE bool nx_join(name, _insert)(name *map, K key, V value) {                             \
+        size_t key_hash = nx_join(nx_join(_, name), _hash)(key);                                   \
+        size_t index    = nx_join(nx_join(_, name), _find)(map, key, key_hash);                    \
+        if (index != map->capacity) {                                                              \
+            map->slots[index].value = value;                                                       \
+            return true;                                                                           \
+        }                                                                                          \
+        if (map->growth_left == 0) {                                                               \
+            size_t capacity = map->capacity == 0               ? NX_HASHMAP_GROUP_WIDTH            \
+                              : map->size * 16 > map->capacity * 7 ? map->capacity * 2             \
+                                                                   : map->capacity;                \
+            if (!nx_join(nx_join(_, name), _rehash)(map, capacity)) {                              \
+                return false;                                                                      \
+            }                                                                                      \
+        }                                                                                          \
+        index = nx_join(nx_join(_, name), _find_free)(map, key_hash);                              \
+        if (map->ctrl[index] == NX_HASHMAP_CTRL_EMPTY) {                                           \
+            map->growth_left--;                                                                    \
+        }                                                                                          \
+        map->ctrl[index]        = (unsigned char) (key_hash & 0x7F);                               \
+        map->slots[index].key   = key;                                                             \
+        map->slots[index].value = value;                                                           \
+        map->size++;                                                                               \
+        return true;                                                                               \
+    }                                                                                              \
+    NX_INLINE bool nx_join(name, _remove)(name *map, K key) {                                      \
+        size_t key_hash = nx_join(nx_join(_, name), _hash)(key);                                   \
+        size_t index    = nx_join(nx_join(_, name), _find)(map, key, key_hash);                    \
+        size_t group_offset;                                                                       \
+        if (index == map->capacity) {                                                              \
+            return false;                                                                          \
+        }                                                                                          \
+        group_offset = index & ~((size_t) NX_HASHMAP_GROUP_WIDTH - 1);                             \
+        if (_nx_hashmap_group_match(map->ctrl + group_offset, NX_HASHMAP_CTRL_EMPTY)) {            \
+            map->ctrl[index] = NX_HASHMAP_CTRL_EMPTY;                                              \
+            map->growth_left++;                                                                    \
+        } else {                                                                                   \
+            map->ctrl[index] = NX_HASHMAP_CTRL_DELETED;                                            \
+        }                                                                                          \
+        map->size--;                                                                               \
+        return true;                                                                               \
+    }
 /* }}} */
 
 /* String Builder {{{ */
@@ -626,33 +1239,179 @@ typedef struct {
 
 NXStringBuilder *nx_string_builder_create(void);
 void             nx_string_builder_destroy(NXStringBuilder *sb);
+void             nx_string_builder_reserve(NXStringBuilder *sb, size_t additional);
 void             nx_string_builder_append(NXStringBuilder *sb, const char *str);
+void             nx_string_builder_append_n(NXStringBuilder *sb, const char *str, size_t len);
 void             nx_string_builder_append_char(NXStringBuilder *sb, char c);
+void             nx_string_builder_appendf(NXStringBuilder *sb, const char *format, ...);
+void             nx_string_builder_vappendf(NXStringBuilder *sb, const char *format, va_list args);
 const char      *nx_string_builder_to_cstring(NXStringBuilder *sb);
+char            *nx_string_builder_detach(NXStringBuilder *sb);
 void             nx_string_builder_clear(NXStringBuilder *sb);
 /* }}} */
 
+/* Thread Pool {{{ */
+typedef void (*NXTaskFunc)(void *arg);
+
+/* Counts the unfinished tasks submitted with it, zero pending before the first submit */
+typedef struct {
+    size_t pending;
+} NXTaskGroup;
+
+typedef struct NXTask {
+    NXTaskFunc     func; /* NULL for the ranges of nx_parallel_for */
+    void          *arg;
+    NXTaskGroup   *group;
+    size_t         begin;
+    size_t         end;
+    struct NXTask *next; /* in the queue of tasks submitted from outside the pool */
+} NXTask;
+
+/* Chase-Lev deque, its owner pushes and pops at the bottom while thieves take from the top */
+typedef struct {
+    NXTask **tasks;
+    long     top;
+    char     padding[NX_CACHE_LINE_SIZE]; /* keeps thieves off the owner's cache line */
+    long     bottom;
+} NXTaskDeque;
+
+struct NXThreadPool;
+
+typedef struct {
+    struct NXThreadPool *pool;
+    pthread_t            thread;
+    NXTaskDeque          deque;
+    unsigned int         seed; /* picks the first worker to steal from */
+} NXThreadWorker;
+
+/* Tasks submitted by a worker go on its own deque, other threads submit to a shared queue. Idle
+ * workers steal, then sleep until something is submitted. Waiting on a group runs queued tasks and
+ * only sleeps when there are none, so tasks can submit and wait on tasks of their own */
+typedef struct NXThreadPool {
+    NXThreadWorker *workers;
+    size_t          worker_count;
+    NXPool         *tasks;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  done; /* a group finished or work was submitted, for nx_task_group_wait */
+    NXTask         *injected; /* tasks from outside the pool, under lock */
+    NXTask         *injected_tail;
+    size_t          injected_count;
+    size_t          queued; /* submitted and not yet taken by any thread */
+    size_t          sleeping;
+    size_t          waiting; /* threads sleeping in nx_task_group_wait */
+    bool            stop;
+} NXThreadPool;
+
+size_t        nx_cpu_count(void);
+NXThreadPool *nx_thread_pool_create(size_t worker_count);
+void          nx_thread_pool_destroy(NXThreadPool *pool);
+void          nx_thread_pool_submit(NXThreadPool *pool, NXTaskGroup *group, NXTaskFunc func,
+                                    void *arg);
+void          nx_task_group_wait(NXThreadPool *pool, NXTaskGroup *group);
+void          nx_parallel_for(NXThreadPool *pool, size_t begin, size_t end, size_t grain,
+                              void (*func)(size_t begin, size_t end, void *arg), void *arg);
+/* }}} */
+
 /* Command Runner {{{ */
+/* Commands built with nx_cr_append run through /bin/sh, commands built with nx_cr_arg are spawned
+ * directly from their argv. Don't mix the two on one NXCR */
 typedef struct {
     NXStringBuilder *command;
     char            *output;
     int              exit_code;
-    int              capture_output;
+    int              capture_output; /* 0 leaves stdout/stderr to the child, output stays NULL */
+    char           **argv;
+    size_t           argc;
+    size_t           argv_capacity;
 } NXCR;
 
 NXCR       *nx_cr_create(void);
 void        nx_cr_destroy(NXCR *cr);
 void        nx_cr_append(NXCR *cr, const char *str);
+void        nx_cr_arg(NXCR *cr, const char *arg);
+void        nx_cr_arg_split(NXCR *cr, const char *args);
 int         nx_cr_execute(NXCR *cr);
 const char *nx_cr_get_output(NXCR *cr);
 int         nx_cr_get_exit_code(NXCR *cr);
 int         nx_cr_run(const char *command);
+
+typedef enum {
+    NX_CR_JOB_PENDING = 0,
+    NX_CR_JOB_RUNNING,
+    NX_CR_JOB_DONE,
+    NX_CR_JOB_SKIPPED /* a dependency failed or was part of a cycle */
+} NXCRJobState;
+
+typedef struct {
+    NXCR            *cr;
+    const char      *description; /* printed with the result when set */
+    NXCRJobState     state;
+    pid_t            pid;
+    int              fd;
+    NXStringBuilder *output;
+    size_t          *deps;
+    size_t           dep_count;
+    bool             cached; /* skipped when the build cache says its target is up to date */
+} NXCRJob;
+
+/* Jobs always capture their output, whatever capture_output says, so it can be printed per job */
+typedef struct {
+    NXCRJob *jobs;
+    size_t   count;
+    size_t   capacity;
+    size_t   max_parallel;
+} NXCRPool;
+
+NXCRPool *nx_cr_pool_create(size_t max_parallel);
+void      nx_cr_pool_destroy(NXCRPool *pool);
+size_t    nx_cr_pool_submit(NXCRPool *pool, NXCR *cr, const char *description);
+bool      nx_cr_pool_depend(NXCRPool *pool, size_t job, size_t dependency);
+int       nx_cr_pool_run(NXCRPool *pool);
+NXCR     *nx_cr_pool_get(NXCRPool *pool, size_t job);
 /* }}} */
 
 /* Command Runner (Build) {{{ */
-int nx_rebuild(const char *source_file, int argc, char **argv);
-int nx_compile_command(const char *description, const char **args, int arg_count,
-                       bool enable_warnings);
+/* A target is up to date when it exists, was built by the same command and every input it was
+ * built from, headers from its -MMD depfile included, still hashes the same. The stat fields only
+ * let unchanged files skip the hashing */
+typedef struct {
+    char  *path;
+    size_t hash;
+    long   size;
+    time_t mtime_sec;
+    long   mtime_nsec;
+} NXBuildInput;
+
+typedef struct {
+    char         *target;
+    size_t        command_hash;
+    NXBuildInput *inputs;
+    size_t        input_count;
+    size_t        input_capacity;
+} NXBuildRecord;
+
+typedef struct {
+    NXArena        *arena;
+    char           *filename;
+    NXHashMap      *records; /* target -> NXBuildRecord */
+    NXBuildRecord **list;
+    size_t          count;
+    size_t          capacity;
+    bool            dirty;
+} NXBuildCache;
+
+NXBuildCache *nx_build_cache_load(const char *filename);
+bool          nx_build_cache_save(NXBuildCache *cache);
+void          nx_build_cache_destroy(NXBuildCache *cache);
+bool          nx_build_cache_fresh(NXBuildCache *cache, NXCR *cr);
+bool          nx_build_cache_record(NXBuildCache *cache, NXCR *cr);
+
+int    nx_rebuild(const char *source_file, int argc, char **argv);
+int    nx_compile_command(const char *description, const char **args, int arg_count,
+                          bool enable_warnings);
+size_t nx_cr_pool_compile(NXCRPool *pool, const char *description, const char **args,
+                          int arg_count, bool enable_warnings);
 
 #define NX_REBUILD(argc, argv)                                                                     \
     do {                                                                                           \
@@ -661,22 +1420,26 @@ int nx_compile_command(const char *description, const char **args, int arg_count
         }                                                                                          \
     } while (0)
 
+#define NX_CR_GCC_WARNINGS                                                                         \
+    "-Wall "                                                                                       \
+    "-Wextra "                                                                                     \
+    "-Wpedantic "                                                                                  \
+    "-Wshadow "                                                                                    \
+    "-Wpointer-arith "                                                                             \
+    "-Wcast-qual "                                                                                 \
+    "-Wno-unused-parameter "                                                                       \
+    "-fstack-protector-strong "                                                                    \
+    "-Wswitch-default "                                                                            \
+    "-Wstrict-prototypes "                                                                         \
+    "-Wmissing-prototypes "                                                                        \
+    "-Wmissing-declarations "                                                                      \
+    "-Wredundant-decls "                                                                           \
+    "-Wconversion "                                                                                \
+    "-Wsign-conversion"
+
 #define nx_cr_enable_gcc_warnings(cr)                                                              \
-    nx_cr_append(cr, "-Wall "                                                                      \
-                     "-Wextra "                                                                    \
-                     "-Wpedantic "                                                                 \
-                     "-Wshadow "                                                                   \
-                     "-Wpointer-arith "                                                            \
-                     "-Wcast-qual "                                                                \
-                     "-Wno-unused-parameter "                                                      \
-                     "-fstack-protector-strong "                                                   \
-                     "-Wswitch-default "                                                           \
-                     "-Wstrict-prototypes "                                                        \
-                     "-Wmissing-prototypes "                                                       \
-                     "-Wmissing-declarations "                                                     \
-                     "-Wredundant-decls "                                                          \
-                     "-Wconversion "                                                               \
-                     "-Wsign-conversion")
+    ((cr)->argc > 0 ? nx_cr_arg_split(cr, NX_CR_GCC_WARNINGS)                                      \
+                    : nx_cr_append(cr, NX_CR_GCC_WARNINGS))
 /* }}} */
 
 /* File IO {{{ */
@@ -690,8 +1453,69 @@ NXFile *nx_file_open(const char *filename, const char *mode);
 void    nx_file_close(NXFile *nx_file);
 char   *nx_file_read_all(const char *filename);
 int     nx_file_write_all(const char *filename, const char *data);
+int     nx_file_write_n(const char *filename, const void *data, size_t length);
 int     nx_file_exists(const char *filename);
 long    nx_file_size(const char *filename);
+
+typedef enum {
+    NX_FILE_MAP_COPY_ON_WRITE = 1 << 0, /* writes go to private pages, never to the file */
+    NX_FILE_MAP_SEQUENTIAL    = 1 << 1,
+    NX_FILE_MAP_RANDOM        = 1 << 2
+} NXFileMapFlags;
+
+typedef struct {
+    char  *data; /* only writable with NX_FILE_MAP_COPY_ON_WRITE, not NUL terminated */
+    size_t length;
+    bool   mapped; /* false when the contents were read into memory instead */
+} NXFileMap;
+
+typedef struct {
+    const void *data;
+    size_t      length;
+} NXFileBuffer;
+
+typedef enum {
+    NX_FILE_WRITE_ATOMIC = 1 << 0, /* write a temp file next to the target and rename it over */
+    NX_FILE_WRITE_SYNC   = 1 << 1  /* fdatasync before close, and the directory after a rename */
+} NXFileWriteFlags;
+
+int nx_file_writev(const char *filename, const NXFileBuffer *buffers, size_t count, int flags);
+
+NXFileMap *nx_file_map(const char *filename, int flags);
+void       nx_file_unmap(NXFileMap *map);
+
+typedef enum {
+    NX_FILE_TYPE_NONE = 0, /* the entry does not exist or could not be stat'ed */
+    NX_FILE_TYPE_REGULAR,
+    NX_FILE_TYPE_DIRECTORY,
+    NX_FILE_TYPE_OTHER
+} NXFileType;
+
+typedef struct {
+    NXFileType type;
+    long       size;
+    time_t     mtime_sec;
+    long       mtime_nsec;
+} NXFileStat;
+
+int    nx_file_stat(const char *filename, NXFileStat *st);
+size_t nx_file_stat_batch(int dir_fd, const char **names, size_t count, NXFileStat *stats);
+int    nx_file_stat_newer(const NXFileStat *a, const NXFileStat *b);
+
+/* Returned slices point into buffer and stay valid until the next call on the reader */
+typedef struct {
+    NXFile *file;
+    char   *buffer;
+    size_t  capacity;
+    size_t  start; /* first byte not yet handed out */
+    size_t  end;
+    bool    eof;
+} NXFileReader;
+
+NXFileReader *nx_file_reader_create(NXFile *file, size_t buffer_size);
+void          nx_file_reader_destroy(NXFileReader *reader);
+size_t        nx_file_read_chunk(NXFileReader *reader, const char **data);
+bool          nx_file_next_line(NXFileReader *reader, const char **line, size_t *length);
 /* }}} */
 
 /* Logging {{{ */
@@ -704,12 +1528,69 @@ typedef enum {
     NX_LOG_FATAL
 } NXLogLevel;
 
+typedef enum { NX_LOG_OVERFLOW_BLOCK = 0, NX_LOG_OVERFLOW_DROP } NXLogOverflow;
+
+typedef enum { NX_LOG_TIME_SECONDS = 0, NX_LOG_TIME_MILLIS, NX_LOG_TIME_MICROS } NXLogTimePrecision;
+
+/* NX_LOG_ERROR and above always flush, whatever the policy */
+typedef enum {
+    NX_LOG_FLUSH_ALWAYS = 0,
+    NX_LOG_FLUSH_LINES,    /* every flush_every lines */
+    NX_LOG_FLUSH_INTERVAL, /* when flush_every milliseconds have passed */
+    NX_LOG_FLUSH_ERROR
+} NXLogFlushPolicy;
+
+typedef union {
+    long          i;
+    unsigned long u;
+    double        d;
+    long double   ld;
+    const void   *p;
+    size_t        offset; /* of a %s argument copied into the record text */
+} NXLogArg;
+
+/* A deferred record keeps the format pointer and raw arguments, text holds only copied strings */
+typedef struct {
+    size_t          sequence;
+    NXLogLevel      level;
+    struct timespec time;
+    const char     *format;
+    size_t          arg_count;
+    NXLogArg        args[NX_LOG_MAX_ARGS];
+    size_t          length;
+    char            text[NX_LOG_RECORD_SIZE];
+} NXLogRecord;
+
 typedef struct {
     NXFile          *file;
     bool             use_stdout;
     bool             use_timestamps;
     NXLogLevel       min_level;
     NXStringBuilder *buffer;
+
+    /* Only touched by the thread that writes, the caller or the async writer thread */
+    NXLogTimePrecision time_precision;
+    time_t             cached_second;
+    char               cached_time[32];
+    size_t             cached_time_len;
+    NXLogFlushPolicy   flush_policy;
+    size_t             flush_every;
+    size_t             pending_lines;
+    struct timespec    last_flush;
+
+    /* Async mode, records is NULL for synchronous loggers */
+    NXLogRecord    *records;
+    NXLogOverflow   overflow;
+    bool            deferred;
+    size_t          head;
+    size_t          tail;
+    size_t          dropped;
+    int             sleeping;
+    bool            stop;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  wake;
+    pthread_cond_t  drained;
 } NXLogger;
 
 const char *NX_LOG_LEVEL_STRINGS[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
@@ -725,38 +1606,129 @@ const char *NX_LOG_LEVEL_COLORS[] = {
 
 NXLogger *nx_logger_create(const char *filename, bool use_stdout, bool use_timestamps,
                            NXLogLevel min_level);
+NXLogger *nx_logger_create_async(const char *filename, bool use_stdout, bool use_timestamps,
+                                 NXLogLevel min_level, NXLogOverflow overflow);
 void      nx_logger_destroy(NXLogger *logger);
 void      nx_logger_log(NXLogger *logger, NXLogLevel level, const char *format, ...);
+void      nx_logger_flush(NXLogger *logger);
+void      nx_logger_set_time_precision(NXLogger *logger, NXLogTimePrecision precision);
+void      nx_logger_set_flush_policy(NXLogger *logger, NXLogFlushPolicy policy, size_t every);
+void      nx_logger_set_deferred(NXLogger *logger, bool deferred);
+
+#define nx_logger_enabled(l, level) ((level) >= (l)->min_level)
+#define _nx_logger_log_if(l, level, args)                                                          \
+    (nx_logger_enabled(l, level) ? nx_logger_log args : (void) 0)
+
+#if NX_LOG_COMPILE_LEVEL <= 0
+#define nx_logger_trace(l, f) _nx_logger_log_if(l, NX_LOG_TRACE, (l, NX_LOG_TRACE, f))
+#define nx_logger_trace1(l, f, a1) _nx_logger_log_if(l, NX_LOG_TRACE, (l, NX_LOG_TRACE, f, a1))
+#define nx_logger_trace2(l, f, a1, a2)                                                             \
+    _nx_logger_log_if(l, NX_LOG_TRACE, (l, NX_LOG_TRACE, f, a1, a2))
+#define nx_logger_trace3(l, f, a1, a2, a3)                                                         \
+    _nx_logger_log_if(l, NX_LOG_TRACE, (l, NX_LOG_TRACE, f, a1, a2, a3))
+#else
+#define nx_logger_trace(l, f) (void) 0
+#define nx_logger_trace1(l, f, a1) (void) 0
+#define nx_logger_trace2(l, f, a1, a2) (void) 0
+#define nx_logger_trace3(l, f, a1, a2, a3) (void) 0
+#endif
+
+#if NX_LOG_COMPILE_LEVEL <= 1
+#define nx_logger_debug(l, f) _nx_logger_log_if(l, NX_LOG_DEBUG, (l, NX_LOG_DEBUG, f))
+#define nx_logger_debug1(l, f, a1) _nx_logger_log_if(l, NX_LOG_DEBUG, (l, NX_LOG_DEBUG, f, a1))
+#define nx_logger_debug2(l, f, a1, a2)                                                             \
+    _nx_logger_log_if(l, NX_LOG_DEBUG, (l, NX_LOG_DEBUG, f, a1, a2))
+#define nx_logger_debug3(l, f, a1, a2, a3)                                                         \
+    _nx_logger_log_if(l, NX_LOG_DEBUG, (l, NX_LOG_DEBUG, f, a1, a2, a3))
+#else
+#define nx_logger_debug(l, f) (void) 0
+#define nx_logger_debug1(l, f, a1) (void) 0
+#define nx_logger_debug2(l, f, a1, a2) (void) 0
+#define nx_logger_debug3(l, f, a1, a2, a3) (void) 0
+#endif
+
+#if NX_LOG_COMPILE_LEVEL <= 2
+#define nx_logger_info(l, f) _nx_logger_log_if(l, NX_LOG_INFO, (l, NX_LOG_INFO, f))
+#define nx_logger_info1(l, f, a1) _nx_logger_log_if(l, NX_LOG_INFO, (l, NX_LOG_INFO, f, a1))
+#define nx_logger_info2(l, f, a1, a2) _nx_logger_log_if(l, NX_LOG_INFO, (l, NX_LOG_INFO, f, a1, a2))
+#define nx_logger_info3(l, f, a1, a2, a3)                                                          \
+    _nx_logger_log_if(l, NX_LOG_INFO, (l, NX_LOG_INFO, f, a1, a2, a3))
+#else
+#define nx_logger_info(l, f) (void) 0
+#define nx_logger_info1(l, f, a1) (void) 0
+#define nx_logger_info2(l, f, a1, a2) (void) 0
+#define nx_logger_info3(l, f, a1, a2, a3) (void) 0
+#endif
+
+#if NX_LOG_COMPILE_LEVEL <= 3
+#define nx_logger_warn(l, f) _nx_logger_log_if(l, NX_LOG_WARN, (l, NX_LOG_WARN, f))
+#define nx_logger_warn1(l, f, a1) _nx_logger_log_if(l, NX_LOG_WARN, (l, NX_LOG_WARN, f, a1))
+#define nx_logger_warn2(l, f, a1, a2) _nx_logger_log_if(l, NX_LOG_WARN, (l, NX_LOG_WARN, f, a1, a2))
+#define nx_logger_warn3(l, f, a1, a2, a3)                                                          \
+    _nx_logger_log_if(l, NX_LOG_WARN, (l, NX_LOG_WARN, f, a1, a2, a3))
+#else
+#define nx_logger_warn(l, f) (void) 0
+#define nx_logger_warn1(l, f, a1) (void) 0
+#define nx_logger_warn2(l, f, a1, a2) (void) 0
+#define nx_logger_warn3(l, f, a1, a2, a3) (void) 0
+#endif
+
+#if NX_LOG_COMPILE_LEVEL <= 4
+#define nx_logger_error(l, f) _nx_logger_log_if(l, NX_LOG_ERROR, (l, NX_LOG_ERROR, f))
+#define nx_logger_error1(l, f, a1) _nx_logger_log_if(l, NX_LOG_ERROR, (l, NX_LOG_ERROR, f, a1))
+#define nx_logger_error2(l, f, a1, a2)                                                             \
+    _nx_logger_log_if(l, NX_LOG_ERROR, (l, NX_LOG_ERROR, f, a1, a2))
+#define nx_logger_error3(l, f, a1, a2, a3)                                                         \
+    _nx_logger_log_if(l, NX_LOG_ERROR, (l, NX_LOG_ERROR, f, a1, a2, a3))
+#else
+#define nx_logger_error(l, f) (void) 0
+#define nx_logger_error1(l, f, a1) (void) 0
+#define nx_logger_error2(l, f, a1, a2) (void) 0
+#define nx_logger_error3(l, f, a1, a2, a3) (void) 0
+#endif
+
+#if NX_LOG_COMPILE_LEVEL <= 5
+#define nx_logger_fatal(l, f) _nx_logger_log_if(l, NX_LOG_FATAL, (l, NX_LOG_FATAL, f))
+#define nx_logger_fatal1(l, f, a1) _nx_logger_log_if(l, NX_LOG_FATAL, (l, NX_LOG_FATAL, f, a1))
+#define nx_logger_fatal2(l, f, a1, a2)                                                             \
+    _nx_logger_log_if(l, NX_LOG_FATAL, (l, NX_LOG_FATAL, f, a1, a2))
+#define nx_logger_fatal3(l, f, a1, a2, a3)                                                         \
+    _nx_logger_log_if(l, NX_LOG_FATAL, (l, NX_LOG_FATAL, f, a1, a2, a3))
+#else
+#define nx_logger_fatal(l, f) (void) 0
+#define nx_logger_fatal1(l, f, a1) (void) 0
+#define nx_logger_fatal2(l, f, a1, a2) (void) 0
+#define nx_logger_fatal3(l, f, a1, a2, a3) (void) 0
+#endif
+/* }}} */
 
-#define nx_logger_trace(l, f) nx_logger_log(l, NX_LOG_TRACE, f)
-#define nx_logger_trace1(l, f, a1) nx_logger_log(l, NX_LOG_TRACE, f, a1)
-#define nx_logger_trace2(l, f, a1, a2) nx_logger_log(l, NX_LOG_TRACE, f, a1, a2)
-#define nx_logger_trace3(l, f, a1, a2, a3) nx_logger_log(l, NX_LOG_TRACE, f, a1, a2, a3)
-
-#define nx_logger_debug(l, f) nx_logger_log(l, NX_LOG_DEBUG, f)
-#define nx_logger_debug1(l, f, a1) nx_logger_log(l, NX_LOG_DEBUG, f, a1)
-#define nx_logger_debug2(l, f, a1, a2) nx_logger_log(l, NX_LOG_DEBUG, f, a1, a2)
-#define nx_logger_debug3(l, f, a1, a2, a3) nx_logger_log(l, NX_LOG_DEBUG, f, a1, a2, a3)
-
-#define nx_logger_info(l, f) nx_logger_log(l, NX_LOG_INFO, f)
-#define nx_logger_info1(l, f, a1) nx_logger_log(l, NX_LOG_INFO, f, a1)
-#define nx_logger_info2(l, f, a1, a2) nx_logger_log(l, NX_LOG_INFO, f, a1, a2)
-#define nx_logger_info3(l, f, a1, a2, a3) nx_logger_log(l, NX_LOG_INFO, f, a1, a2, a3)
-
-#define nx_logger_warn(l, f) nx_logger_log(l, NX_LOG_WARN, f)
-#define nx_logger_warn1(l, f, a1) nx_logger_log(l, NX_LOG_WARN, f, a1)
-#define nx_logger_warn2(l, f, a1, a2) nx_logger_log(l, NX_LOG_WARN, f, a1, a2)
-#define nx_logger_warn3(l, f, a1, a2, a3) nx_logger_log(l, NX_LOG_WARN, f, a1, a2, a3)
-
-#define nx_logger_error(l, f) nx_logger_log(l, NX_LOG_ERROR, f)
-#define nx_logger_error1(l, f, a1) nx_logger_log(l, NX_LOG_ERROR, f, a1)
-#define nx_logger_error2(l, f, a1, a2) nx_logger_log(l, NX_LOG_ERROR, f, a1, a2)
-#define nx_logger_error3(l, f, a1, a2, a3) nx_logger_log(l, NX_LOG_ERROR, f, a1, a2, a3)
-
-#define nx_logger_fatal(l, f) nx_logger_log(l, NX_LOG_FATAL, f)
-#define nx_logger_fatal1(l, f, a1) nx_logger_log(l, NX_LOG_FATAL, f, a1)
-#define nx_logger_fatal2(l, f, a1, a2) nx_logger_log(l, NX_LOG_FATAL, f, a1, a2)
-#define nx_logger_fatal3(l, f, a1, a2, a3) nx_logger_log(l, NX_LOG_FATAL, f, a1, a2, a3)
+/* Stats {{{ */
+#ifdef NX_STATS
+typedef struct {
+    size_t hashmap_lookups;
+    size_t hashmap_probes; /* chain entries or flat groups inspected */
+    size_t hashmap_max_probe;
+    size_t hashmap_resizes;
+    size_t hashmap_resize_usec;
+    size_t arena_blocks;
+    size_t arena_bytes_reserved;
+    size_t string_builder_reallocs;
+    size_t string_builder_bytes_reserved;
+} NXStats;
+
+extern NXStats nx_stats;
+
+void nx_stats_dump(NXLogger *logger);
+void nx_stats_reset(void);
+
+#define nx_stats_add(field, n) ((void) __atomic_fetch_add(&nx_stats.field, (n), __ATOMIC_RELAXED))
+#define nx_stats_sub(field, n) ((void) __atomic_fetch_sub(&nx_stats.field, (n), __ATOMIC_RELAXED))
+#else
+#define nx_stats_dump(logger) (void) 0
+#define nx_stats_reset() (void) 0
+#define nx_stats_add(field, n) (void) 0
+#define nx_stats_sub(field, n) (void) 0
+#endif /* NX_STATS */
 /* }}} */
 
 #ifdef __cplusplus
@@ -770,111 +1742,267 @@ void      nx_logger_log(NXLogger *logger, NXLogLevel level, const char *format,
 /* Memory Tracker {{{ */
 #ifdef NX_DEBUG
 
-typedef struct NXMemoryBlock {
-    void                 *ptr;
-    size_t                size;
-    const char           *file;
-    int                   line;
-    struct NXMemoryBlock *next;
+/* Live allocations and callsites are kept in two open addressing tables with linear probing.
+ * Both use the system allocator directly and are guarded by one mutex. */
+typedef struct {
+    void       *ptr;
+    size_t      size;
+    const char *file;
+    int         line;
 } NXMemoryBlock;
 
-static NXMemoryBlock *memoryList = NULL;
+typedef struct {
+    const char *file;
+    int         line;
+    size_t      bytes;
+    size_t      count;
+    size_t      peak;
+    size_t      total;
+} NXMemorySite;
+
+static NXMemoryBlock  *memoryBlocks     = NULL;
+static size_t          memoryBlockCount = 0;
+static size_t          memoryBlockCap   = 0;
+static NXMemorySite   *memorySites      = NULL;
+static size_t          memorySiteCount  = 0;
+static size_t          memorySiteCap    = 0;
+static pthread_mutex_t memoryLock       = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t _nx_memory_hash_ptr(const void *ptr) {
+    size_t hash = (size_t) ptr >> 4;
+    return hash ^ (hash >> 15) ^ (hash >> 31);
+}
 
-void *nx_malloc_debug(size_t size, const char *file, int line) {
-    void *ptr = malloc(size);
-    if (ptr) {
-        NXMemoryBlock *block = (NXMemoryBlock *) malloc(sizeof(NXMemoryBlock));
-        block->ptr           = ptr;
-        block->size          = size;
-        block->file          = file;
-        block->line          = line;
-        block->next          = memoryList;
-        memoryList           = block;
-    }
-    return ptr;
+static size_t _nx_memory_hash_site(const char *file, int line) {
+    return _nx_memory_hash_ptr(file) * 31 + (size_t) line;
 }
 
-void *nx_calloc_debug(size_t num, size_t size, const char *file, int line) {
-    void *ptr = calloc(num, size);
-    if (ptr) {
-        NXMemoryBlock *block = (NXMemoryBlock *) malloc(sizeof(NXMemoryBlock));
-        block->ptr           = ptr;
-        block->size          = num * size;
-        block->file          = file;
-        block->line          = line;
-        block->next          = memoryList;
-        memoryList           = block;
+/* Returns the slot of a callsite, which is empty (file == NULL) if it was never seen */
+static NXMemorySite *_nx_memory_find_site(const char *file, int line) {
+    size_t mask  = memorySiteCap - 1;
+    size_t index = _nx_memory_hash_site(file, line) & mask;
+    while (memorySites[index].file &&
+           (memorySites[index].file != file || memorySites[index].line != line)) {
+        index = (index + 1) & mask;
     }
-    return ptr;
+    return &memorySites[index];
 }
 
-void *nx_realloc_debug(void *ptr, size_t size, const char *file, int line) {
-    void *newPtr = realloc(ptr, size);
-    if (newPtr) {
-        if (ptr == NULL) {
-            NXMemoryBlock *block = (NXMemoryBlock *) malloc(sizeof(NXMemoryBlock));
-            block->ptr           = newPtr;
-            block->size          = size;
-            block->file          = file;
-            block->line          = line;
-            block->next          = memoryList;
-            memoryList           = block;
-        } else {
-            NXMemoryBlock  *block;
-            NXMemoryBlock **current = &memoryList;
-            while (*current) {
-                if ((*current)->ptr == ptr) {
-                    NXMemoryBlock *temp = *current;
-                    *current            = (*current)->next;
-                    free(temp);
-                    break;
-                }
-                current = &(*current)->next;
-            }
+static bool _nx_memory_grow_sites(void) {
+    size_t        i;
+    size_t        old_cap   = memorySiteCap;
+    NXMemorySite *old_sites = memorySites;
 
-            block       = (NXMemoryBlock *) malloc(sizeof(NXMemoryBlock));
-            block->ptr  = newPtr;
-            block->size = size;
-            block->file = file;
-            block->line = line;
-            block->next = memoryList;
-            memoryList  = block;
+    memorySiteCap = old_cap ? old_cap * 2 : 256;
+    memorySites   = (NXMemorySite *) calloc(memorySiteCap, sizeof(NXMemorySite));
+    if (!memorySites) {
+        memorySites   = old_sites;
+        memorySiteCap = old_cap;
+        return false;
+    }
+    for (i = 0; i < old_cap; i++) {
+        if (old_sites[i].file) {
+            *_nx_memory_find_site(old_sites[i].file, old_sites[i].line) = old_sites[i];
         }
     }
-    return newPtr;
+    free(old_sites);
+    return true;
 }
 
-void nx_free_debug(void *ptr) {
-    if (ptr) {
-        NXMemoryBlock **block = &memoryList;
-        while (*block) {
-            if ((*block)->ptr == ptr) {
-                NXMemoryBlock *temp = *block;
-                *block              = (*block)->next;
-                free(temp);
-                break;
-            }
-            block = &(*block)->next;
-        }
-        free(ptr);
+static size_t _nx_memory_find_block(const void *ptr) {
+    size_t mask  = memoryBlockCap - 1;
+    size_t index = _nx_memory_hash_ptr(ptr) & mask;
+    while (memoryBlocks[index].ptr && memoryBlocks[index].ptr != ptr) {
+        index = (index + 1) & mask;
     }
+    return index;
 }
 
-void nx_print_memory_leaks(void) {
-    if (memoryList) {
-        NXMemoryBlock *block = memoryList;
-        while (block) {
-            fprintf(stderr,
-                    "Leaked memory at address %p, size %lu bytes, "
-                    "allocated at %s:%d\n",
-                    block->ptr, block->size, block->file, block->line);
-            block = block->next;
+static bool _nx_memory_grow_blocks(void) {
+    size_t         i;
+    size_t         old_cap    = memoryBlockCap;
+    NXMemoryBlock *old_blocks = memoryBlocks;
+
+    memoryBlockCap = old_cap ? old_cap * 2 : 1024;
+    memoryBlocks   = (NXMemoryBlock *) calloc(memoryBlockCap, sizeof(NXMemoryBlock));
+    if (!memoryBlocks) {
+        memoryBlocks   = old_blocks;
+        memoryBlockCap = old_cap;
+        return false;
+    }
+    for (i = 0; i < old_cap; i++) {
+        if (old_blocks[i].ptr) {
+            memoryBlocks[_nx_memory_find_block(old_blocks[i].ptr)] = old_blocks[i];
         }
-    } else {
-        fprintf(stderr, "No memory leaks detected.\n");
     }
+    free(old_blocks);
+    return true;
 }
-#endif /* NX_DEBUG */
+
+static void _nx_memory_track(void *ptr, size_t size, const char *file, int line) {
+    NXMemoryBlock *block;
+    NXMemorySite  *site;
+
+    pthread_mutex_lock(&memoryLock);
+
+    /* Both tables are kept at most half full so probe sequences stay short */
+    if ((memoryBlockCount + 1) * 2 > memoryBlockCap && !_nx_memory_grow_blocks()) {
+        pthread_mutex_unlock(&memoryLock);
+        return;
+    }
+    if ((memorySiteCount + 1) * 2 > memorySiteCap && !_nx_memory_grow_sites()) {
+        pthread_mutex_unlock(&memoryLock);
+        return;
+    }
+
+    block       = &memoryBlocks[_nx_memory_find_block(ptr)];
+    block->ptr  = ptr;
+    block->size = size;
+    block->file = file;
+    block->line = line;
+    memoryBlockCount++;
+
+    site = _nx_memory_find_site(file, line);
+    if (!site->file) {
+        site->file = file;
+        site->line = line;
+        memorySiteCount++;
+    }
+    site->bytes += size;
+    site->count++;
+    site->total++;
+    if (site->bytes > site->peak) {
+        site->peak = site->bytes;
+    }
+
+    pthread_mutex_unlock(&memoryLock);
+}
+
+/* Removes a block from the index, a copy of it is stored in removed when not NULL */
+static bool _nx_memory_untrack(void *ptr, NXMemoryBlock *removed) {
+    size_t        index;
+    size_t        next;
+    size_t        mask;
+    NXMemorySite *site;
+
+    pthread_mutex_lock(&memoryLock);
+
+    if (memoryBlockCount == 0) {
+        pthread_mutex_unlock(&memoryLock);
+        return false;
+    }
+
+    index = _nx_memory_find_block(ptr);
+    if (!memoryBlocks[index].ptr) {
+        pthread_mutex_unlock(&memoryLock);
+        return false;
+    }
+    if (removed) {
+        *removed = memoryBlocks[index];
+    }
+
+    site = _nx_memory_find_site(memoryBlocks[index].file, memoryBlocks[index].line);
+    site->bytes -= memoryBlocks[index].size;
+    site->count--;
+
+    /* Backward shift deletion keeps the probe sequences intact without tombstones */
+    mask = memoryBlockCap - 1;
+    next = (index + 1) & mask;
+    while (memoryBlocks[next].ptr) {
+        size_t home = _nx_memory_hash_ptr(memoryBlocks[next].ptr) & mask;
+        if (((next - home) & mask) >= ((next - index) & mask)) {
+            memoryBlocks[index] = memoryBlocks[next];
+            index               = next;
+        }
+        next = (next + 1) & mask;
+    }
+    memoryBlocks[index].ptr = NULL;
+    memoryBlockCount--;
+
+    pthread_mutex_unlock(&memoryLock);
+    return true;
+}
+
+void *nx_malloc_debug(size_t size, const char *file, int line) {
+    void *ptr = malloc(size);
+    if (ptr) {
+        _nx_memory_track(ptr, size, file, line);
+    }
+    return ptr;
+}
+
+void *nx_calloc_debug(size_t num, size_t size, const char *file, int line) {
+    void *ptr = calloc(num, size);
+    if (ptr) {
+        _nx_memory_track(ptr, num * size, file, line);
+    }
+    return ptr;
+}
+
+void *nx_realloc_debug(void *ptr, size_t size, const char *file, int line) {
+    NXMemoryBlock old;
+    bool          tracked = false;
+    void         *newPtr;
+
+    /* Untrack first, once realloc returns another thread may already be handed the old address */
+    if (ptr) {
+        tracked = _nx_memory_untrack(ptr, &old);
+    }
+    newPtr = realloc(ptr, size);
+    if (newPtr) {
+        _nx_memory_track(newPtr, size, file, line);
+    } else if (tracked && size > 0) {
+        _nx_memory_track(ptr, old.size, old.file, old.line);
+    }
+    return newPtr;
+}
+
+void nx_free_debug(void *ptr) {
+    if (ptr) {
+        _nx_memory_untrack(ptr, NULL);
+        free(ptr);
+    }
+}
+
+void nx_print_memory_leaks(void) {
+    size_t i;
+
+    pthread_mutex_lock(&memoryLock);
+    if (memoryBlockCount > 0) {
+        for (i = 0; i < memoryBlockCap; i++) {
+            NXMemoryBlock *block = &memoryBlocks[i];
+            if (block->ptr) {
+                fprintf(stderr,
+                        "Leaked memory at address %p, size %lu bytes, "
+                        "allocated at %s:%d\n",
+                        block->ptr, (unsigned long) block->size, block->file, block->line);
+            }
+        }
+    } else {
+        fprintf(stderr, "No memory leaks detected.\n");
+    }
+    pthread_mutex_unlock(&memoryLock);
+}
+
+void nx_print_memory_sites(void) {
+    size_t i;
+
+    pthread_mutex_lock(&memoryLock);
+    fprintf(stderr, "%-40s %12s %8s %12s %10s\n", "callsite", "live bytes", "live", "peak bytes",
+            "total");
+    for (i = 0; i < memorySiteCap; i++) {
+        NXMemorySite *site = &memorySites[i];
+        if (site->file) {
+            char location[256];
+            nx_snprintf(location, sizeof(location), "%s:%d", site->file, site->line);
+            fprintf(stderr, "%-40s %12lu %8lu %12lu %10lu\n", location,
+                    (unsigned long) site->bytes, (unsigned long) site->count,
+                    (unsigned long) site->peak, (unsigned long) site->total);
+        }
+    }
+    pthread_mutex_unlock(&memoryLock);
+}
+#endif /* NX_DEBUG */
 /* }}}} */
 
 /* Error Handling {{{ */
@@ -902,76 +2030,210 @@ void nx_die_impl(const char *file, int line, const char *fmt, ...) {
 /* }}} */
 
 /* Arena {{{ */
-NXArena *nx_arena_create(void) {
-    NXArena      *arena;
-    NXArenaBlock *block;
+static size_t _nx_align_forward(size_t value, size_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
 
-    arena = malloc(sizeof(NXArena));
-    if (!arena) {
+/* Blocks are allocated together with their memory, which directly follows the header */
+static NXArenaBlock *_nx_arena_block_create(size_t size) {
+    NXArenaBlock *block = malloc(sizeof(NXArenaBlock) + size);
+    if (!block) {
         return NULL;
     }
+    nx_stats_add(arena_blocks, 1);
+    nx_stats_add(arena_bytes_reserved, size);
+    block->memory = block + 1;
+    block->used   = 0;
+    block->size   = size;
+    block->next   = NULL;
+    return block;
+}
+
+static void _nx_arena_free_blocks(NXArenaBlock *block, NXArenaBlock *until) {
+    while (block != until) {
+        NXArenaBlock *next = block->next;
+        nx_stats_sub(arena_blocks, 1);
+        nx_stats_sub(arena_bytes_reserved, block->size);
+        free(block);
+        block = next;
+    }
+}
 
-    block = malloc(sizeof(NXArenaBlock));
-    if (!block) {
-        free(arena);
+NXArena *nx_arena_create(void) {
+    NXArena *arena;
+
+    arena = malloc(sizeof(NXArena));
+    if (!arena) {
         return NULL;
     }
 
-    block->memory = malloc(NX_ARENA_BLOCK_SIZE);
-    if (!block->memory) {
-        free(block);
+    arena->first = _nx_arena_block_create(NX_ARENA_BLOCK_SIZE);
+    if (!arena->first) {
         free(arena);
         return NULL;
     }
 
-    block->used = 0;
-    block->size = NX_ARENA_BLOCK_SIZE;
-    block->next = NULL;
+    arena->current         = arena->first;
+    arena->large           = NULL;
+    arena->next_block_size = NX_ARENA_BLOCK_SIZE * 2;
+    arena->concurrent      = false;
 
-    arena->first   = block;
-    arena->current = block;
+    return arena;
+}
 
+NXArena *nx_arena_create_concurrent(void) {
+    NXArena *arena = nx_arena_create();
+    if (arena) {
+        arena->concurrent = true;
+    }
     return arena;
 }
 
 void *nx_arena_alloc(NXArena *arena, size_t size) {
-    NXArenaBlock *current;
-    void         *ptr;
+    return nx_arena_alloc_aligned(arena, size, NX_ARENA_ALIGNMENT);
+}
 
-    /* Ensure 8-byte alignment using unsigned arithmetic */
-    size = (size + 7U) & ~7U;
+/* Lock-free bump allocation. The worst case padding is reserved with a single fetch-add, a
+ * thread that overshoots the block installs (or adopts) the next block with CAS and retries. */
+static void *_nx_arena_alloc_concurrent(NXArena *arena, size_t size, size_t alignment) {
+    size_t reserve = size + alignment - 1;
 
-    current = arena->current;
-    if (current->used + size > current->size) {
-        size_t        new_block_size;
-        NXArenaBlock *new_block;
+    for (;;) {
+        NXArenaBlock *current = nx_atomic_load(&arena->current);
+        NXArenaBlock *next;
+        size_t        used = nx_atomic_fetch_add(&current->used, reserve);
 
-        new_block_size = size > NX_ARENA_BLOCK_SIZE ? size : NX_ARENA_BLOCK_SIZE;
+        if (used + reserve <= current->size) {
+            size_t base = (size_t) current->memory;
+            return (char *) current->memory + (_nx_align_forward(base + used, alignment) - base);
+        }
 
-        new_block = malloc(sizeof(NXArenaBlock));
-        if (!new_block) {
-            return NULL;
+        next = nx_atomic_load(&current->next);
+        if (!next) {
+            size_t        block_size = nx_atomic_load(&arena->next_block_size);
+            NXArenaBlock *new_block  = _nx_arena_block_create(block_size);
+            if (!new_block) {
+                return NULL;
+            }
+            if (nx_atomic_cas(&current->next, &next, new_block)) {
+                next = new_block;
+                if (block_size < NX_ARENA_MAX_BLOCK_SIZE) {
+                    nx_atomic_store(&arena->next_block_size, block_size * 2);
+                }
+            } else {
+                _nx_arena_free_blocks(new_block, NULL);
+            }
         }
+        nx_atomic_cas(&arena->current, &current, next);
+    }
+}
+
+void *nx_arena_alloc_aligned(NXArena *arena, size_t size, size_t alignment) {
+    NXArenaBlock *current;
+    size_t        base;
+    size_t        offset;
+
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
 
-        new_block->memory = malloc(new_block_size);
-        if (!new_block->memory) {
-            free(new_block);
+    /* Oversized requests get a block of their own on a separate list, so the space left in the
+     * current block stays usable for the allocations that follow */
+    if (size + alignment - 1 > NX_ARENA_BLOCK_SIZE) {
+        NXArenaBlock *block = _nx_arena_block_create(size + alignment - 1);
+        if (!block) {
             return NULL;
         }
+        base        = (size_t) block->memory;
+        block->used = block->size;
+        if (arena->concurrent) {
+            NXArenaBlock *head = nx_atomic_load(&arena->large);
+            do {
+                block->next = head;
+            } while (!nx_atomic_cas(&arena->large, &head, block));
+        } else {
+            block->next  = arena->large;
+            arena->large = block;
+        }
+        return (char *) block->memory + (_nx_align_forward(base, alignment) - base);
+    }
+
+    if (arena->concurrent) {
+        return _nx_arena_alloc_concurrent(arena, size, alignment);
+    }
 
-        new_block->used = 0;
-        new_block->size = new_block_size;
-        new_block->next = NULL;
+    current = arena->current;
+    for (;;) {
+        base   = (size_t) current->memory;
+        offset = _nx_align_forward(base + current->used, alignment) - base;
+        if (offset + size <= current->size) {
+            break;
+        }
 
-        current->next  = new_block;
-        arena->current = new_block;
-        current        = new_block;
+        /* Blocks after the current one are empty, they are kept around by reset and rewind */
+        if (!current->next) {
+            NXArenaBlock *new_block = _nx_arena_block_create(arena->next_block_size);
+            if (!new_block) {
+                return NULL;
+            }
+            if (arena->next_block_size < NX_ARENA_MAX_BLOCK_SIZE) {
+                arena->next_block_size *= 2;
+            }
+            current->next = new_block;
+        }
+        current        = current->next;
+        arena->current = current;
     }
 
-    ptr = (char *) current->memory + current->used;
-    current->used += size;
+    current->used = offset + size;
+    return (char *) current->memory + offset;
+}
 
-    return ptr;
+/* Bytes handed out versus bytes held in blocks, oversized allocations count as fully used */
+void nx_arena_usage(NXArena *arena, size_t *used, size_t *reserved) {
+    NXArenaBlock *block;
+    size_t        total_used     = 0;
+    size_t        total_reserved = 0;
+
+    for (block = arena->first; block; block = block->next) {
+        total_used += nx_min(block->used, block->size);
+        total_reserved += block->size;
+    }
+    for (block = arena->large; block; block = block->next) {
+        total_used += block->size;
+        total_reserved += block->size;
+    }
+
+    if (used) {
+        *used = total_used;
+    }
+    if (reserved) {
+        *reserved = total_reserved;
+    }
+}
+
+NXArenaMark nx_arena_mark(NXArena *arena) {
+    NXArenaMark mark;
+    mark.block = arena->current;
+    mark.used  = arena->current->used;
+    mark.large = arena->large;
+    return mark;
+}
+
+/* Releases everything allocated after the mark. The mark must not be older than the last
+ * nx_arena_reset. Marks, rewinds and resets of a concurrent arena must not race with
+ * allocations. */
+void nx_arena_rewind(NXArena *arena, NXArenaMark mark) {
+    NXArenaBlock *block;
+
+    _nx_arena_free_blocks(arena->large, mark.large);
+    arena->large = mark.large;
+
+    for (block = mark.block->next; block; block = block->next) {
+        block->used = 0;
+    }
+    mark.block->used = mark.used;
+    arena->current   = mark.block;
 }
 
 void nx_arena_reset(NXArena *arena) {
@@ -981,778 +2243,3691 @@ void nx_arena_reset(NXArena *arena) {
         block       = block->next;
     }
     arena->current = arena->first;
+
+    _nx_arena_free_blocks(arena->large, NULL);
+    arena->large = NULL;
 }
 
 void nx_arena_destroy(NXArena *arena) {
-    NXArenaBlock *block = arena->first;
-    while (block) {
-        NXArenaBlock *next = block->next;
-        free(block->memory);
-        free(block);
-        block = next;
-    }
+    _nx_arena_free_blocks(arena->first, NULL);
+    _nx_arena_free_blocks(arena->large, NULL);
     free(arena);
 }
-/* }}} */
 
-/* Linked Lists {{{ */
-NXSinglyLinkedList *nx_sll_create(void) {
-    NXSinglyLinkedList *list = (NXSinglyLinkedList *) nx_malloc(sizeof(NXSinglyLinkedList));
-    if (!list) {
-        return NULL;
-    }
-    list->head = list->tail = NULL;
-    return list;
+static pthread_key_t  _nx_scratch_key;
+static pthread_once_t _nx_scratch_once = PTHREAD_ONCE_INIT;
+
+static void _nx_scratch_destroy(void *arena) {
+    nx_arena_destroy((NXArena *) arena);
 }
 
-void nx_sll_destroy(NXSinglyLinkedList *list) {
-    NXSLLNode *current = list->head;
-    while (current) {
-        NXSLLNode *next = current->next;
-        nx_free(current);
-        current = next;
-    }
-    nx_free(list);
+static void _nx_scratch_init(void) {
+    pthread_key_create(&_nx_scratch_key, _nx_scratch_destroy);
 }
 
-void nx_sll_append(NXSinglyLinkedList *list, void *data) {
-    NXSLLNode *new_node = (NXSLLNode *) nx_malloc(sizeof(NXSLLNode));
-    if (!new_node) {
-        return;
+/* Returns the arena of the calling thread, it is destroyed when the thread exits. Memory stays
+ * valid until the owner calls nx_scratch_reset, or use nx_arena_mark/nx_arena_rewind for
+ * nested scratch scopes. */
+NXArena *nx_scratch_arena(void) {
+    NXArena *arena;
+
+    pthread_once(&_nx_scratch_once, _nx_scratch_init);
+    arena = (NXArena *) pthread_getspecific(_nx_scratch_key);
+    if (!arena) {
+        arena = nx_arena_create();
+        if (arena && pthread_setspecific(_nx_scratch_key, arena) != 0) {
+            nx_arena_destroy(arena);
+            return NULL;
+        }
     }
+    return arena;
+}
 
-    new_node->data = data;
-    new_node->next = NULL;
+void nx_scratch_reset(void) {
+    NXArena *arena;
 
-    if (list->tail) {
-        list->tail->next = new_node;
-    } else {
-        list->head = new_node;
+    pthread_once(&_nx_scratch_once, _nx_scratch_init);
+    arena = (NXArena *) pthread_getspecific(_nx_scratch_key);
+    if (arena) {
+        nx_arena_reset(arena);
     }
-
-    list->tail = new_node;
 }
+/* }}} */
 
-void nx_sll_prepend(NXSinglyLinkedList *list, void *data) {
-    NXSLLNode *new_node = (NXSLLNode *) nx_malloc(sizeof(NXSLLNode));
-    if (!new_node) {
-        return;
+/* Pool {{{ */
+/* The slab header takes up one cache line so the first block starts on a cache line boundary */
+#define NX_POOL_SLAB_HEADER ((size_t) NX_CACHE_LINE_SIZE)
+
+NXPool *nx_pool_create(size_t block_size, size_t blocks_per_slab) {
+    NXPool *pool = malloc(sizeof(NXPool));
+    if (!pool) {
+        return NULL;
     }
 
-    new_node->data = data;
-    new_node->next = list->head;
+    /* Free blocks store the free list link inside themselves */
+    if (block_size < sizeof(void *)) {
+        block_size = sizeof(void *);
+    }
+    block_size = (block_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+
+    pool->block_size      = block_size;
+    pool->blocks_per_slab = blocks_per_slab ? blocks_per_slab : NX_POOL_BLOCKS_PER_SLAB;
+    pool->free_list       = NULL;
+    pool->first           = NULL;
+    pool->current         = NULL;
+    pool->bump            = 0;
+    pool->concurrent      = false;
+    pool->caches          = NULL;
+
+    return pool;
+}
 
-    list->head = new_node;
+static void _nx_pool_cache_release(void *data);
 
-    if (!list->tail) {
-        list->tail = new_node;
+NXPool *nx_pool_create_concurrent(size_t block_size, size_t blocks_per_slab) {
+    NXPool *pool = nx_pool_create(block_size, blocks_per_slab);
+    if (!pool) {
+        return NULL;
     }
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        free(pool);
+        return NULL;
+    }
+    if (pthread_key_create(&pool->cache_key, _nx_pool_cache_release) != 0) {
+        pthread_mutex_destroy(&pool->lock);
+        free(pool);
+        return NULL;
+    }
+    pool->concurrent = true;
+
+    return pool;
 }
 
-void nx_sll_remove(NXSinglyLinkedList *list, void *data) {
-    NXSLLNode *current  = list->head;
-    NXSLLNode *previous = NULL;
+static void *_nx_pool_alloc_block(NXPool *pool) {
+    void *block;
 
-    while (current) {
-        if (current->data == data) {
-            if (previous) {
-                previous->next = current->next;
-            } else {
-                list->head = current->next;
-            }
+    if (pool->free_list) {
+        block           = pool->free_list;
+        pool->free_list = *(void **) block;
+        return block;
+    }
 
-            if (current == list->tail) {
-                list->tail = previous;
+    /* Hand out never-used blocks of the current slab, moving on to the next slab (kept from
+     * before a reset) or a new one when it runs out */
+    if (!pool->current || pool->bump == pool->blocks_per_slab) {
+        if (pool->current && pool->current->next) {
+            pool->current = pool->current->next;
+        } else {
+            NXPoolSlab *slab;
+            size_t      padding;
+            char       *memory = malloc(NX_CACHE_LINE_SIZE - 1 + NX_POOL_SLAB_HEADER +
+                                        pool->block_size * pool->blocks_per_slab);
+            if (!memory) {
+                return NULL;
             }
-
-            nx_free(current);
-            return;
+            padding      = _nx_align_forward((size_t) memory, NX_CACHE_LINE_SIZE) - (size_t) memory;
+            slab         = (NXPoolSlab *) (void *) (memory + padding);
+            slab->memory = memory;
+            slab->next   = NULL;
+            if (pool->current) {
+                pool->current->next = slab;
+            } else {
+                pool->first = slab;
+            }
+            pool->current = slab;
         }
-
-        previous = current;
-        current  = current->next;
+        pool->bump = 0;
     }
+
+    block = (char *) pool->current + NX_POOL_SLAB_HEADER + pool->bump * pool->block_size;
+    pool->bump++;
+    return block;
 }
 
-NXDoublyLinkedList *nx_dll_create(void) {
-    NXDoublyLinkedList *list = (NXDoublyLinkedList *) nx_malloc(sizeof(NXDoublyLinkedList));
-    if (!list) {
-        return NULL;
+/* Returns the cache of the calling thread, creating and registering it on first use */
+static NXPoolCache *_nx_pool_get_cache(NXPool *pool) {
+    NXPoolCache *cache = (NXPoolCache *) pthread_getspecific(pool->cache_key);
+    if (cache) {
+        return cache;
     }
-    list->head = list->tail = NULL;
-    return list;
-}
 
-void nx_dll_destroy(NXDoublyLinkedList *list) {
-    NXDLLNode *current = list->head;
-    while (current) {
-        NXDLLNode *next = current->next;
-        nx_free(current);
-        current = next;
+    cache = malloc(sizeof(NXPoolCache));
+    if (!cache) {
+        return NULL;
     }
-    nx_free(list);
+    cache->pool   = pool;
+    cache->blocks = NULL;
+    cache->count  = 0;
+    if (pthread_setspecific(pool->cache_key, cache) != 0) {
+        free(cache);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    cache->next  = pool->caches;
+    pool->caches = cache;
+    pthread_mutex_unlock(&pool->lock);
+
+    return cache;
 }
 
-void nx_dll_append(NXDoublyLinkedList *list, void *data) {
-    NXDLLNode *new_node = (NXDLLNode *) nx_malloc(sizeof(NXDLLNode));
-    if (!new_node) {
-        return;
+/* Moves `count` blocks from a cache back to the shared free list, the pool must be locked */
+static void _nx_pool_cache_flush(NXPoolCache *cache, size_t count) {
+    NXPool *pool = cache->pool;
+    while (count > 0 && cache->blocks) {
+        void *block      = cache->blocks;
+        cache->blocks    = *(void **) block;
+        *(void **) block = pool->free_list;
+        pool->free_list  = block;
+        cache->count--;
+        count--;
     }
+}
 
-    new_node->data = data;
-    new_node->next = NULL;
-    new_node->prev = list->tail;
-
-    if (list->tail) {
-        list->tail->next = new_node;
-    } else {
-        list->head = new_node;
+/* Thread exit destructor, hands the cached blocks back to the pool */
+static void _nx_pool_cache_release(void *data) {
+    NXPoolCache  *cache = (NXPoolCache *) data;
+    NXPool       *pool  = cache->pool;
+    NXPoolCache **link;
+
+    pthread_mutex_lock(&pool->lock);
+    _nx_pool_cache_flush(cache, cache->count);
+    for (link = &pool->caches; *link; link = &(*link)->next) {
+        if (*link == cache) {
+            *link = cache->next;
+            break;
+        }
     }
+    pthread_mutex_unlock(&pool->lock);
 
-    list->tail = new_node;
+    free(cache);
 }
 
-void nx_dll_prepend(NXDoublyLinkedList *list, void *data) {
-    NXDLLNode *new_node = (NXDLLNode *) nx_malloc(sizeof(NXDLLNode));
-    if (!new_node)
-        return;
+void *nx_pool_alloc(NXPool *pool) {
+    NXPoolCache *cache;
+    void        *block;
 
-    new_node->data = data;
-    new_node->next = list->head;
-    new_node->prev = NULL;
+    if (!pool->concurrent) {
+        return _nx_pool_alloc_block(pool);
+    }
 
-    if (list->head) {
-        list->head->prev = new_node;
-    } else {
-        list->tail = new_node;
+    cache = _nx_pool_get_cache(pool);
+    if (!cache) {
+        return NULL;
+    }
+
+    /* Refill half the cache in one locked batch */
+    if (!cache->blocks) {
+        pthread_mutex_lock(&pool->lock);
+        while (cache->count < NX_POOL_CACHE_SIZE / 2 + 1) {
+            block = _nx_pool_alloc_block(pool);
+            if (!block) {
+                break;
+            }
+            *(void **) block = cache->blocks;
+            cache->blocks    = block;
+            cache->count++;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        if (!cache->blocks) {
+            return NULL;
+        }
+    }
+
+    block         = cache->blocks;
+    cache->blocks = *(void **) block;
+    cache->count--;
+    return block;
+}
+
+void nx_pool_free(NXPool *pool, void *ptr) {
+    NXPoolCache *cache;
+
+    if (!ptr) {
+        return;
+    }
+
+    if (!pool->concurrent || !(cache = _nx_pool_get_cache(pool))) {
+        if (pool->concurrent) {
+            pthread_mutex_lock(&pool->lock);
+        }
+        *(void **) ptr  = pool->free_list;
+        pool->free_list = ptr;
+        if (pool->concurrent) {
+            pthread_mutex_unlock(&pool->lock);
+        }
+        return;
+    }
+
+    *(void **) ptr = cache->blocks;
+    cache->blocks  = ptr;
+    cache->count++;
+
+    /* Give half of a full cache back so blocks freed by one thread can serve the others */
+    if (cache->count > NX_POOL_CACHE_SIZE) {
+        pthread_mutex_lock(&pool->lock);
+        _nx_pool_cache_flush(cache, NX_POOL_CACHE_SIZE / 2);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* For concurrent pools no other thread may use the pool during a reset or destroy */
+void nx_pool_reset(NXPool *pool) {
+    NXPoolCache *cache;
+    for (cache = pool->caches; cache; cache = cache->next) {
+        cache->blocks = NULL;
+        cache->count  = 0;
+    }
+    pool->free_list = NULL;
+    pool->current   = pool->first;
+    pool->bump      = 0;
+}
+
+void nx_pool_destroy(NXPool *pool) {
+    NXPoolSlab *slab = pool->first;
+
+    if (pool->concurrent) {
+        NXPoolCache *cache = pool->caches;
+
+        /* Deleting the key first stops the thread exit destructors from running */
+        pthread_key_delete(pool->cache_key);
+        while (cache) {
+            NXPoolCache *next = cache->next;
+            free(cache);
+            cache = next;
+        }
+        pthread_mutex_destroy(&pool->lock);
+    }
+
+    while (slab) {
+        NXPoolSlab *next = slab->next;
+        free(slab->memory);
+        slab = next;
+    }
+    free(pool);
+}
+/* }}} */
+
+/* Node allocation {{{ */
+/* Nodes of the containers come from an arena, a pool or the heap. Arena nodes are never freed
+ * individually, they are released all at once by nx_arena_reset or nx_arena_destroy. */
+static void *_nx_node_alloc(NXArena *arena, NXPool *pool, size_t size) {
+    if (arena) {
+        return nx_arena_alloc(arena, size);
+    }
+    if (pool) {
+        return nx_pool_alloc(pool);
+    }
+    return nx_malloc(size);
+}
+
+static void _nx_node_free(NXArena *arena, NXPool *pool, void *node) {
+    if (arena) {
+        return;
+    }
+    if (pool) {
+        nx_pool_free(pool, node);
+    } else {
+        nx_free(node);
+    }
+}
+/* }}} */
+
+/* Linked Lists {{{ */
+NXSinglyLinkedList *nx_sll_create(void) {
+    return nx_sll_create_ex(NULL, NULL);
+}
+
+NXSinglyLinkedList *nx_sll_create_ex(NXArena *arena, NXPool *pool) {
+    NXSinglyLinkedList *list;
+
+    if (pool && pool->block_size < sizeof(NXSLLNode)) {
+        return NULL;
+    }
+
+    list = (NXSinglyLinkedList *) (arena ? nx_arena_alloc(arena, sizeof(NXSinglyLinkedList))
+                                         : nx_malloc(sizeof(NXSinglyLinkedList)));
+    if (!list) {
+        return NULL;
+    }
+    list->head = list->tail = NULL;
+    list->arena             = arena;
+    list->pool              = pool;
+    return list;
+}
+
+void nx_sll_destroy(NXSinglyLinkedList *list) {
+    NXSLLNode *current = list->head;
+
+    /* Everything lives in the arena, nx_arena_reset releases it */
+    if (list->arena) {
+        return;
+    }
+    while (current) {
+        NXSLLNode *next = current->next;
+        _nx_node_free(list->arena, list->pool, current);
+        current = next;
+    }
+    nx_free(list);
+}
+
+NXSLLNode *nx_sll_append(NXSinglyLinkedList *list, void *data) {
+    NXSLLNode *new_node = (NXSLLNode *) _nx_node_alloc(list->arena, list->pool, sizeof(NXSLLNode));
+    if (!new_node) {
+        return NULL;
+    }
+
+    new_node->data = data;
+    new_node->next = NULL;
+
+    if (list->tail) {
+        list->tail->next = new_node;
+    } else {
+        list->head = new_node;
+    }
+
+    list->tail = new_node;
+    return new_node;
+}
+
+NXSLLNode *nx_sll_prepend(NXSinglyLinkedList *list, void *data) {
+    NXSLLNode *new_node = (NXSLLNode *) _nx_node_alloc(list->arena, list->pool, sizeof(NXSLLNode));
+    if (!new_node) {
+        return NULL;
     }
 
+    new_node->data = data;
+    new_node->next = list->head;
+
     list->head = new_node;
+
+    if (!list->tail) {
+        list->tail = new_node;
+    }
+    return new_node;
 }
 
-void nx_dll_remove(NXDoublyLinkedList *list, void *data) {
-    NXDLLNode *current = list->head;
+void nx_sll_remove(NXSinglyLinkedList *list, void *data) {
+    NXSLLNode *current  = list->head;
+    NXSLLNode *previous = NULL;
 
     while (current) {
         if (current->data == data) {
-            if (current->prev) {
-                current->prev->next = current->next;
+            if (previous) {
+                previous->next = current->next;
             } else {
                 list->head = current->next;
             }
 
-            if (current->next) {
-                current->next->prev = current->prev;
-            } else {
-                list->tail = current->prev;
+            if (current == list->tail) {
+                list->tail = previous;
             }
 
-            nx_free(current);
+            _nx_node_free(list->arena, list->pool, current);
+            return;
+        }
+
+        previous = current;
+        current  = current->next;
+    }
+}
+
+void *nx_sll_pop_front(NXSinglyLinkedList *list) {
+    NXSLLNode *node = list->head;
+    void      *data;
+
+    if (!node) {
+        return NULL;
+    }
+
+    data       = node->data;
+    list->head = node->next;
+    if (!list->head) {
+        list->tail = NULL;
+    }
+
+    _nx_node_free(list->arena, list->pool, node);
+    return data;
+}
+
+NXDoublyLinkedList *nx_dll_create(void) {
+    return nx_dll_create_ex(NULL, NULL);
+}
+
+NXDoublyLinkedList *nx_dll_create_ex(NXArena *arena, NXPool *pool) {
+    NXDoublyLinkedList *list;
+
+    if (pool && pool->block_size < sizeof(NXDLLNode)) {
+        return NULL;
+    }
+
+    list = (NXDoublyLinkedList *) (arena ? nx_arena_alloc(arena, sizeof(NXDoublyLinkedList))
+                                         : nx_malloc(sizeof(NXDoublyLinkedList)));
+    if (!list) {
+        return NULL;
+    }
+    list->head = list->tail = NULL;
+    list->arena             = arena;
+    list->pool              = pool;
+    return list;
+}
+
+void nx_dll_destroy(NXDoublyLinkedList *list) {
+    NXDLLNode *current = list->head;
+
+    /* Everything lives in the arena, nx_arena_reset releases it */
+    if (list->arena) {
+        return;
+    }
+    while (current) {
+        NXDLLNode *next = current->next;
+        _nx_node_free(list->arena, list->pool, current);
+        current = next;
+    }
+    nx_free(list);
+}
+
+/* Links an already allocated node in front of the head */
+static void _nx_dll_link_front(NXDoublyLinkedList *list, NXDLLNode *node) {
+    node->next = list->head;
+    node->prev = NULL;
+
+    if (list->head) {
+        list->head->prev = node;
+    } else {
+        list->tail = node;
+    }
+
+    list->head = node;
+}
+
+static void _nx_dll_unlink(NXDoublyLinkedList *list, NXDLLNode *node) {
+    if (node->prev) {
+        node->prev->next = node->next;
+    } else {
+        list->head = node->next;
+    }
+
+    if (node->next) {
+        node->next->prev = node->prev;
+    } else {
+        list->tail = node->prev;
+    }
+}
+
+NXDLLNode *nx_dll_append(NXDoublyLinkedList *list, void *data) {
+    NXDLLNode *new_node = (NXDLLNode *) _nx_node_alloc(list->arena, list->pool, sizeof(NXDLLNode));
+    if (!new_node) {
+        return NULL;
+    }
+
+    new_node->data = data;
+    new_node->next = NULL;
+    new_node->prev = list->tail;
+
+    if (list->tail) {
+        list->tail->next = new_node;
+    } else {
+        list->head = new_node;
+    }
+
+    list->tail = new_node;
+    return new_node;
+}
+
+NXDLLNode *nx_dll_prepend(NXDoublyLinkedList *list, void *data) {
+    NXDLLNode *new_node = (NXDLLNode *) _nx_node_alloc(list->arena, list->pool, sizeof(NXDLLNode));
+    if (!new_node) {
+        return NULL;
+    }
+
+    new_node->data = data;
+    _nx_dll_link_front(list, new_node);
+    return new_node;
+}
+
+void nx_dll_remove(NXDoublyLinkedList *list, void *data) {
+    NXDLLNode *current = list->head;
+
+    while (current) {
+        if (current->data == data) {
+            nx_dll_remove_node(list, current);
             return;
         }
 
         current = current->next;
     }
 }
+
+void nx_dll_remove_node(NXDoublyLinkedList *list, NXDLLNode *node) {
+    _nx_dll_unlink(list, node);
+    _nx_node_free(list->arena, list->pool, node);
+}
+
+void nx_dll_move_to_front(NXDoublyLinkedList *list, NXDLLNode *node) {
+    if (list->head == node) {
+        return;
+    }
+    _nx_dll_unlink(list, node);
+    _nx_dll_link_front(list, node);
+}
+
+void *nx_dll_pop_front(NXDoublyLinkedList *list) {
+    NXDLLNode *node = list->head;
+    void      *data;
+
+    if (!node) {
+        return NULL;
+    }
+    data = node->data;
+    nx_dll_remove_node(list, node);
+    return data;
+}
+
+void *nx_dll_pop_back(NXDoublyLinkedList *list) {
+    NXDLLNode *node = list->tail;
+    void      *data;
+
+    if (!node) {
+        return NULL;
+    }
+    data = node->data;
+    nx_dll_remove_node(list, node);
+    return data;
+}
 /* }}} */
 
 /* Hashmap {{{ */
+#ifdef NX_STATS
+static void _nx_stats_record_probes(size_t probes) {
+    size_t max = __atomic_load_n(&nx_stats.hashmap_max_probe, __ATOMIC_RELAXED);
+    nx_stats_add(hashmap_lookups, 1);
+    nx_stats_add(hashmap_probes, probes);
+    while (probes > max && !__atomic_compare_exchange_n(&nx_stats.hashmap_max_probe, &max, probes,
+                                                        true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/* Wall time, clock() would add up the CPU time of every busy thread */
+static struct timespec _nx_stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now;
+}
+
+static size_t _nx_stats_usec_since(struct timespec start) {
+    struct timespec now = _nx_stats_now();
+    return (size_t) ((double) (now.tv_sec - start.tv_sec) * 1000000.0 +
+                     (double) (now.tv_nsec - start.tv_nsec) / 1000.0);
+}
+#define NX_STATS_RECORD_PROBES(probes) _nx_stats_record_probes(probes)
+#else
+#define NX_STATS_RECORD_PROBES(probes) (void) 0
+#endif /* NX_STATS */
+
+size_t nx_hash_bytes(const void *data, size_t len) {
+    const unsigned char *bytes = (const unsigned char *) data;
+    size_t               hash  = (size_t) NX_HASH_K1 ^ len;
+    size_t               word;
+
+    while (len >= sizeof(size_t)) {
+        memcpy(&word, bytes, sizeof(size_t));
+        hash = _nx_hash_mix(hash, word);
+        bytes += sizeof(size_t);
+        len -= sizeof(size_t);
+    }
+    if (len > 0) {
+        word = 0;
+        memcpy(&word, bytes, len);
+        hash = _nx_hash_mix(hash, word);
+    }
+
+    /* Final avalanche so the low bits used for bucket selection depend on every input byte */
+    hash *= (size_t) NX_HASH_K1;
+    return hash ^ (hash >> (NX_HASH_HALF_BITS - 3));
+}
+
+static size_t _nx_next_pow2(size_t n) {
+    size_t result = 1;
+    while (result < n) {
+        result <<= 1;
+    }
+    return result;
+}
+
+/* Bucket arrays follow the node allocator, arena buckets are abandoned on resize and released
+ * together with the arena */
+static NXHashMapEntry **_nx_hashmap_alloc_buckets(NXHashMap *map, size_t capacity) {
+    NXHashMapEntry **buckets;
+
+    if (!map->arena) {
+        return (NXHashMapEntry **) nx_calloc(capacity, sizeof(NXHashMapEntry *));
+    }
+    buckets = (NXHashMapEntry **) nx_arena_alloc(map->arena, capacity * sizeof(NXHashMapEntry *));
+    if (buckets) {
+        memset(buckets, 0, capacity * sizeof(NXHashMapEntry *));
+    }
+    return buckets;
+}
+
+static void _nx_hashmap_free_buckets(NXHashMap *map, NXHashMapEntry **buckets) {
+    if (!map->arena) {
+        nx_free(buckets);
+    }
+}
+
+static void _nx_hashmap_move_bucket(NXHashMap *map, NXHashMapEntry *entry) {
+    while (entry) {
+        NXHashMapEntry *next      = entry->next;
+        size_t          new_index = entry->hash & (map->capacity - 1);
+        entry->next               = map->buckets[new_index];
+        map->buckets[new_index]   = entry;
+        entry                     = next;
+    }
+}
+
+/* Migrates up to `steps` non-empty buckets from the old table to the new one, visiting at most
+ * ten empty buckets per step so a single call stays bounded on sparse tables. */
+static void _nx_hashmap_rehash_step(NXHashMap *map, size_t steps) {
+    size_t empty_visits = steps * 10;
+
+    while (steps > 0 && map->old_buckets) {
+        NXHashMapEntry *entry = map->old_buckets[map->rehash_index];
+
+        map->old_buckets[map->rehash_index] = NULL;
+        map->rehash_index++;
+        if (entry) {
+            _nx_hashmap_move_bucket(map, entry);
+            steps--;
+        } else if (--empty_visits == 0) {
+            steps = 0;
+        }
+
+        if (map->rehash_index == map->old_capacity) {
+            _nx_hashmap_free_buckets(map, map->old_buckets);
+            map->old_buckets  = NULL;
+            map->old_capacity = 0;
+            map->rehash_index = 0;
+        }
+    }
+}
+
 static void _nx_hashmap_resize(NXHashMap *map) {
     size_t           i;
     size_t           old_capacity = map->capacity;
     NXHashMapEntry **old_buckets  = map->buckets;
+    NXHashMapEntry **new_buckets;
+#ifdef NX_STATS
+    struct timespec started = _nx_stats_now();
+#endif
 
+    new_buckets = _nx_hashmap_alloc_buckets(map, old_capacity * 2);
+    if (!new_buckets) {
+        return;
+    }
     map->capacity *= 2;
-    map->buckets = (NXHashMapEntry **) nx_calloc(map->capacity, sizeof(NXHashMapEntry *));
+    map->buckets = new_buckets;
+    nx_stats_add(hashmap_resizes, 1);
+
+    /* Incremental resizes only account for the allocation here, the migration is spread out */
+    if (map->incremental) {
+        map->old_buckets  = old_buckets;
+        map->old_capacity = old_capacity;
+        map->rehash_index = 0;
+        nx_stats_add(hashmap_resize_usec, _nx_stats_usec_since(started));
+        return;
+    }
 
     for (i = 0; i < old_capacity; i++) {
-        NXHashMapEntry *entry = old_buckets[i];
-        while (entry) {
-            NXHashMapEntry *next      = entry->next;
-            size_t          new_index = map->hash_func(entry->key) % map->capacity;
-            entry->next               = map->buckets[new_index];
-            map->buckets[new_index]   = entry;
-            entry                     = next;
-        }
+        _nx_hashmap_move_bucket(map, old_buckets[i]);
     }
 
-    nx_free(old_buckets);
+    _nx_hashmap_free_buckets(map, old_buckets);
+    nx_stats_add(hashmap_resize_usec, _nx_stats_usec_since(started));
 }
 
-static size_t _nx_default_hash(void *key) {
-    const char *str  = (const char *) key;
+/* Returns the link pointing at the entry for key, or NULL if the key is not present */
+static NXHashMapEntry **_nx_hashmap_find_link(NXHashMap *map, void *key, size_t hash) {
+    NXHashMapEntry **link   = &map->buckets[hash & (map->capacity - 1)];
+    size_t           probes = 0;
+
+    /* The cached hash rejects most chain entries without calling key_equal */
+    while (*link) {
+        probes++;
+        if ((*link)->hash == hash && map->key_equal((*link)->key, key)) {
+            NX_STATS_RECORD_PROBES(probes);
+            return link;
+        }
+        link = &(*link)->next;
+    }
+
+    if (map->old_buckets) {
+        link = &map->old_buckets[hash & (map->old_capacity - 1)];
+        while (*link) {
+            probes++;
+            if ((*link)->hash == hash && map->key_equal((*link)->key, key)) {
+                NX_STATS_RECORD_PROBES(probes);
+                return link;
+            }
+            link = &(*link)->next;
+        }
+    }
+    NX_STATS_RECORD_PROBES(probes);
+    (void) probes;
+    return NULL;
+}
+
+static size_t _nx_default_hash(void *key) {
+#ifdef NX_HASHMAP_LEGACY_HASH
+    const char *str  = (const char *) key;
     size_t      hash = 0;
     while (*str) {
         hash = 31 * hash + (unsigned char) (*str++);
     }
     return hash;
+#else
+    return nx_hash_bytes(key, strlen((const char *) key));
+#endif
+}
+
+static bool _nx_default_key_equal(void *key1, void *key2) {
+    return strcmp((const char *) key1, (const char *) key2) == 0;
+}
+
+static bool _nx_hashmap_flat_alloc(NXHashMap *map, size_t capacity) {
+    size_t slots_size = capacity * sizeof(NXHashMapSlot);
+    char  *memory     = (char *) nx_malloc(slots_size + capacity);
+    if (!memory) {
+        return false;
+    }
+
+    map->slots       = (NXHashMapSlot *) (void *) memory;
+    map->ctrl        = (unsigned char *) memory + slots_size;
+    map->capacity    = capacity;
+    map->growth_left = capacity - capacity / 8;
+    memset(map->ctrl, NX_HASHMAP_CTRL_EMPTY, capacity);
+    return true;
+}
+
+/* The group comes from the high bits and h2 from the low ones, so identity hashes of sequential
+ * keys would all land in one group without the mix */
+static size_t _nx_hashmap_flat_hash(const NXHashMap *map, void *key) {
+    return _nx_hash_mix(map->hash_func(key), 0);
+}
+
+static size_t _nx_hashmap_flat_find_free(const NXHashMap *map, size_t hash) {
+    size_t group_mask = map->capacity / NX_HASHMAP_GROUP_WIDTH - 1;
+    size_t group      = (hash >> 7) & group_mask;
+    size_t step       = 0;
+
+    for (;;) {
+        size_t       offset = group * NX_HASHMAP_GROUP_WIDTH;
+        unsigned int free   = _nx_hashmap_group_match_free(map->ctrl + offset);
+        if (free) {
+            return offset + _nx_ctz(free);
+        }
+        step++;
+        group = (group + step) & group_mask;
+    }
+}
+
+static NXHashMapSlot *_nx_hashmap_flat_find(const NXHashMap *map, void *key, size_t hash) {
+    size_t        group_mask = map->capacity / NX_HASHMAP_GROUP_WIDTH - 1;
+    size_t        group      = (hash >> 7) & group_mask;
+    size_t        step       = 0;
+    unsigned char h2         = (unsigned char) (hash & 0x7F);
+
+    for (;;) {
+        size_t       offset  = group * NX_HASHMAP_GROUP_WIDTH;
+        unsigned int matches = _nx_hashmap_group_match(map->ctrl + offset, h2);
+        while (matches) {
+            NXHashMapSlot *slot = &map->slots[offset + _nx_ctz(matches)];
+            if (slot->hash == hash && map->key_equal(slot->key, key)) {
+                NX_STATS_RECORD_PROBES(step + 1);
+                return slot;
+            }
+            matches &= matches - 1;
+        }
+        if (_nx_hashmap_group_match(map->ctrl + offset, NX_HASHMAP_CTRL_EMPTY)) {
+            NX_STATS_RECORD_PROBES(step + 1);
+            return NULL;
+        }
+        step++;
+        group = (group + step) & group_mask;
+    }
+}
+
+/* Rehashes into a new slab using the cached hashes, so no callbacks are called */
+static bool _nx_hashmap_flat_rehash(NXHashMap *map, size_t new_capacity) {
+    size_t         i;
+    size_t         old_capacity = map->capacity;
+    unsigned char *old_ctrl     = map->ctrl;
+    NXHashMapSlot *old_slots    = map->slots;
+#ifdef NX_STATS
+    struct timespec started = _nx_stats_now();
+#endif
+
+    if (!_nx_hashmap_flat_alloc(map, new_capacity)) {
+        return false;
+    }
+
+    for (i = 0; i < old_capacity; i++) {
+        if (!(old_ctrl[i] & 0x80)) {
+            size_t index      = _nx_hashmap_flat_find_free(map, old_slots[i].hash);
+            map->ctrl[index]  = old_ctrl[i];
+            map->slots[index] = old_slots[i];
+            map->growth_left--;
+        }
+    }
+
+    nx_free(old_slots);
+    nx_stats_add(hashmap_resizes, 1);
+    nx_stats_add(hashmap_resize_usec, _nx_stats_usec_since(started));
+    return true;
+}
+
+static bool _nx_hashmap_flat_insert(NXHashMap *map, void *key, void *value) {
+    size_t         hash = _nx_hashmap_flat_hash(map, key);
+    NXHashMapSlot *slot = _nx_hashmap_flat_find(map, key, hash);
+    size_t         index;
+
+    if (slot) {
+        slot->value = value;
+        return true;
+    }
+
+    if (map->growth_left == 0) {
+        /* Grow when mostly full, otherwise only purge the tombstones */
+        size_t new_capacity =
+            map->size * 16 > map->capacity * 7 ? map->capacity * 2 : map->capacity;
+        if (!_nx_hashmap_flat_rehash(map, new_capacity)) {
+            return false;
+        }
+    }
+
+    index = _nx_hashmap_flat_find_free(map, hash);
+    if (map->ctrl[index] == NX_HASHMAP_CTRL_EMPTY) {
+        map->growth_left--;
+    }
+    map->ctrl[index]        = (unsigned char) (hash & 0x7F);
+    map->slots[index].hash  = hash;
+    map->slots[index].key   = key;
+    map->slots[index].value = value;
+    map->size++;
+    return true;
+}
+
+static bool _nx_hashmap_flat_remove(NXHashMap *map, void *key) {
+    NXHashMapSlot *slot = _nx_hashmap_flat_find(map, key, _nx_hashmap_flat_hash(map, key));
+    size_t         index;
+    size_t         group_offset;
+
+    if (!slot) {
+        return false;
+    }
+
+    /* A slot may only become empty again if no probe sequence ever passed its group, which is
+     * guaranteed while the group still contains an empty slot. */
+    index        = (size_t) (slot - map->slots);
+    group_offset = index & ~((size_t) NX_HASHMAP_GROUP_WIDTH - 1);
+    if (_nx_hashmap_group_match(map->ctrl + group_offset, NX_HASHMAP_CTRL_EMPTY)) {
+        map->ctrl[index] = NX_HASHMAP_CTRL_EMPTY;
+        map->growth_left++;
+    } else {
+        map->ctrl[index] = NX_HASHMAP_CTRL_DELETED;
+    }
+    map->size--;
+    return true;
+}
+
+NXHashMap *nx_hashmap_create(size_t (*hash_func)(void *key),
+                             bool (*key_equal)(void *key1, void *key2)) {
+    return nx_hashmap_create_ex(hash_func, key_equal, NULL, NULL);
+}
+
+NXHashMap *nx_hashmap_create_ex(size_t (*hash_func)(void *key),
+                                bool (*key_equal)(void *key1, void *key2), NXArena *arena,
+                                NXPool *pool) {
+    NXHashMap *map;
+
+    if (pool && pool->block_size < sizeof(NXHashMapEntry)) {
+        return NULL;
+    }
+
+    map = (NXHashMap *) (arena ? nx_arena_alloc(arena, sizeof(NXHashMap))
+                               : nx_malloc(sizeof(NXHashMap)));
+    if (!map)
+        return NULL;
+
+    map->capacity     = _nx_next_pow2(NX_HASHMAP_INITIAL_CAPACITY);
+    map->size         = 0;
+    map->hash_func    = hash_func ? hash_func : _nx_default_hash;
+    map->key_equal    = key_equal ? key_equal : _nx_default_key_equal;
+    map->arena        = arena;
+    map->pool         = pool;
+    map->incremental  = false;
+    map->old_buckets  = NULL;
+    map->old_capacity = 0;
+    map->rehash_index = 0;
+    map->ctrl         = NULL;
+    map->slots        = NULL;
+    map->growth_left  = 0;
+    map->buckets      = _nx_hashmap_alloc_buckets(map, map->capacity);
+    if (!map->buckets) {
+        if (!arena) {
+            nx_free(map);
+        }
+        return NULL;
+    }
+    return map;
+}
+
+NXHashMap *nx_hashmap_create_flat(size_t (*hash_func)(void *key),
+                                  bool (*key_equal)(void *key1, void *key2)) {
+    NXHashMap *map = (NXHashMap *) nx_malloc(sizeof(NXHashMap));
+    if (!map)
+        return NULL;
+
+    map->buckets      = NULL;
+    map->size         = 0;
+    map->hash_func    = hash_func ? hash_func : _nx_default_hash;
+    map->key_equal    = key_equal ? key_equal : _nx_default_key_equal;
+    map->arena        = NULL;
+    map->pool         = NULL;
+    map->incremental  = false;
+    map->old_buckets  = NULL;
+    map->old_capacity = 0;
+    map->rehash_index = 0;
+    if (!_nx_hashmap_flat_alloc(map, _nx_next_pow2(nx_max(NX_HASHMAP_INITIAL_CAPACITY,
+                                                          NX_HASHMAP_GROUP_WIDTH)))) {
+        nx_free(map);
+        return NULL;
+    }
+    return map;
+}
+
+void nx_hashmap_destroy(NXHashMap *map) {
+    size_t i;
+    if (map->ctrl) {
+        nx_free(map->slots);
+        nx_free(map);
+        return;
+    }
+    /* Everything lives in the arena, nx_arena_reset releases it */
+    if (map->arena) {
+        return;
+    }
+    /* Finishing a pending resize first means only one table has to be walked */
+    while (map->old_buckets) {
+        _nx_hashmap_rehash_step(map, map->old_capacity);
+    }
+    for (i = 0; i < map->capacity; i++) {
+        NXHashMapEntry *entry = map->buckets[i];
+        while (entry) {
+            NXHashMapEntry *next = entry->next;
+            _nx_node_free(map->arena, map->pool, entry);
+            entry = next;
+        }
+    }
+    nx_free(map->buckets);
+    nx_free(map);
+}
+
+void nx_hashmap_set_incremental(NXHashMap *map, bool incremental) {
+    if (map->ctrl) {
+        return;
+    }
+    map->incremental = incremental;
+    while (!incremental && map->old_buckets) {
+        _nx_hashmap_rehash_step(map, map->old_capacity);
+    }
+}
+
+bool nx_hashmap_insert(NXHashMap *map, void *key, void *value) {
+    size_t           hash;
+    size_t           index;
+    NXHashMapEntry **link;
+    NXHashMapEntry  *new_entry;
+
+    if (map->ctrl) {
+        return _nx_hashmap_flat_insert(map, key, value);
+    }
+
+    if (map->old_buckets) {
+        _nx_hashmap_rehash_step(map, NX_HASHMAP_REHASH_STEPS);
+    }
+
+    hash = map->hash_func(key);
+    link = _nx_hashmap_find_link(map, key, hash);
+    if (link) {
+        (*link)->value = value;
+        return true;
+    }
+
+    /* New entries always go into the new table while a resize is in progress */
+    index     = hash & (map->capacity - 1);
+    new_entry = (NXHashMapEntry *) _nx_node_alloc(map->arena, map->pool, sizeof(NXHashMapEntry));
+    if (!new_entry) {
+        return false;
+    }
+    new_entry->hash     = hash;
+    new_entry->key      = key;
+    new_entry->value    = value;
+    new_entry->next     = map->buckets[index];
+    map->buckets[index] = new_entry;
+
+    map->size++;
+
+    /* Fixing the conversion warning by explicitly casting to float */
+    if (!map->old_buckets && (float) map->size / (float) map->capacity > NX_HASHMAP_LOAD_FACTOR) {
+        _nx_hashmap_resize(map);
+    }
+    return true;
+}
+
+void *nx_hashmap_get(NXHashMap *map, void *key) {
+    NXHashMapEntry **link;
+
+    if (map->ctrl) {
+        NXHashMapSlot *slot = _nx_hashmap_flat_find(map, key, _nx_hashmap_flat_hash(map, key));
+        return slot ? slot->value : NULL;
+    }
+
+    if (map->old_buckets) {
+        _nx_hashmap_rehash_step(map, NX_HASHMAP_REHASH_STEPS);
+    }
+
+    link = _nx_hashmap_find_link(map, key, map->hash_func(key));
+    return link ? (*link)->value : NULL;
+}
+
+bool nx_hashmap_remove(NXHashMap *map, void *key) {
+    NXHashMapEntry **link;
+    NXHashMapEntry  *entry;
+
+    if (map->ctrl) {
+        return _nx_hashmap_flat_remove(map, key);
+    }
+
+    if (map->old_buckets) {
+        _nx_hashmap_rehash_step(map, NX_HASHMAP_REHASH_STEPS);
+    }
+
+    link = _nx_hashmap_find_link(map, key, map->hash_func(key));
+    if (!link) {
+        return false;
+    }
+    entry = *link;
+    *link = entry->next;
+    _nx_node_free(map->arena, map->pool, entry);
+    map->size--;
+    return true;
+}
+/* }}} */
+
+/* String Builder {{{ */
+static void _nx_string_builder_resize(NXStringBuilder *sb, size_t new_capacity) {
+    if (new_capacity <= sb->capacity) {
+        return;
+    }
+    sb->buffer = (char *) nx_realloc(sb->buffer, new_capacity);
+    if (sb->buffer) {
+        nx_stats_add(string_builder_reallocs, 1);
+        nx_stats_add(string_builder_bytes_reserved, new_capacity - sb->capacity);
+        sb->capacity = new_capacity;
+    } else {
+        nx_die("Failed to allocate memory for string builder");
+    }
+}
+
+NXStringBuilder *nx_string_builder_create(void) {
+    NXStringBuilder *sb = (NXStringBuilder *) nx_malloc(sizeof(NXStringBuilder));
+    if (!sb) {
+        return NULL;
+    }
+    sb->capacity = NX_STRING_BUILDER_INITIAL_CAPACITY;
+    sb->length   = 0;
+    sb->buffer   = (char *) nx_malloc(sb->capacity);
+    if (!sb->buffer) {
+        nx_free(sb);
+        return NULL;
+    }
+    nx_stats_add(string_builder_bytes_reserved, sb->capacity);
+    sb->buffer[0] = '\0';
+    return sb;
+}
+
+void nx_string_builder_destroy(NXStringBuilder *sb) {
+    if (sb) {
+        nx_stats_sub(string_builder_bytes_reserved, sb->capacity);
+        nx_free(sb->buffer);
+        nx_free(sb);
+    }
+}
+
+/* Guarantees room for additional characters plus the terminator */
+void nx_string_builder_reserve(NXStringBuilder *sb, size_t additional) {
+    size_t new_capacity;
+    if (sb->length + additional < sb->capacity) {
+        return;
+    }
+    new_capacity = sb->capacity * NX_STRING_BUILDER_GROWTH_FACTOR;
+    while (sb->length + additional >= new_capacity) {
+        new_capacity *= NX_STRING_BUILDER_GROWTH_FACTOR;
+    }
+    _nx_string_builder_resize(sb, new_capacity);
+}
+
+void nx_string_builder_append(NXStringBuilder *sb, const char *str) {
+    nx_string_builder_append_n(sb, str, strlen(str));
+}
+
+void nx_string_builder_append_n(NXStringBuilder *sb, const char *str, size_t len) {
+    nx_string_builder_reserve(sb, len);
+    memcpy(sb->buffer + sb->length, str, len);
+    sb->length += len;
+    sb->buffer[sb->length] = '\0';
+}
+
+void nx_string_builder_append_char(NXStringBuilder *sb, char c) {
+    nx_string_builder_reserve(sb, 1);
+    sb->buffer[sb->length]     = c;
+    sb->buffer[sb->length + 1] = '\0';
+    sb->length++;
+}
+
+void nx_string_builder_appendf(NXStringBuilder *sb, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    nx_string_builder_vappendf(sb, format, args);
+    va_end(args);
+}
+
+/* Formats straight into the spare capacity, a second pass is only needed when it does not fit */
+void nx_string_builder_vappendf(NXStringBuilder *sb, const char *format, va_list args) {
+    va_list copy;
+    size_t  spare = sb->capacity - sb->length;
+    int     written;
+
+    nx_va_copy(copy, args);
+    written = nx_vsnprintf(sb->buffer + sb->length, spare, format, copy);
+    va_end(copy);
+    if (written < 0) {
+        sb->buffer[sb->length] = '\0';
+        return;
+    }
+
+    if ((size_t) written >= spare) {
+        nx_string_builder_reserve(sb, (size_t) written);
+        nx_vsnprintf(sb->buffer + sb->length, sb->capacity - sb->length, format, args);
+    }
+    sb->length += (size_t) written;
+}
+
+const char *nx_string_builder_to_cstring(NXStringBuilder *sb) {
+    return sb->buffer;
+}
+
+/* Hands the buffer to the caller, who releases it with nx_free. The builder is destroyed */
+char *nx_string_builder_detach(NXStringBuilder *sb) {
+    char *buffer = sb->buffer;
+    nx_stats_sub(string_builder_bytes_reserved, sb->capacity);
+    nx_free(sb);
+    return buffer;
+}
+
+void nx_string_builder_clear(NXStringBuilder *sb) {
+    sb->length    = 0;
+    sb->buffer[0] = '\0';
+}
+/* }}} */
+
+/* Thread Pool {{{ */
+typedef struct {
+    void (*func)(size_t begin, size_t end, void *arg);
+    void  *arg;
+    size_t grain;
+} NXParallelFor;
+
+static pthread_key_t  _nx_thread_worker_key;
+static pthread_once_t _nx_thread_worker_once = PTHREAD_ONCE_INIT;
+
+static void _nx_thread_worker_init(void) {
+    pthread_key_create(&_nx_thread_worker_key, NULL);
+}
+
+/* Returns the worker of pool running on the calling thread, NULL on any other thread */
+static NXThreadWorker *_nx_thread_pool_self(NXThreadPool *pool) {
+    NXThreadWorker *worker;
+    pthread_once(&_nx_thread_worker_once, _nx_thread_worker_init);
+    worker = (NXThreadWorker *) pthread_getspecific(_nx_thread_worker_key);
+    return worker && worker->pool == pool ? worker : NULL;
+}
+
+#define NX_TASK_DEQUE_SLOT(deque, index)                                                           \
+    (&(deque)->tasks[(size_t) (index) & (NX_THREAD_POOL_DEQUE_SIZE - 1)])
+
+/* Returns false when the deque is full */
+static bool _nx_task_deque_push(NXTaskDeque *deque, NXTask *task) {
+    long bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long top    = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+
+    if (bottom - top >= NX_THREAD_POOL_DEQUE_SIZE) {
+        return false;
+    }
+    __atomic_store_n(NX_TASK_DEQUE_SLOT(deque, bottom), task, __ATOMIC_RELAXED);
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static NXTask *_nx_task_deque_pop(NXTaskDeque *deque) {
+    long    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    long    top;
+    NXTask *task = NULL;
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (top <= bottom) {
+        task = __atomic_load_n(NX_TASK_DEQUE_SLOT(deque, bottom), __ATOMIC_RELAXED);
+        if (top == bottom) {
+            /* The last task, thieves may be racing for it */
+            if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST,
+                                             __ATOMIC_RELAXED)) {
+                task = NULL;
+            }
+            __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+/* Returns NULL when the deque is empty or another thread won the race */
+static NXTask *_nx_task_deque_steal(NXTaskDeque *deque) {
+    long    top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    long    bottom;
+    NXTask *task;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (top >= bottom) {
+        return NULL;
+    }
+    task = __atomic_load_n(NX_TASK_DEQUE_SLOT(deque, top), __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return task;
+}
+
+/* Own deque first, then the other workers, then the tasks submitted from outside the pool */
+static NXTask *_nx_thread_pool_take(NXThreadPool *pool, NXThreadWorker *self) {
+    NXTask *task  = self ? _nx_task_deque_pop(&self->deque) : NULL;
+    size_t  start = 0;
+    size_t  i;
+
+    if (!task && self) {
+        /* xorshift, so thieves don't all go for the same victim */
+        self->seed ^= self->seed << 13;
+        self->seed ^= self->seed >> 17;
+        self->seed ^= self->seed << 5;
+        start = self->seed % pool->worker_count;
+    }
+    for (i = 0; i < pool->worker_count && !task; i++) {
+        NXThreadWorker *victim = &pool->workers[(start + i) % pool->worker_count];
+        if (victim != self) {
+            task = _nx_task_deque_steal(&victim->deque);
+        }
+    }
+    if (!task && nx_atomic_load(&pool->injected_count) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        task = pool->injected;
+        if (task) {
+            pool->injected = task->next;
+            nx_atomic_fetch_sub(&pool->injected_count, 1);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    if (task) {
+        nx_atomic_fetch_sub(&pool->queued, 1);
+    }
+    return task;
+}
+
+/* Pairs with the fence in nx_task_group_wait, either the waiter sees the change or we see that
+ * it's sleeping */
+static void _nx_thread_pool_notify_waiters(NXThreadPool *pool) {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->waiting, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static void _nx_thread_pool_push(NXThreadPool *pool, NXTaskGroup *group, NXTaskFunc func,
+                                 void *arg, size_t begin, size_t end);
+
+static void _nx_thread_pool_run(NXThreadPool *pool, NXTask *task) {
+    NXTaskGroup *group = task->group;
+
+    if (task->func) {
+        task->func(task->arg);
+    } else {
+        /* Hand the upper halves to thieves and keep splitting the lower one */
+        const NXParallelFor *loop  = (const NXParallelFor *) task->arg;
+        size_t               begin = task->begin;
+        size_t               end   = task->end;
+        while (end - begin > loop->grain) {
+            size_t middle = begin + (end - begin) / 2;
+            _nx_thread_pool_push(pool, group, NULL, task->arg, middle, end);
+            end = middle;
+        }
+        loop->func(begin, end, loop->arg);
+    }
+
+    nx_pool_free(pool->tasks, task);
+    if (group && nx_atomic_fetch_sub(&group->pending, 1) == 1) {
+        _nx_thread_pool_notify_waiters(pool);
+    }
+}
+
+static void _nx_thread_pool_push(NXThreadPool *pool, NXTaskGroup *group, NXTaskFunc func,
+                                 void *arg, size_t begin, size_t end) {
+    NXThreadWorker *self = _nx_thread_pool_self(pool);
+    NXTask         *task = (NXTask *) nx_pool_alloc(pool->tasks);
+
+    if (!task) {
+        nx_die("Failed to allocate memory for task");
+    }
+    task->func  = func;
+    task->arg   = arg;
+    task->group = group;
+    task->begin = begin;
+    task->end   = end;
+    task->next  = NULL;
+    if (group) {
+        nx_atomic_fetch_add(&group->pending, 1);
+    }
+
+    if (self) {
+        /* A full deque means there is plenty of work queued already, so just run it */
+        nx_atomic_fetch_add(&pool->queued, 1);
+        if (!_nx_task_deque_push(&self->deque, task)) {
+            nx_atomic_fetch_sub(&pool->queued, 1);
+            _nx_thread_pool_run(pool, task);
+            return;
+        }
+    } else {
+        pthread_mutex_lock(&pool->lock);
+        if (pool->injected) {
+            pool->injected_tail->next = task;
+        } else {
+            pool->injected = task;
+        }
+        pool->injected_tail = task;
+        nx_atomic_fetch_add(&pool->injected_count, 1);
+        nx_atomic_fetch_add(&pool->queued, 1);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    /* Pairs with the fence in _nx_thread_pool_worker, either the worker sees the task or we see
+     * that it's sleeping */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&pool->sleeping, __ATOMIC_RELAXED) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->wake);
+        pthread_mutex_unlock(&pool->lock);
+    }
+    _nx_thread_pool_notify_waiters(pool);
+}
+
+/* The scratch arena of a worker is reset after every task it picks up here, tasks that need
+ * scratch memory across a nested wait have to mark and rewind it themselves */
+static void *_nx_thread_pool_worker(void *arg) {
+    NXThreadWorker *self = (NXThreadWorker *) arg;
+    NXThreadPool   *pool = self->pool;
+
+    pthread_once(&_nx_thread_worker_once, _nx_thread_worker_init);
+    pthread_setspecific(_nx_thread_worker_key, self);
+
+    for (;;) {
+        NXTask *task = _nx_thread_pool_take(pool, self);
+        if (task) {
+            _nx_thread_pool_run(pool, task);
+            nx_scratch_reset();
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        nx_atomic_fetch_add(&pool->sleeping, 1);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (!pool->stop && nx_atomic_load(&pool->queued) == 0) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        nx_atomic_fetch_sub(&pool->sleeping, 1);
+        if (pool->stop && nx_atomic_load(&pool->queued) == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+    return NULL;
+}
+
+size_t nx_cpu_count(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (size_t) cpus : 1;
+}
+
+/* Stops and joins the first count workers, then frees the pool */
+static void _nx_thread_pool_stop(NXThreadPool *pool, size_t count) {
+    size_t i;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (i = 0; i < pool->worker_count; i++) {
+        nx_free(pool->workers[i].deque.tasks);
+    }
+    pthread_cond_destroy(&pool->wake);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+    nx_pool_destroy(pool->tasks);
+    nx_free(pool->workers);
+    nx_free(pool);
+}
+
+/* Starts worker_count workers, or one per CPU when it is 0. Returns NULL on failure */
+NXThreadPool *nx_thread_pool_create(size_t worker_count) {
+    NXThreadPool *pool = (NXThreadPool *) nx_malloc(sizeof(NXThreadPool));
+    size_t        i;
+
+    if (!pool) {
+        return NULL;
+    }
+    memset(pool, 0, sizeof(NXThreadPool));
+    if (worker_count == 0) {
+        worker_count = nx_cpu_count();
+    }
+
+    pool->workers = (NXThreadWorker *) nx_calloc(worker_count, sizeof(NXThreadWorker));
+    pool->tasks   = nx_pool_create_concurrent(sizeof(NXTask), 0);
+    if (!pool->workers || !pool->tasks || pthread_mutex_init(&pool->lock, NULL) != 0) {
+        if (pool->tasks) {
+            nx_pool_destroy(pool->tasks);
+        }
+        nx_free(pool->workers);
+        nx_free(pool);
+        return NULL;
+    }
+    pthread_cond_init(&pool->wake, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    /* Workers steal from each other right away, so every deque exists before the first starts */
+    pool->worker_count = worker_count;
+    for (i = 0; i < worker_count; i++) {
+        NXThreadWorker *worker = &pool->workers[i];
+        worker->pool           = pool;
+        worker->seed           = (unsigned int) i * 2654435761u + 1;
+        worker->deque.tasks = (NXTask **) nx_malloc(NX_THREAD_POOL_DEQUE_SIZE * sizeof(NXTask *));
+        if (!worker->deque.tasks) {
+            _nx_thread_pool_stop(pool, 0);
+            return NULL;
+        }
+    }
+    for (i = 0; i < worker_count; i++) {
+        if (pthread_create(&pool->workers[i].thread, NULL, _nx_thread_pool_worker,
+                           &pool->workers[i]) != 0) {
+            _nx_thread_pool_stop(pool, i);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+/* Runs whatever is still queued, then stops and joins the workers */
+void nx_thread_pool_destroy(NXThreadPool *pool) {
+    if (pool) {
+        _nx_thread_pool_stop(pool, pool->worker_count);
+    }
+}
+
+/* group may be NULL for tasks nobody waits on */
+void nx_thread_pool_submit(NXThreadPool *pool, NXTaskGroup *group, NXTaskFunc func, void *arg) {
+    _nx_thread_pool_push(pool, group, func, arg, 0, 0);
+}
+
+/* Runs queued tasks, of any group, until every task of the group has finished. Sleeps while the
+ * remaining tasks are running elsewhere */
+void nx_task_group_wait(NXThreadPool *pool, NXTaskGroup *group) {
+    NXThreadWorker *self = _nx_thread_pool_self(pool);
+
+    while (nx_atomic_load(&group->pending) > 0) {
+        NXTask *task = _nx_thread_pool_take(pool, self);
+        if (task) {
+            _nx_thread_pool_run(pool, task);
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        nx_atomic_fetch_add(&pool->waiting, 1);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (nx_atomic_load(&group->pending) > 0 && nx_atomic_load(&pool->queued) == 0) {
+            pthread_cond_wait(&pool->done, &pool->lock);
+        }
+        nx_atomic_fetch_sub(&pool->waiting, 1);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/* Calls func on disjoint subranges of [begin, end) of at most grain indices and returns once all
+ * of them are done. Ranges are split in halves on demand, so idle workers steal big chunks */
+void nx_parallel_for(NXThreadPool *pool, size_t begin, size_t end, size_t grain,
+                     void (*func)(size_t begin, size_t end, void *arg), void *arg) {
+    NXParallelFor loop;
+    NXTaskGroup   group;
+
+    if (begin >= end) {
+        return;
+    }
+    loop.func     = func;
+    loop.arg      = arg;
+    loop.grain    = grain ? grain : 1;
+    group.pending = 0;
+    _nx_thread_pool_push(pool, &group, NULL, &loop, begin, end);
+    nx_task_group_wait(pool, &group);
+}
+/* }}} */
+
+/* Command Runner {{{ */
+NXCR *nx_cr_create(void) {
+    NXCR *cr = (NXCR *) nx_malloc(sizeof(NXCR));
+    if (!cr) {
+        return NULL;
+    }
+
+    cr->command = nx_string_builder_create();
+    if (!cr->command) {
+        nx_free(cr);
+        return NULL;
+    }
+
+    cr->output         = NULL;
+    cr->exit_code      = 0;
+    cr->capture_output = 1;
+    cr->argv           = NULL;
+    cr->argc           = 0;
+    cr->argv_capacity  = 0;
+    return cr;
+}
+
+static void _nx_cr_clear_args(NXCR *cr) {
+    size_t i;
+    for (i = 0; i < cr->argc; i++) {
+        nx_free(cr->argv[i]);
+    }
+    cr->argc = 0;
+    if (cr->argv) {
+        cr->argv[0] = NULL;
+    }
+}
+
+void nx_cr_destroy(NXCR *cr) {
+    if (cr) {
+        _nx_cr_clear_args(cr);
+        nx_free(cr->argv);
+        nx_string_builder_destroy(cr->command);
+        nx_free(cr->output);
+        nx_free(cr);
+    }
+}
+
+void nx_cr_append(NXCR *cr, const char *str) {
+    nx_string_builder_append(cr->command, str);
+    nx_string_builder_append(cr->command, " ");
+}
+
+static void _nx_cr_arg_n(NXCR *cr, const char *arg, size_t len) {
+    char *copy;
+
+    /* One extra slot keeps argv NULL terminated for posix_spawn */
+    if (cr->argc + 2 > cr->argv_capacity) {
+        size_t capacity = cr->argv_capacity ? cr->argv_capacity * 2 : 16;
+        char **argv     = (char **) nx_realloc(cr->argv, capacity * sizeof(char *));
+        if (!argv) {
+            nx_die("Failed to allocate memory for command arguments");
+        }
+        cr->argv          = argv;
+        cr->argv_capacity = capacity;
+    }
+
+    copy = (char *) nx_malloc(len + 1);
+    if (!copy) {
+        nx_die("Failed to allocate memory for command arguments");
+    }
+    memcpy(copy, arg, len);
+    copy[len]            = '\0';
+    cr->argv[cr->argc++] = copy;
+    cr->argv[cr->argc]   = NULL;
+
+    /* Only kept so the command can still be printed */
+    nx_string_builder_append_n(cr->command, arg, len);
+    nx_string_builder_append_char(cr->command, ' ');
+}
+
+/* Adds one argument verbatim, no shell quoting or splitting applies */
+void nx_cr_arg(NXCR *cr, const char *arg) {
+    _nx_cr_arg_n(cr, arg, strlen(arg));
+}
+
+/* Adds every space separated word of args as its own argument */
+void nx_cr_arg_split(NXCR *cr, const char *args) {
+    while (*args) {
+        const char *end;
+        while (*args == ' ') {
+            args++;
+        }
+        end = args;
+        while (*end && *end != ' ') {
+            end++;
+        }
+        if (end > args) {
+            _nx_cr_arg_n(cr, args, (size_t) (end - args));
+        }
+        args = end;
+    }
+}
+
+extern char **environ;
+
+/* Spawns the command without copying the parent, through /bin/sh only for nx_cr_append commands.
+ * When capturing, stdout and stderr go to a pipe returned in output_fd, otherwise it is -1 */
+static pid_t _nx_cr_spawn(NXCR *cr, bool capture, int *output_fd) {
+    posix_spawn_file_actions_t actions;
+    int                        pipefd[2];
+    pid_t                      pid;
+    int                        error;
+    char                      *shell_argv[4];
+
+    *output_fd = -1;
+    posix_spawn_file_actions_init(&actions);
+    if (capture) {
+        if (pipe(pipefd) == -1) {
+            perror("pipe");
+            posix_spawn_file_actions_destroy(&actions);
+            return -1;
+        }
+        /* Close-on-exec so jobs spawned in parallel never hold each other's pipes open, dup2
+         * clears the flag on the child's copies */
+        fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+        fcntl(pipefd[1], F_SETFD, FD_CLOEXEC);
+        posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, pipefd[1], STDERR_FILENO);
+    }
+
+    if (cr->argc > 0) {
+        error = posix_spawnp(&pid, cr->argv[0], &actions, NULL, cr->argv, environ);
+    } else {
+        shell_argv[0] = (char *) (size_t) "sh";
+        shell_argv[1] = (char *) (size_t) "-c";
+        shell_argv[2] = cr->command->buffer;
+        shell_argv[3] = NULL;
+        error         = posix_spawn(&pid, "/bin/sh", &actions, NULL, shell_argv, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (capture) {
+        close(pipefd[1]);
+    }
+    if (error != 0) {
+        fprintf(stderr, "posix_spawn %s: %s\n", cr->argc > 0 ? cr->argv[0] : "/bin/sh",
+                strerror(error));
+        if (capture) {
+            close(pipefd[0]);
+        }
+        return -1;
+    }
+
+    if (capture) {
+        *output_fd = pipefd[0];
+    }
+    return pid;
+}
+
+static int _nx_cr_wait(pid_t pid) {
+    int status;
+    if (waitpid(pid, &status, 0) == -1) {
+        return -1;
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+int nx_cr_execute(NXCR *cr) {
+    int              fd;
+    pid_t            pid;
+    char             buffer[4096];
+    ssize_t          bytes_read;
+    NXStringBuilder *output_sb;
+
+    nx_free(cr->output);
+    cr->output = NULL;
+
+    pid = _nx_cr_spawn(cr, cr->capture_output != 0, &fd);
+    if (pid == -1) {
+        cr->exit_code = -1;
+        _nx_cr_clear_args(cr);
+        nx_string_builder_clear(cr->command);
+        return -1;
+    }
+    if (fd == -1) {
+        cr->exit_code = _nx_cr_wait(pid);
+        _nx_cr_clear_args(cr);
+        nx_string_builder_clear(cr->command);
+        return cr->exit_code;
+    }
+    output_sb = nx_string_builder_create();
+
+    while ((bytes_read = read(fd, buffer, sizeof(buffer))) > 0) {
+        fwrite(buffer, 1, (size_t) bytes_read, stdout);
+        fflush(stdout);
+        nx_string_builder_append_n(output_sb, buffer, (size_t) bytes_read);
+    }
+
+    close(fd);
+
+    if (output_sb->length > 0) {
+        cr->output = nx_string_builder_detach(output_sb);
+    } else {
+        nx_string_builder_destroy(output_sb);
+    }
+
+    cr->exit_code = _nx_cr_wait(pid);
+    _nx_cr_clear_args(cr);
+    nx_string_builder_clear(cr->command);
+
+    return cr->exit_code;
+}
+
+const char *nx_cr_get_output(NXCR *cr) {
+    return cr->output ? cr->output : "";
+}
+
+int nx_cr_get_exit_code(NXCR *cr) {
+    return cr->exit_code;
+}
+
+int nx_cr_run(const char *command) {
+    NXCR *cr;
+    int   result;
+
+    cr = nx_cr_create();
+    if (!cr) {
+        fprintf(stderr, "Failed to create NXCR instance.\n");
+        return EXIT_FAILURE;
+    }
+
+    nx_string_builder_append(cr->command, command);
+    result = nx_cr_execute(cr);
+    nx_cr_destroy(cr);
+    return result;
+}
+
+/* max_parallel of 0 uses one job per online CPU */
+NXCRPool *nx_cr_pool_create(size_t max_parallel) {
+    NXCRPool *pool = (NXCRPool *) nx_malloc(sizeof(NXCRPool));
+    if (!pool) {
+        return NULL;
+    }
+    if (max_parallel == 0) {
+        max_parallel = nx_cpu_count();
+    }
+    pool->jobs         = NULL;
+    pool->count        = 0;
+    pool->capacity     = 0;
+    pool->max_parallel = max_parallel;
+    return pool;
+}
+
+void nx_cr_pool_destroy(NXCRPool *pool) {
+    size_t i;
+    if (pool) {
+        for (i = 0; i < pool->count; i++) {
+            nx_cr_destroy(pool->jobs[i].cr);
+            nx_free(pool->jobs[i].deps);
+        }
+        nx_free(pool->jobs);
+        nx_free(pool);
+    }
+}
+
+/* The pool takes ownership of cr, the returned index identifies the job */
+size_t nx_cr_pool_submit(NXCRPool *pool, NXCR *cr, const char *description) {
+    NXCRJob *job;
+
+    if (pool->count == pool->capacity) {
+        size_t   capacity = pool->capacity ? pool->capacity * 2 : 8;
+        NXCRJob *jobs     = (NXCRJob *) nx_realloc(pool->jobs, capacity * sizeof(NXCRJob));
+        if (!jobs) {
+            nx_die("Failed to allocate memory for command pool");
+        }
+        pool->jobs     = jobs;
+        pool->capacity = capacity;
+    }
+
+    job              = &pool->jobs[pool->count];
+    job->cr          = cr;
+    job->description = description;
+    job->state       = NX_CR_JOB_PENDING;
+    job->pid         = -1;
+    job->fd          = -1;
+    job->output      = NULL;
+    job->deps        = NULL;
+    job->dep_count   = 0;
+    job->cached      = false;
+    return pool->count++;
+}
+
+/* job only starts once dependency has finished with exit code 0 */
+bool nx_cr_pool_depend(NXCRPool *pool, size_t job, size_t dependency) {
+    NXCRJob *target;
+    size_t  *deps;
+
+    if (job >= pool->count || dependency >= pool->count || job == dependency) {
+        return false;
+    }
+    target = &pool->jobs[job];
+    deps   = (size_t *) nx_realloc(target->deps, (target->dep_count + 1) * sizeof(size_t));
+    if (!deps) {
+        return false;
+    }
+    deps[target->dep_count++] = dependency;
+    target->deps              = deps;
+    return true;
+}
+
+NXCR *nx_cr_pool_get(NXCRPool *pool, size_t job) {
+    return job < pool->count ? pool->jobs[job].cr : NULL;
+}
+
+/* Returns NX_CR_JOB_DONE when every dependency succeeded, NX_CR_JOB_SKIPPED when one did not and
+ * NX_CR_JOB_PENDING while any is still outstanding */
+static NXCRJobState _nx_cr_pool_deps_state(NXCRPool *pool, NXCRJob *job) {
+    NXCRJobState state = NX_CR_JOB_DONE;
+    size_t       i;
+
+    for (i = 0; i < job->dep_count; i++) {
+        NXCRJob *dep = &pool->jobs[job->deps[i]];
+        if (dep->state == NX_CR_JOB_SKIPPED ||
+            (dep->state == NX_CR_JOB_DONE && dep->cr->exit_code != 0)) {
+            return NX_CR_JOB_SKIPPED;
+        }
+        if (dep->state != NX_CR_JOB_DONE) {
+            state = NX_CR_JOB_PENDING;
+        }
+    }
+    return state;
+}
+
+static void _nx_cr_pool_finish(NXCRJob *job) {
+    close(job->fd);
+    job->fd            = -1;
+    job->cr->exit_code = _nx_cr_wait(job->pid);
+    job->state         = NX_CR_JOB_DONE;
+
+    /* Output is printed per job so parallel commands never interleave */
+    nx_free(job->cr->output);
+    job->cr->output = NULL;
+    if (job->output->length > 0) {
+        fwrite(job->output->buffer, 1, job->output->length, stdout);
+        job->cr->output = nx_string_builder_detach(job->output);
+    } else {
+        nx_string_builder_destroy(job->output);
+    }
+    job->output = NULL;
+
+    if (job->description) {
+        if (job->cr->exit_code != 0) {
+            printf("%sCompilation of %s failed.%s\n", COLOR_RED, job->description, COLOR_RESET);
+        } else {
+            printf("%sCompilation of %s succeeded.%s\n", COLOR_GREEN, job->description,
+                   COLOR_RESET);
+        }
+    }
+    fflush(stdout);
+}
+
+/* Runs every pending job, at most max_parallel at once, multiplexing their output with poll.
+ * Cached jobs are checked against NX_BUILD_CACHE once their dependencies finished, so a target
+ * whose inputs were just rebuilt with the same content is still skipped.
+ * Returns 0 when all jobs succeeded, otherwise the first non-zero exit code */
+int nx_cr_pool_run(NXCRPool *pool) {
+    struct pollfd *fds;
+    size_t        *running;
+    size_t         running_count = 0;
+    size_t         i;
+    int            result = 0;
+    NXBuildCache  *cache  = NULL;
+    char           buffer[65536];
+
+    fds     = (struct pollfd *) nx_malloc(nx_max(pool->max_parallel, (size_t) 1) *
+                                          sizeof(struct pollfd));
+    running = (size_t *) nx_malloc(nx_max(pool->max_parallel, (size_t) 1) * sizeof(size_t));
+    if (!fds || !running) {
+        nx_free(fds);
+        nx_free(running);
+        return -1;
+    }
+
+    for (i = 0; i < pool->count && !cache; i++) {
+        if (pool->jobs[i].cached) {
+            cache = nx_build_cache_load(NX_BUILD_CACHE);
+        }
+    }
+
+    for (;;) {
+        /* Start everything that is ready, skip jobs whose dependencies failed */
+        bool progressed = true;
+        while (progressed) {
+            progressed = false;
+            for (i = 0; i < pool->count && running_count < pool->max_parallel; i++) {
+                NXCRJob     *job = &pool->jobs[i];
+                NXCRJobState deps;
+                if (job->state != NX_CR_JOB_PENDING) {
+                    continue;
+                }
+                deps = _nx_cr_pool_deps_state(pool, job);
+                if (deps == NX_CR_JOB_SKIPPED) {
+                    job->state         = NX_CR_JOB_SKIPPED;
+                    job->cr->exit_code = -1;
+                    progressed         = true;
+                } else if (deps == NX_CR_JOB_DONE && job->cached && cache &&
+                           nx_build_cache_fresh(cache, job->cr)) {
+                    job->state         = NX_CR_JOB_DONE;
+                    job->cr->exit_code = 0;
+                    progressed         = true;
+                    if (job->description) {
+                        printf("%s%s is up to date.%s\n", COLOR_GREEN, job->description,
+                               COLOR_RESET);
+                    }
+                } else if (deps == NX_CR_JOB_DONE) {
+                    job->pid = _nx_cr_spawn(job->cr, true, &job->fd);
+                    if (job->pid == -1) {
+                        job->state         = NX_CR_JOB_DONE;
+                        job->cr->exit_code = -1;
+                    } else {
+                        job->state               = NX_CR_JOB_RUNNING;
+                        job->output              = nx_string_builder_create();
+                        running[running_count++] = i;
+                    }
+                    progressed = true;
+                }
+            }
+        }
+
+        if (running_count == 0) {
+            break;
+        }
+
+        for (i = 0; i < running_count; i++) {
+            fds[i].fd      = pool->jobs[running[i]].fd;
+            fds[i].events  = POLLIN;
+            fds[i].revents = 0;
+        }
+        if (poll(fds, (nfds_t) running_count, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            result = -1;
+            break;
+        }
+
+        /* Walk backwards so finished jobs can be swapped out of the running list */
+        for (i = running_count; i-- > 0;) {
+            NXCRJob *job = &pool->jobs[running[i]];
+            ssize_t  bytes_read;
+            if (!fds[i].revents) {
+                continue;
+            }
+            bytes_read = read(job->fd, buffer, sizeof(buffer));
+            if (bytes_read > 0) {
+                nx_string_builder_append_n(job->output, buffer, (size_t) bytes_read);
+            } else if (bytes_read == 0 || errno != EINTR) {
+                _nx_cr_pool_finish(job);
+                running[i] = running[--running_count];
+                if (job->cached && cache && job->cr->exit_code == 0) {
+                    nx_build_cache_record(cache, job->cr);
+                }
+            }
+        }
+    }
+
+    /* Anything still pending is waiting on a cycle */
+    for (i = 0; i < pool->count; i++) {
+        NXCRJob *job = &pool->jobs[i];
+        if (job->state == NX_CR_JOB_PENDING) {
+            job->state         = NX_CR_JOB_SKIPPED;
+            job->cr->exit_code = -1;
+        }
+        if (result == 0 && job->state == NX_CR_JOB_SKIPPED) {
+            result = -1;
+        } else if (result == 0 && job->cr->exit_code != 0) {
+            result = job->cr->exit_code;
+        }
+    }
+
+    if (cache) {
+        nx_build_cache_save(cache);
+        nx_build_cache_destroy(cache);
+    }
+
+    nx_free(fds);
+    nx_free(running);
+    return result;
+}
+/* }}} */
+
+/* Command Runner (Build) {{{ */
+static char *_nx_build_strdup(NXBuildCache *cache, const char *str, size_t length) {
+    char *copy = (char *) nx_arena_alloc(cache->arena, length + 1);
+    if (copy) {
+        memcpy(copy, str, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+static NXBuildRecord *_nx_build_record_get(NXBuildCache *cache, char *target) {
+    NXBuildRecord *record = (NXBuildRecord *) nx_hashmap_get(cache->records, target);
+    if (record) {
+        return record;
+    }
+
+    if (cache->count == cache->capacity) {
+        size_t          capacity = cache->capacity ? cache->capacity * 2 : 16;
+        NXBuildRecord **list;
+        list = (NXBuildRecord **) nx_realloc(cache->list, capacity * sizeof(NXBuildRecord *));
+        if (!list) {
+            return NULL;
+        }
+        cache->list     = list;
+        cache->capacity = capacity;
+    }
+
+    record = (NXBuildRecord *) nx_arena_alloc(cache->arena, sizeof(NXBuildRecord));
+    if (!record) {
+        return NULL;
+    }
+    record->target         = _nx_build_strdup(cache, target, strlen(target));
+    record->command_hash   = 0;
+    record->inputs         = NULL;
+    record->input_count    = 0;
+    record->input_capacity = 0;
+    if (!record->target || !nx_hashmap_insert(cache->records, record->target, record)) {
+        return NULL;
+    }
+    cache->list[cache->count++] = record;
+    return record;
+}
+
+static bool _nx_build_hash_file(const char *path, NXBuildInput *input) {
+    NXFileStat st;
+    NXFileMap *map;
+
+    if (nx_file_stat(path, &st) != 0 || st.type != NX_FILE_TYPE_REGULAR) {
+        return false;
+    }
+    map = nx_file_map(path, NX_FILE_MAP_SEQUENTIAL);
+    if (!map) {
+        return false;
+    }
+    input->hash       = nx_hash_bytes(map->data, map->length);
+    input->size       = st.size;
+    input->mtime_sec  = st.mtime_sec;
+    input->mtime_nsec = st.mtime_nsec;
+    nx_file_unmap(map);
+    return true;
+}
+
+static bool _nx_build_record_push(NXBuildRecord *record, const NXBuildInput *input) {
+    if (record->input_count == record->input_capacity) {
+        size_t        capacity = record->input_capacity ? record->input_capacity * 2 : 8;
+        NXBuildInput *inputs   = (NXBuildInput *) nx_realloc(record->inputs,
+                                                             capacity * sizeof(NXBuildInput));
+        if (!inputs) {
+            return false;
+        }
+        record->inputs         = inputs;
+        record->input_capacity = capacity;
+    }
+    record->inputs[record->input_count++] = *input;
+    return true;
+}
+
+/* Hashes path and adds it to record unless it is already there or can't be read */
+static void _nx_build_record_add(NXBuildCache *cache, NXBuildRecord *record, const char *path) {
+    NXBuildInput input;
+    size_t       i;
+
+    for (i = 0; i < record->input_count; i++) {
+        if (strcmp(record->inputs[i].path, path) == 0) {
+            return;
+        }
+    }
+    if (!_nx_build_hash_file(path, &input)) {
+        return;
+    }
+    input.path = _nx_build_strdup(cache, path, strlen(path));
+    if (input.path) {
+        _nx_build_record_push(record, &input);
+    }
+}
+
+static bool _nx_build_takes_value(const char *arg) {
+    static const char *flags[] = {"-o", "-MF", "-MT", "-MQ", "-I", "-L", "-include", "-isystem",
+                                  "-x"};
+    size_t             i;
+
+    for (i = 0; i < nx_len(flags); i++) {
+        if (strcmp(arg, flags[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns the argument following flag, e.g. the target of -o */
+static char *_nx_build_flag_value(NXCR *cr, const char *flag) {
+    size_t i;
+
+    for (i = 1; i + 1 < cr->argc; i++) {
+        if (strcmp(cr->argv[i], flag) == 0) {
+            return cr->argv[i + 1];
+        }
+    }
+    return NULL;
+}
+
+/* Every argument that is not a flag or the value of one and names a regular file */
+static bool _nx_build_is_input(NXCR *cr, size_t i) {
+    NXFileStat st;
+
+    if (i == 0 || cr->argv[i][0] == '-' || _nx_build_takes_value(cr->argv[i - 1])) {
+        return false;
+    }
+    return nx_file_stat(cr->argv[i], &st) == 0 && st.type == NX_FILE_TYPE_REGULAR;
+}
+
+/* Adds the prerequisites of the make rule -MMD wrote, the text is split in place */
+static void _nx_build_record_depfile(NXBuildCache *cache, NXBuildRecord *record, char *text) {
+    char *read = strchr(text, ':');
+    char *write;
+    char *token;
+
+    if (!read) {
+        return;
+    }
+    read++;
+
+    for (;;) {
+        while (*read == ' ' || *read == '\t' || *read == '\n' || *read == '\r' ||
+               (*read == '\\' && (read[1] == '\n' || read[1] == '\r'))) {
+            read++;
+        }
+        if (*read == '\0') {
+            break;
+        }
+
+        /* Escaped spaces belong to the path, so the token is unescaped while it is scanned */
+        token = write = read;
+        while (*read != '\0' && *read != ' ' && *read != '\t' && *read != '\n' && *read != '\r') {
+            if (*read == '\\' && read[1] == ' ') {
+                read++;
+            }
+            *write++ = *read++;
+        }
+        if (*read != '\0') {
+            read++;
+        }
+        *write = '\0';
+
+        /* -MP adds empty rules for the headers, their targets are not prerequisites */
+        if (write > token && write[-1] != ':') {
+            _nx_build_record_add(cache, record, token);
+        }
+    }
+}
+
+static size_t _nx_build_command_hash(NXCR *cr) {
+    return nx_hash_bytes(cr->command->buffer, cr->command->length);
+}
+
+NXBuildCache *nx_build_cache_load(const char *filename) {
+    NXBuildCache  *cache;
+    NXBuildRecord *record = NULL;
+    size_t         remaining = 0;
+    char          *text;
+    char          *line;
+    char          *end;
+
+    cache = (NXBuildCache *) nx_malloc(sizeof(NXBuildCache));
+    if (!cache) {
+        return NULL;
+    }
+    cache->arena    = nx_arena_create();
+    cache->list     = NULL;
+    cache->count    = 0;
+    cache->capacity = 0;
+    cache->dirty    = false;
+    cache->records  = cache->arena ? nx_hashmap_create_ex(NULL, NULL, cache->arena, NULL) : NULL;
+    cache->filename = cache->records ? _nx_build_strdup(cache, filename, strlen(filename)) : NULL;
+    if (!cache->filename) {
+        nx_build_cache_destroy(cache);
+        return NULL;
+    }
+
+    text = nx_file_read_all(filename);
+    if (!text) {
+        return cache;
+    }
+
+    /* "<command hash>\t<input count>\t<target>" followed by one
+     * "<hash>\t<size>\t<mtime sec>\t<mtime nsec>\t<path>" line per input.
+     * A malformed line drops the rest of the file, which only costs a rebuild */
+    for (line = text; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+        NXBuildInput input;
+        char        *p;
+
+        *end = '\0';
+        if (remaining == 0) {
+            size_t command_hash = (size_t) strtoul(line, &p, 16);
+            size_t count        = (size_t) strtoul(p, &p, 10);
+            if (*p != '\t' || !(record = _nx_build_record_get(cache, p + 1))) {
+                break;
+            }
+            record->command_hash = command_hash;
+            remaining            = count;
+            continue;
+        }
+
+        input.hash       = (size_t) strtoul(line, &p, 16);
+        input.size       = strtol(p, &p, 10);
+        input.mtime_sec  = (time_t) strtol(p, &p, 10);
+        input.mtime_nsec = strtol(p, &p, 10);
+        if (*p != '\t' || !(input.path = _nx_build_strdup(cache, p + 1, strlen(p + 1))) ||
+            !_nx_build_record_push(record, &input)) {
+            break;
+        }
+        remaining--;
+    }
+
+    nx_free(text);
+    return cache;
+}
+
+/* Writes the cache atomically when anything changed since it was loaded */
+bool nx_build_cache_save(NXBuildCache *cache) {
+    NXStringBuilder *sb;
+    NXFileBuffer     buffer;
+    size_t           i;
+    size_t           j;
+    int              result;
+
+    if (!cache->dirty) {
+        return true;
+    }
+
+    sb = nx_string_builder_create();
+    for (i = 0; i < cache->count; i++) {
+        NXBuildRecord *record = cache->list[i];
+        if (record->input_count == 0) {
+            continue;
+        }
+        nx_string_builder_appendf(sb, "%lx\t%lu\t%s\n", (unsigned long) record->command_hash,
+                                  (unsigned long) record->input_count, record->target);
+        for (j = 0; j < record->input_count; j++) {
+            NXBuildInput *input = &record->inputs[j];
+            nx_string_builder_appendf(sb, "%lx\t%ld\t%ld\t%ld\t%s\n", (unsigned long) input->hash,
+                                      input->size, (long) input->mtime_sec, input->mtime_nsec,
+                                      input->path);
+        }
+    }
+
+    buffer.data   = sb->buffer;
+    buffer.length = sb->length;
+    result        = nx_file_writev(cache->filename, &buffer, 1, NX_FILE_WRITE_ATOMIC);
+    nx_string_builder_destroy(sb);
+    if (result != 0) {
+        return false;
+    }
+    cache->dirty = false;
+    return true;
+}
+
+void nx_build_cache_destroy(NXBuildCache *cache) {
+    size_t i;
+    if (cache) {
+        for (i = 0; i < cache->count; i++) {
+            nx_free(cache->list[i]->inputs);
+        }
+        nx_free(cache->list);
+        if (cache->arena) {
+            nx_arena_destroy(cache->arena);
+        }
+        nx_free(cache);
+    }
+}
+
+/* cr has to be built with nx_cr_arg, its target is the argument after -o */
+bool nx_build_cache_fresh(NXBuildCache *cache, NXCR *cr) {
+    char          *target = _nx_build_flag_value(cr, "-o");
+    NXBuildRecord *record;
+    NXFileStat     st;
+    size_t         i;
+
+    if (!target || nx_file_stat(target, &st) != 0) {
+        return false;
+    }
+    record = (NXBuildRecord *) nx_hashmap_get(cache->records, target);
+    if (!record || record->input_count == 0 || record->command_hash != _nx_build_command_hash(cr)) {
+        return false;
+    }
+
+    for (i = 0; i < record->input_count; i++) {
+        NXBuildInput *input = &record->inputs[i];
+        NXBuildInput  current;
+        if (nx_file_stat(input->path, &st) != 0) {
+            return false;
+        }
+        if (st.size == input->size && st.mtime_sec == input->mtime_sec &&
+            st.mtime_nsec == input->mtime_nsec) {
+            continue;
+        }
+        if (!_nx_build_hash_file(input->path, &current) || current.hash != input->hash) {
+            return false;
+        }
+        /* Touched but unchanged, keep the new stat so it isn't hashed again next time */
+        input->size       = current.size;
+        input->mtime_sec  = current.mtime_sec;
+        input->mtime_nsec = current.mtime_nsec;
+        cache->dirty      = true;
+    }
+    return true;
+}
+
+/* Call once cr built its target. cr still needs its arguments, which nx_cr_execute clears, so
+ * this is meant for jobs run by an NXCRPool */
+bool nx_build_cache_record(NXBuildCache *cache, NXCR *cr) {
+    char          *target = _nx_build_flag_value(cr, "-o");
+    const char    *depfile;
+    NXBuildRecord *record;
+    size_t         i;
+
+    if (!target || !(record = _nx_build_record_get(cache, target))) {
+        return false;
+    }
+    record->command_hash = _nx_build_command_hash(cr);
+    record->input_count  = 0;
+    cache->dirty         = true;
+
+    for (i = 1; i < cr->argc; i++) {
+        if (_nx_build_is_input(cr, i)) {
+            _nx_build_record_add(cache, record, cr->argv[i]);
+        }
+    }
+
+    depfile = _nx_build_flag_value(cr, "-MF");
+    if (depfile) {
+        char *text = nx_file_read_all(depfile);
+        if (text) {
+            _nx_build_record_depfile(cache, record, text);
+            nx_free(text);
+        }
+    }
+    return record->input_count > 0;
+}
+
+static const char *_nx_extract_basename(const char *filepath) {
+    const char *slash = strrchr(filepath, '/');
+    if (slash) {
+        return slash + 1;
+    }
+    return filepath;
+}
+
+static void _nx_remove_extension(char *filename) {
+    char *dot = strrchr(filename, '.');
+    if (dot) {
+        *dot = '\0';
+    }
+}
+
+static bool _nx_build_is_source(const char *arg) {
+    static const char *extensions[] = {".c", ".cc", ".cpp", ".cxx"};
+    const char        *dot          = strrchr(arg, '.');
+    size_t             i;
+
+    for (i = 0; dot && i < nx_len(extensions); i++) {
+        if (strcmp(dot, extensions[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Compiles of sources also write a depfile next to their target, which is how the build cache
+ * learns about the headers they include */
+static NXCR *_nx_compile_cr(const char **args, int arg_count, bool enable_warnings) {
+    NXCR            *cr;
+    NXStringBuilder *depfile;
+    const char      *target;
+    bool             sources = false;
+    int              i;
+
+    cr = nx_cr_create();
+    if (!cr) {
+        return NULL;
+    }
+
+    for (i = 0; i < arg_count; ++i) {
+        nx_cr_arg(cr, args[i]);
+        sources = sources || (args[i][0] != '-' && _nx_build_is_source(args[i]));
+    }
+
+    if (enable_warnings) {
+        nx_cr_enable_gcc_warnings(cr);
+    }
+
+    target = _nx_build_flag_value(cr, "-o");
+    if (target && sources && !_nx_build_flag_value(cr, "-MF")) {
+        depfile = nx_string_builder_create();
+        nx_string_builder_append(depfile, target);
+        nx_string_builder_append(depfile, ".d");
+        nx_cr_arg(cr, "-MMD");
+        nx_cr_arg(cr, "-MF");
+        nx_cr_arg(cr, depfile->buffer);
+        nx_string_builder_destroy(depfile);
+    }
+    return cr;
+}
+
+/* Skips the compile when NX_BUILD_CACHE says the target of -o is up to date */
+int nx_compile_command(const char *description, const char **args, int arg_count,
+                       bool enable_warnings) {
+    NXCRPool *pool;
+    int       result;
+
+    pool = nx_cr_pool_create(1);
+    if (!pool) {
+        fprintf(stderr, "Failed to create NXCRPool instance for %s.\n", description);
+        return EXIT_FAILURE;
+    }
+
+    nx_cr_pool_compile(pool, description, args, arg_count, enable_warnings);
+    result = nx_cr_pool_run(pool);
+    nx_cr_pool_destroy(pool);
+    return result;
+}
+
+/* Queues the compile on a pool instead of running it, see nx_compile_command */
+size_t nx_cr_pool_compile(NXCRPool *pool, const char *description, const char **args,
+                          int arg_count, bool enable_warnings) {
+    NXCR  *cr;
+    size_t job;
+
+    cr = _nx_compile_cr(args, arg_count, enable_warnings);
+    if (!cr) {
+        nx_die("Failed to create NXCR instance");
+    }
+
+    job                    = nx_cr_pool_submit(pool, cr, description);
+    pool->jobs[job].cached = true;
+    return job;
+}
+
+int nx_rebuild(const char *source_file, int argc, char **argv) {
+    const char   *basename_with_ext;
+    char          basename[256];
+    const char   *output_executable;
+    NXFileStat    src_stat;
+    NXBuildCache *cache;
+    NXCR         *cr;
+    int           need_build;
+    const char   *args[8];
+    int           compile_result;
+    char        **new_argv;
+    int           i;
+
+    basename_with_ext = _nx_extract_basename(source_file);
+    if (strlen(basename_with_ext) >= sizeof(basename)) {
+        fprintf(stderr, "Error: Source file basename is too long.\n");
+        return -1;
+    }
+    strncpy(basename, basename_with_ext, sizeof(basename) - 1);
+    basename[sizeof(basename) - 1] = '\0';
+    _nx_remove_extension(basename);
+
+    output_executable = basename;
+
+    if (nx_file_stat(source_file, &src_stat) != 0) {
+        perror("stat source_file");
+        return -1;
+    }
+
+    args[0] = "cc";
+    args[1] = source_file;
+    args[2] = "-o";
+    args[3] = output_executable;
+    args[4] = "-Wall";
+    args[5] = "-Wextra";
+    args[6] = "-fdiagnostics-color=always";
+    args[7] = "-O2";
+
+    /* Same command nx_compile_command builds, so the record it leaves is the one checked here */
+    cr         = _nx_compile_cr(args, nx_len(args), 1);
+    cache      = nx_build_cache_load(NX_BUILD_CACHE);
+    need_build = !cr || !cache || !nx_build_cache_fresh(cache, cr);
+    if (cache) {
+        nx_build_cache_save(cache);
+        nx_build_cache_destroy(cache);
+    }
+    nx_cr_destroy(cr);
+
+    if (need_build) {
+        printf("%sRebuilding %s due to changes in %s.%s\n", COLOR_YELLOW, output_executable,
+               source_file, COLOR_RESET);
+
+        compile_result = nx_compile_command(output_executable, args, nx_len(args), 1);
+        if (compile_result != 0) {
+            return compile_result;
+        }
+
+        new_argv = (char **) nx_malloc((size_t) (argc + 1) * sizeof(char *));
+        if (new_argv == NULL) {
+            perror("malloc");
+            return -1;
+        }
+
+        for (i = 0; i < argc; i++) {
+            new_argv[i] = argv[i];
+        }
+        new_argv[argc] = NULL;
+
+        execv(output_executable, new_argv);
+        perror("execv");
+        nx_free(new_argv);
+        return -1;
+    }
+
+    return 0;
+}
+/* }}} */
+
+/* File IO {{{ */
+NXFile *nx_file_open(const char *filename, const char *mode) {
+    size_t  len;
+    NXFile *nx_file = (NXFile *) nx_malloc(sizeof(NXFile));
+    if (!nx_file) {
+        return NULL;
+    }
+    len               = strlen(filename) + 1;
+    nx_file->filename = (char *) nx_malloc(len);
+    if (!nx_file->filename) {
+        nx_free(nx_file);
+        return NULL;
+    }
+    memcpy(nx_file->filename, filename, len);
+    nx_file->mode = mode;
+    nx_file->file = fopen(filename, mode);
+    if (!nx_file->file) {
+        nx_free(nx_file->filename);
+        nx_free(nx_file);
+        return NULL;
+    }
+    return nx_file;
+}
+
+void nx_file_close(NXFile *nx_file) {
+    if (nx_file) {
+        if (nx_file->file) {
+            fclose(nx_file->file);
+        }
+        nx_free(nx_file->filename);
+        nx_free(nx_file);
+    }
+}
+
+char *nx_file_read_all(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    char *buffer;
+    long  length;
+    if (!file) {
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    length = ftell(file);
+    if (length == -1L) {
+        fclose(file);
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    buffer = (char *) nx_malloc((size_t) length + 1);
+    if (!buffer) {
+        fclose(file);
+        return NULL;
+    }
+    if (fread(buffer, 1, (size_t) length, file) != (size_t) length) {
+        nx_free(buffer);
+        fclose(file);
+        return NULL;
+    }
+    buffer[length] = '\0';
+    fclose(file);
+    return buffer;
 }
 
-static bool _nx_default_key_equal(void *key1, void *key2) {
-    return strcmp((const char *) key1, (const char *) key2) == 0;
+int nx_file_write_all(const char *filename, const char *data) {
+    return nx_file_write_n(filename, data, strlen(data));
 }
 
-NXHashMap *nx_hashmap_create(size_t (*hash_func)(void *key),
-                             bool (*key_equal)(void *key1, void *key2)) {
-    NXHashMap *map = (NXHashMap *) nx_malloc(sizeof(NXHashMap));
-    if (!map)
-        return NULL;
-
-    map->capacity  = NX_HASHMAP_INITIAL_CAPACITY;
-    map->size      = 0;
-    map->hash_func = hash_func ? hash_func : _nx_default_hash;
-    map->key_equal = key_equal ? key_equal : _nx_default_key_equal;
-    map->buckets   = (NXHashMapEntry **) nx_calloc(map->capacity, sizeof(NXHashMapEntry *));
-    if (!map->buckets) {
-        nx_free(map);
-        return NULL;
-    }
-    return map;
+int nx_file_write_n(const char *filename, const void *data, size_t length) {
+    NXFileBuffer buffer;
+    buffer.data   = data;
+    buffer.length = length;
+    return nx_file_writev(filename, &buffer, 1, 0);
 }
 
-void nx_hashmap_destroy(NXHashMap *map) {
-    size_t i;
-    for (i = 0; i < map->capacity; i++) {
-        NXHashMapEntry *entry = map->buckets[i];
-        while (entry) {
-            NXHashMapEntry *next = entry->next;
-            nx_free(entry);
-            entry = next;
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* writev until everything is out, resuming after short writes and signals */
+static int _nx_file_write_iov(int fd, struct iovec *iov, size_t count) {
+    while (count > 0) {
+        size_t  written;
+        ssize_t result = writev(fd, iov, (int) nx_min(count, (size_t) IOV_MAX));
+        if (result < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+
+        written = (size_t) result;
+        while (count > 0 && written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
         }
     }
-    nx_free(map->buckets);
-    nx_free(map);
+    return 0;
 }
 
-bool nx_hashmap_insert(NXHashMap *map, void *key, void *value) {
-    /* Declare variables before any executable statements */
-    size_t          index = map->hash_func(key) % map->capacity;
-    NXHashMapEntry *entry = map->buckets[index];
-    NXHashMapEntry *new_entry;
+static void _nx_file_sync_parent(const char *filename) {
+    char        dir[4096] = ".";
+    const char *slash     = strrchr(filename, '/');
+    int         fd;
 
-    while (entry) {
-        if (map->key_equal(entry->key, key)) {
-            entry->value = value;
-            return true;
+    if (slash) {
+        size_t len = slash == filename ? 1 : (size_t) (slash - filename);
+        if (len >= sizeof(dir)) {
+            return;
         }
-        entry = entry->next;
+        memcpy(dir, filename, len);
+        dir[len] = '\0';
     }
 
-    new_entry = (NXHashMapEntry *) nx_malloc(sizeof(NXHashMapEntry));
-    if (!new_entry) {
-        return false;
+    fd = open(dir, O_RDONLY);
+    if (fd != -1) {
+        fsync(fd);
+        close(fd);
     }
-    new_entry->key      = key;
-    new_entry->value    = value;
-    new_entry->next     = map->buckets[index];
-    map->buckets[index] = new_entry;
-
-    map->size++;
+}
 
-    /* Fixing the conversion warning by explicitly casting to float */
-    if ((float) map->size / (float) map->capacity > NX_HASHMAP_LOAD_FACTOR) {
-        _nx_hashmap_resize(map);
+/* Makes temp names unique across threads, the pid only separates processes */
+static unsigned long _nx_file_temp_counter = 0;
+
+/* Writes all buffers with as few syscalls as possible. With NX_FILE_WRITE_ATOMIC readers see
+ * either the old or the new contents, never a partial file */
+int nx_file_writev(const char *filename, const NXFileBuffer *buffers, size_t count, int flags) {
+    struct iovec *iov;
+    struct stat   existing;
+    char         *temp_name = NULL;
+    size_t        i;
+    int           fd;
+    int           result = 0;
+
+    iov = (struct iovec *) nx_malloc(nx_max(count, (size_t) 1) * sizeof(struct iovec));
+    if (!iov) {
+        return -1;
+    }
+    for (i = 0; i < count; i++) {
+        /* iovec is shared with readv, writev never writes through it */
+        iov[i].iov_base = (void *) (size_t) buffers[i].data;
+        iov[i].iov_len  = buffers[i].length;
     }
-    return true;
-}
 
-void *nx_hashmap_get(NXHashMap *map, void *key) {
-    size_t          index = map->hash_func(key) % map->capacity;
-    NXHashMapEntry *entry = map->buckets[index];
+    if (flags & NX_FILE_WRITE_ATOMIC) {
+        int attempts = 0;
 
-    while (entry) {
-        if (map->key_equal(entry->key, key)) {
-            return entry->value;
+        temp_name = (char *) nx_malloc(strlen(filename) + 64);
+        if (!temp_name) {
+            nx_free(iov);
+            return -1;
         }
-        entry = entry->next;
+        /* O_EXCL so a leftover temp file is skipped instead of shared */
+        do {
+            sprintf(temp_name, "%s.tmp.%ld.%lu", filename, (long) getpid(),
+                    nx_atomic_fetch_add(&_nx_file_temp_counter, 1UL));
+            fd = open(temp_name, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        } while (fd == -1 && errno == EEXIST && ++attempts < 100);
+    } else {
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    }
+    if (fd == -1) {
+        nx_free(temp_name);
+        nx_free(iov);
+        return -1;
     }
-    return NULL;
-}
 
-bool nx_hashmap_remove(NXHashMap *map, void *key) {
-    size_t          index = map->hash_func(key) % map->capacity;
-    NXHashMapEntry *entry = map->buckets[index];
-    NXHashMapEntry *prev  = NULL;
+    /* The rename replaces the file, so carry its mode (e.g. the exec bit) over to the temp file */
+    if (temp_name && stat(filename, &existing) == 0) {
+        result = chmod(temp_name, existing.st_mode & 07777);
+    }
+    if (result == 0) {
+        result = _nx_file_write_iov(fd, iov, count);
+    }
+    if (result == 0 && (flags & NX_FILE_WRITE_SYNC)) {
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+        result = fdatasync(fd);
+#else
+        result = fsync(fd);
+#endif
+    }
+    if (close(fd) != 0) {
+        result = -1;
+    }
 
-    while (entry) {
-        if (map->key_equal(entry->key, key)) {
-            if (prev) {
-                prev->next = entry->next;
-            } else {
-                map->buckets[index] = entry->next;
-            }
-            nx_free(entry);
-            map->size--;
-            return true;
+    if (temp_name) {
+        if (result == 0 && rename(temp_name, filename) != 0) {
+            result = -1;
         }
-        prev  = entry;
-        entry = entry->next;
+        if (result != 0) {
+            remove(temp_name);
+        } else if (flags & NX_FILE_WRITE_SYNC) {
+            _nx_file_sync_parent(filename);
+        }
+        nx_free(temp_name);
     }
-    return false;
+
+    nx_free(iov);
+    return result == 0 ? 0 : -1;
 }
-/* }}} */
 
-/* String Builder {{{ */
-static void _nx_string_builder_resize(NXStringBuilder *sb, size_t new_capacity) {
-    if (new_capacity <= sb->capacity) {
-        return;
+int nx_file_exists(const char *filename) {
+    NXFileStat st;
+    return nx_file_stat(filename, &st) == 0;
+}
+
+long nx_file_size(const char *filename) {
+    NXFileStat st;
+    if (nx_file_stat(filename, &st) != 0) {
+        return -1;
     }
-    sb->buffer = (char *) nx_realloc(sb->buffer, new_capacity);
-    if (sb->buffer) {
-        sb->capacity = new_capacity;
+    return st.size;
+}
+
+static void _nx_file_stat_convert(const struct stat *raw, NXFileStat *st) {
+    if (S_ISREG(raw->st_mode)) {
+        st->type = NX_FILE_TYPE_REGULAR;
+    } else if (S_ISDIR(raw->st_mode)) {
+        st->type = NX_FILE_TYPE_DIRECTORY;
     } else {
-        nx_die("Failed to allocate memory for string builder");
+        st->type = NX_FILE_TYPE_OTHER;
     }
+    st->size = (long) raw->st_size;
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+    st->mtime_sec  = raw->st_mtim.tv_sec;
+    st->mtime_nsec = raw->st_mtim.tv_nsec;
+#else
+    st->mtime_sec  = raw->st_mtime;
+    st->mtime_nsec = 0;
+#endif
 }
 
-NXStringBuilder *nx_string_builder_create(void) {
-    NXStringBuilder *sb = (NXStringBuilder *) nx_malloc(sizeof(NXStringBuilder));
-    if (!sb) {
-        return NULL;
-    }
-    sb->capacity = NX_STRING_BUILDER_INITIAL_CAPACITY;
-    sb->length   = 0;
-    sb->buffer   = (char *) nx_malloc(sb->capacity);
-    if (!sb->buffer) {
-        nx_free(sb);
-        return NULL;
+/* One stat call, no open. Returns 0 on success and -1 when the file is missing */
+int nx_file_stat(const char *filename, NXFileStat *st) {
+    struct stat raw;
+    if (stat(filename, &raw) != 0) {
+        memset(st, 0, sizeof(*st));
+        return -1;
     }
-    sb->buffer[0] = '\0';
-    return sb;
+    _nx_file_stat_convert(&raw, st);
+    return 0;
 }
 
-void nx_string_builder_destroy(NXStringBuilder *sb) {
-    if (sb) {
-        nx_free(sb->buffer);
-        nx_free(sb);
+static int _nx_file_statat(int dir_fd, const char *name, struct stat *raw) {
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+    return fstatat(dir_fd, name, raw, 0);
+#else
+    /* Without fstatat, go through the directory's /dev/fd entry, AT_FDCWD is negative */
+    char *path;
+    int   result;
+
+    if (dir_fd < 0 || name[0] == '/') {
+        return stat(name, raw);
+    }
+    path = (char *) nx_malloc(strlen(name) + 32);
+    if (!path) {
+        return -1;
     }
+    sprintf(path, "/dev/fd/%d/%s", dir_fd, name);
+    result = stat(path, raw);
+    nx_free(path);
+    return result;
+#endif
 }
 
-void nx_string_builder_append(NXStringBuilder *sb, const char *str) {
-    size_t str_len = strlen(str);
-    if (sb->length + str_len >= sb->capacity) {
-        size_t new_capacity = sb->capacity * NX_STRING_BUILDER_GROWTH_FACTOR;
-        while (sb->length + str_len >= new_capacity) {
-            new_capacity *= NX_STRING_BUILDER_GROWTH_FACTOR;
+/* Resolves names relative to dir_fd (or AT_FDCWD) so the directory is only walked once. Missing
+ * entries get NX_FILE_TYPE_NONE, the return value counts the ones found */
+size_t nx_file_stat_batch(int dir_fd, const char **names, size_t count, NXFileStat *stats) {
+    struct stat raw;
+    size_t      found = 0;
+    size_t      i;
+
+    for (i = 0; i < count; i++) {
+        if (_nx_file_statat(dir_fd, names[i], &raw) != 0) {
+            memset(&stats[i], 0, sizeof(stats[i]));
+            continue;
         }
-        _nx_string_builder_resize(sb, new_capacity);
+        _nx_file_stat_convert(&raw, &stats[i]);
+        found++;
     }
-    memcpy(sb->buffer + sb->length, str, str_len + 1);
-    sb->length += str_len;
+    return found;
 }
 
-void nx_string_builder_append_char(NXStringBuilder *sb, char c) {
-    if (sb->length + 1 >= sb->capacity) {
-        _nx_string_builder_resize(sb, sb->capacity * NX_STRING_BUILDER_GROWTH_FACTOR);
+/* Whether a was modified after b, down to the nanosecond */
+int nx_file_stat_newer(const NXFileStat *a, const NXFileStat *b) {
+    if (a->mtime_sec != b->mtime_sec) {
+        return a->mtime_sec > b->mtime_sec;
     }
-    sb->buffer[sb->length]     = c;
-    sb->buffer[sb->length + 1] = '\0';
-    sb->length++;
+    return a->mtime_nsec > b->mtime_nsec;
 }
 
-const char *nx_string_builder_to_cstring(NXStringBuilder *sb) {
-    return sb->buffer;
-}
+static bool _nx_file_read_fd(int fd, NXFileMap *map) {
+    char             chunk[4096];
+    ssize_t          bytes_read;
+    NXStringBuilder *sb = nx_string_builder_create();
+    if (!sb) {
+        return false;
+    }
 
-void nx_string_builder_clear(NXStringBuilder *sb) {
-    sb->length    = 0;
-    sb->buffer[0] = '\0';
+    nx_string_builder_reserve(sb, map->length);
+    while ((bytes_read = read(fd, chunk, sizeof(chunk))) > 0) {
+        nx_string_builder_append_n(sb, chunk, (size_t) bytes_read);
+    }
+    if (bytes_read < 0) {
+        nx_string_builder_destroy(sb);
+        return false;
+    }
+
+    map->length = sb->length;
+    map->data   = nx_string_builder_detach(sb);
+    map->mapped = false;
+    return true;
 }
-/* }}} */
 
-/* Command Runner {{{ */
-NXCR *nx_cr_create(void) {
-    NXCR *cr = (NXCR *) nx_malloc(sizeof(NXCR));
-    if (!cr) {
+/* Maps the whole file, falls back to reading it when mmap is unavailable or fails, e.g. on empty
+ * files or pipes */
+NXFileMap *nx_file_map(const char *filename, int flags) {
+    struct stat st;
+    NXFileMap  *map;
+    int         fd = open(filename, O_RDONLY);
+    if (fd == -1) {
         return NULL;
     }
-
-    cr->command = nx_string_builder_create();
-    if (!cr->command) {
-        nx_free(cr);
+    if (fstat(fd, &st) == -1) {
+        close(fd);
         return NULL;
     }
 
-    cr->output    = NULL;
-    cr->exit_code = 0;
-    return cr;
-}
+    map = (NXFileMap *) nx_malloc(sizeof(NXFileMap));
+    if (!map) {
+        close(fd);
+        return NULL;
+    }
+    map->data   = NULL;
+    map->length = (size_t) st.st_size;
+    map->mapped = false;
+
+#ifndef NX_NO_MMAP
+    if (S_ISREG(st.st_mode) && map->length > 0) {
+        int   prot = PROT_READ | ((flags & NX_FILE_MAP_COPY_ON_WRITE) ? PROT_WRITE : 0);
+        void *addr = mmap(NULL, map->length, prot, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            map->data   = (char *) addr;
+            map->mapped = true;
+            /* Only hints, skipped where madvise is not exposed */
+#ifdef MADV_SEQUENTIAL
+            if (flags & NX_FILE_MAP_SEQUENTIAL) {
+                madvise(addr, map->length, MADV_SEQUENTIAL);
+            }
+#endif
+#ifdef MADV_RANDOM
+            if ((flags & NX_FILE_MAP_RANDOM) && !(flags & NX_FILE_MAP_SEQUENTIAL)) {
+                madvise(addr, map->length, MADV_RANDOM);
+            }
+#endif
+        }
+    }
+#else
+    (void) flags;
+#endif
 
-void nx_cr_destroy(NXCR *cr) {
-    if (cr) {
-        nx_string_builder_destroy(cr->command);
-        nx_free(cr->output);
-        nx_free(cr);
+    if (!map->mapped && !_nx_file_read_fd(fd, map)) {
+        nx_free(map);
+        close(fd);
+        return NULL;
     }
-}
 
-void nx_cr_append(NXCR *cr, const char *str) {
-    nx_string_builder_append(cr->command, str);
-    nx_string_builder_append(cr->command, " ");
+    close(fd);
+    return map;
 }
 
-int nx_cr_execute(NXCR *cr) {
-    int              pipefd[2];
-    pid_t            pid;
-    int              status;
-    char             buffer[4096];
-    ssize_t          bytes_read;
-    NXStringBuilder *output_sb;
-    const char      *temp_output;
-
-    nx_free(cr->output);
-    cr->output = NULL;
-
-    if (pipe(pipefd) == -1) {
-        perror("pipe");
-        return -1;
+/* memchr that checks 64 bytes per iteration with SIMD before pinpointing the match */
+static const char *_nx_memchr(const char *data, size_t length, char c) {
+#if defined(NX_SIMD_SSE2)
+    __m128i needle = _mm_set1_epi8(c);
+    while (length >= 64) {
+        const __m128i *block = (const __m128i *) (const void *) data;
+        __m128i        a     = _mm_cmpeq_epi8(_mm_loadu_si128(block), needle);
+        __m128i        b     = _mm_cmpeq_epi8(_mm_loadu_si128(block + 1), needle);
+        __m128i        d     = _mm_cmpeq_epi8(_mm_loadu_si128(block + 2), needle);
+        __m128i        e     = _mm_cmpeq_epi8(_mm_loadu_si128(block + 3), needle);
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(d, e)))) {
+            break;
+        }
+        data += 64;
+        length -= 64;
     }
-
-    pid = fork();
-    if (pid == -1) {
-        perror("fork");
-        return -1;
+    while (length >= 16) {
+        unsigned int mask = (unsigned int) _mm_movemask_epi8(
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (const void *) data), needle));
+        if (mask) {
+            return data + _nx_ctz(mask);
+        }
+        data += 16;
+        length -= 16;
     }
-
-    if (pid == 0) {
-        close(pipefd[0]);
-        if (dup2(pipefd[1], STDOUT_FILENO) == -1 || dup2(pipefd[1], STDERR_FILENO) == -1) {
-            perror("dup2");
-            exit(1);
+#elif defined(NX_SIMD_NEON)
+    uint8x16_t needle = vdupq_n_u8((unsigned char) c);
+    while (length >= 16) {
+        if (vmaxvq_u8(vceqq_u8(vld1q_u8((const unsigned char *) data), needle))) {
+            break;
         }
-        close(pipefd[1]);
-
-        execlp("/bin/sh", "sh", "-c", nx_string_builder_to_cstring(cr->command), NULL);
-        perror("execlp");
-        exit(1);
+        data += 16;
+        length -= 16;
     }
+#endif
+    return (const char *) memchr(data, c, length);
+}
 
-    close(pipefd[1]);
-    output_sb = nx_string_builder_create();
+/* Keeps the unconsumed tail and reads after it, growing only when one line fills the buffer */
+static bool _nx_file_reader_fill(NXFileReader *reader) {
+    size_t bytes;
 
-    while ((bytes_read = read(pipefd[0], buffer, sizeof(buffer) - 1)) > 0) {
-        buffer[bytes_read] = '\0';
-        fprintf(stdout, "%s", buffer);
-        fflush(stdout);
-        nx_string_builder_append(output_sb, buffer);
+    if (reader->eof) {
+        return false;
     }
 
-    close(pipefd[0]);
-
-    if (output_sb->length > 0) {
-        temp_output = nx_string_builder_to_cstring(output_sb);
-        cr->output  = (char *) nx_malloc(strlen(temp_output) + 1);
-        if (cr->output) {
-            strcpy(cr->output, temp_output);
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+    if (reader->end == reader->capacity) {
+        char *buffer = (char *) nx_realloc(reader->buffer, reader->capacity * 2);
+        if (!buffer) {
+            return false;
         }
+        reader->buffer = buffer;
+        reader->capacity *= 2;
     }
 
-    nx_string_builder_destroy(output_sb);
-
-    waitpid(pid, &status, 0);
-    cr->exit_code = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-    nx_string_builder_clear(cr->command);
-
-    return cr->exit_code;
+    bytes = fread(reader->buffer + reader->end, 1, reader->capacity - reader->end,
+                  reader->file->file);
+    if (bytes == 0) {
+        reader->eof = true;
+        return false;
+    }
+    reader->end += bytes;
+    return true;
 }
 
-const char *nx_cr_get_output(NXCR *cr) {
-    return cr->output ? cr->output : "";
+NXFileReader *nx_file_reader_create(NXFile *file, size_t buffer_size) {
+    NXFileReader *reader = (NXFileReader *) nx_malloc(sizeof(NXFileReader));
+    if (!reader) {
+        return NULL;
+    }
+    reader->capacity = buffer_size ? buffer_size : NX_FILE_READER_BUFFER_SIZE;
+    reader->buffer   = (char *) nx_malloc(reader->capacity);
+    if (!reader->buffer) {
+        nx_free(reader);
+        return NULL;
+    }
+    reader->file  = file;
+    reader->start = 0;
+    reader->end   = 0;
+    reader->eof   = false;
+    return reader;
 }
 
-int nx_cr_get_exit_code(NXCR *cr) {
-    return cr->exit_code;
+void nx_file_reader_destroy(NXFileReader *reader) {
+    if (reader) {
+        nx_free(reader->buffer);
+        nx_free(reader);
+    }
 }
 
-int nx_cr_run(const char *command) {
-    NXCR *cr;
-    int   result;
+size_t nx_file_read_chunk(NXFileReader *reader, const char **data) {
+    size_t available;
 
-    cr = nx_cr_create();
-    if (!cr) {
-        fprintf(stderr, "Failed to create NXCR instance.\n");
-        return EXIT_FAILURE;
+    if (reader->start == reader->end && !_nx_file_reader_fill(reader)) {
+        return 0;
     }
 
-    nx_string_builder_append(cr->command, command);
-    result = nx_cr_execute(cr);
-    nx_cr_destroy(cr);
-    return result;
+    available     = reader->end - reader->start;
+    *data         = reader->buffer + reader->start;
+    reader->start = reader->end;
+    return available;
 }
-/* }}} */
 
-/* Command Runner (Build) {{{ */
-static const char *_nx_extract_basename(const char *filepath) {
-    const char *slash = strrchr(filepath, '/');
-    if (slash) {
-        return slash + 1;
+/* The line excludes its newline, a last line without one is still returned */
+bool nx_file_next_line(NXFileReader *reader, const char **line, size_t *length) {
+    size_t scanned = 0;
+
+    for (;;) {
+        const char *start   = reader->buffer + reader->start;
+        const char *newline = _nx_memchr(start + scanned, reader->end - reader->start - scanned,
+                                         '\n');
+        if (newline) {
+            *line   = start;
+            *length = (size_t) (newline - start);
+            reader->start += *length + 1;
+            return true;
+        }
+        scanned = reader->end - reader->start;
+        if (!_nx_file_reader_fill(reader)) {
+            break;
+        }
     }
-    return filepath;
+
+    if (reader->end > reader->start) {
+        *line         = reader->buffer + reader->start;
+        *length       = reader->end - reader->start;
+        reader->start = reader->end;
+        return true;
+    }
+    return false;
 }
 
-static void _nx_remove_extension(char *filename) {
-    char *dot = strrchr(filename, '.');
-    if (dot) {
-        *dot = '\0';
+void nx_file_unmap(NXFileMap *map) {
+    if (map) {
+#ifndef NX_NO_MMAP
+        if (map->mapped) {
+            munmap(map->data, map->length);
+        } else {
+            nx_free(map->data);
+        }
+#else
+        nx_free(map->data);
+#endif
+        nx_free(map);
     }
 }
+/* }}} */
 
-int nx_compile_command(const char *description, const char **args, int arg_count,
-                       bool enable_warnings) {
-    NXCR *cr;
-    int   i;
-    int   result;
+/* Logging {{{ */
+/* Timestamps come from clock_gettime and localtime_r, see USAGE for the include order */
+#if !defined(CLOCK_MONOTONIC) || !defined(CLOCK_REALTIME)
+#error "the logger needs CLOCK_MONOTONIC and CLOCK_REALTIME, include nexus.h first"
+#endif
 
-    cr = nx_cr_create();
-    if (!cr) {
-        fprintf(stderr, "Failed to create NXCR instance for %s.\n", description);
-        return EXIT_FAILURE;
-    }
+static pthread_once_t  _nx_logger_clock_once = PTHREAD_ONCE_INIT;
+static struct timespec _nx_logger_wall_base;
+static struct timespec _nx_logger_mono_base;
 
-    for (i = 0; i < arg_count; ++i) {
-        nx_cr_append(cr, args[i]);
+static void _nx_logger_clock_init(void) {
+    clock_gettime(CLOCK_REALTIME, &_nx_logger_wall_base);
+    clock_gettime(CLOCK_MONOTONIC, &_nx_logger_mono_base);
+}
+
+/* Wall clock time derived from the monotonic clock, so it never steps backwards */
+static void _nx_logger_now(struct timespec *now) {
+    struct timespec mono;
+
+    pthread_once(&_nx_logger_clock_once, _nx_logger_clock_init);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+
+    now->tv_sec  = _nx_logger_wall_base.tv_sec + (mono.tv_sec - _nx_logger_mono_base.tv_sec);
+    now->tv_nsec = _nx_logger_wall_base.tv_nsec + (mono.tv_nsec - _nx_logger_mono_base.tv_nsec);
+    if (now->tv_nsec < 0) {
+        now->tv_sec--;
+        now->tv_nsec += 1000000000L;
+    } else if (now->tv_nsec >= 1000000000L) {
+        now->tv_sec++;
+        now->tv_nsec -= 1000000000L;
     }
+}
 
-    if (enable_warnings) {
-        nx_cr_enable_gcc_warnings(cr);
+/* Writes "[date time] ", localtime_r and strftime only run when the second changes */
+static size_t _nx_logger_timestamp(NXLogger *logger, const struct timespec *now, char *out) {
+    size_t length;
+
+    if (now->tv_sec != logger->cached_second || logger->cached_time_len == 0) {
+        struct tm local;
+        localtime_r(&now->tv_sec, &local);
+        logger->cached_second   = now->tv_sec;
+        logger->cached_time_len = strftime(logger->cached_time, sizeof(logger->cached_time),
+                                           "[%Y-%m-%d %H:%M:%S", &local);
     }
 
-    result = nx_cr_execute(cr);
-    if (result != 0) {
-        printf("%sCompilation of %s failed.%s\n", COLOR_RED, description, COLOR_RESET);
-    } else {
-        printf("%sCompilation of %s succeeded.%s\n", COLOR_GREEN, description, COLOR_RESET);
+    memcpy(out, logger->cached_time, logger->cached_time_len);
+    length = logger->cached_time_len;
+
+    switch (logger->time_precision) {
+    case NX_LOG_TIME_MILLIS:
+        length += (size_t) sprintf(out + length, ".%03ld", now->tv_nsec / 1000000L);
+        break;
+    case NX_LOG_TIME_MICROS:
+        length += (size_t) sprintf(out + length, ".%06ld", now->tv_nsec / 1000L);
+        break;
+    case NX_LOG_TIME_SECONDS:
+    default:
+        break;
     }
 
-    nx_cr_destroy(cr);
-    return result;
+    out[length++] = ']';
+    out[length++] = ' ';
+    return length;
 }
 
-int nx_rebuild(const char *source_file, int argc, char **argv) {
-    const char *basename_with_ext;
-    char        basename[256];
-    const char *output_executable;
-    struct stat src_stat;
-    struct stat exe_stat;
-    int         need_build;
-    const char *args[8];
-    int         compile_result;
-    char      **new_argv;
-    int         i;
+/* Decides after writing lines whether the sinks are flushed now or left to stdio buffering */
+static bool _nx_logger_should_flush(NXLogger *logger, NXLogLevel level, size_t lines) {
+    bool            flush = level >= NX_LOG_ERROR;
+    struct timespec now;
+    double          elapsed_ms;
+
+    logger->pending_lines += lines;
+
+    switch (logger->flush_policy) {
+    case NX_LOG_FLUSH_LINES:
+        flush = flush || logger->pending_lines >= logger->flush_every;
+        break;
+    case NX_LOG_FLUSH_INTERVAL:
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed_ms = (double) (now.tv_sec - logger->last_flush.tv_sec) * 1000.0 +
+                     (double) (now.tv_nsec - logger->last_flush.tv_nsec) / 1000000.0;
+        if (flush || elapsed_ms >= (double) logger->flush_every) {
+            flush              = true;
+            logger->last_flush = now;
+        }
+        break;
+    case NX_LOG_FLUSH_ERROR:
+        break;
+    case NX_LOG_FLUSH_ALWAYS:
+    default:
+        flush = true;
+        break;
+    }
 
-    basename_with_ext = _nx_extract_basename(source_file);
-    if (strlen(basename_with_ext) >= sizeof(basename)) {
-        fprintf(stderr, "Error: Source file basename is too long.\n");
-        return -1;
+    if (flush) {
+        logger->pending_lines = 0;
     }
-    strncpy(basename, basename_with_ext, sizeof(basename) - 1);
-    basename[sizeof(basename) - 1] = '\0';
-    _nx_remove_extension(basename);
+    return flush;
+}
 
-    output_executable = basename;
-    need_build        = 0;
+static void _nx_logger_format_message(NXLogger *logger, NXLogLevel level, const char *format,
+                                      va_list args) {
+    struct timespec now;
+    char            timestamp[48];
 
-    if (stat(source_file, &src_stat) != 0) {
-        perror("stat source_file");
-        return -1;
-    }
-    if (stat(output_executable, &exe_stat) != 0) {
-        need_build = 1;
-    } else if (src_stat.st_mtime > exe_stat.st_mtime) {
-        need_build = 1;
+    nx_string_builder_clear(logger->buffer);
+
+    /* Add timestamp if enabled */
+    if (logger->use_timestamps) {
+        _nx_logger_now(&now);
+        nx_string_builder_append_n(logger->buffer, timestamp,
+                                   _nx_logger_timestamp(logger, &now, timestamp));
     }
 
-    if (need_build) {
-        printf("%sRebuilding %s due to changes in %s.%s\n", COLOR_YELLOW, output_executable,
-               source_file, COLOR_RESET);
+    /* Add log level */
+    nx_string_builder_append_char(logger->buffer, '[');
+    nx_string_builder_append(logger->buffer, NX_LOG_LEVEL_STRINGS[level]);
+    nx_string_builder_append_n(logger->buffer, "] ", 2);
 
-        args[0] = "cc";
-        args[1] = source_file;
-        args[2] = "-o";
-        args[3] = output_executable;
-        args[4] = "-Wall";
-        args[5] = "-Wextra";
-        args[6] = "-fdiagnostics-color=always";
-        args[7] = "-O2";
+    /* Format the actual message */
+    nx_string_builder_vappendf(logger->buffer, format, args);
 
-        compile_result = nx_compile_command(output_executable, args, nx_len(args), 1);
-        if (compile_result != 0) {
-            return compile_result;
-        }
+    nx_string_builder_append_char(logger->buffer, '\n');
+}
 
-        new_argv = (char **) nx_malloc((size_t) (argc + 1) * sizeof(char *));
-        if (new_argv == NULL) {
-            perror("malloc");
-            return -1;
-        }
+/* Formats one line into a fixed record, truncating so the newline always fits. The timestamp is
+ * added by the writer thread */
+static size_t _nx_logger_format_record(NXLogLevel level, const char *format, va_list args,
+                                       char *out, size_t size) {
+    size_t length = 0;
+    int    written;
 
-        for (i = 0; i < argc; i++) {
-            new_argv[i] = argv[i];
-        }
-        new_argv[argc] = NULL;
+    written = nx_snprintf(out + length, size - length, "[%s] ", NX_LOG_LEVEL_STRINGS[level]);
+    length  = nx_min(length + (size_t) nx_max(written, 0), size - 2);
 
-        execv(output_executable, new_argv);
-        perror("execv");
-        nx_free(new_argv);
-        return -1;
-    }
+    written = nx_vsnprintf(out + length, size - length, format, args);
+    length  = nx_min(length + (size_t) nx_max(written, 0), size - 2);
 
-    return 0;
+    out[length++] = '\n';
+    out[length]   = '\0';
+    return length;
 }
-/* }}} */
 
-/* File IO {{{ */
-NXFile *nx_file_open(const char *filename, const char *mode) {
-    size_t  len;
-    NXFile *nx_file = (NXFile *) nx_malloc(sizeof(NXFile));
-    if (!nx_file) {
-        return NULL;
+/* Parses the conversion after a '%', returns its length or 0 when it cannot be deferred */
+static size_t _nx_logger_parse_spec(const char *spec, size_t *stars, char *length,
+                                    char *conversion) {
+    const char *p = spec;
+
+    *stars  = 0;
+    *length = 0;
+    while (*p && strchr("-+ #0", *p)) {
+        p++;
     }
-    len               = strlen(filename) + 1;
-    nx_file->filename = (char *) nx_malloc(len);
-    if (!nx_file->filename) {
-        nx_free(nx_file);
-        return NULL;
+    if (*p == '*') {
+        (*stars)++;
+        p++;
     }
-    memcpy(nx_file->filename, filename, len);
-    nx_file->mode = mode;
-    nx_file->file = fopen(filename, mode);
-    if (!nx_file->file) {
-        nx_free(nx_file->filename);
-        nx_free(nx_file);
-        return NULL;
+    while (*p >= '0' && *p <= '9') {
+        p++;
     }
-    return nx_file;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+    }
+    if (*p == 'h' || *p == 'l' || *p == 'L') {
+        *length = *p++;
+    }
+    if (!*p || !strchr("diouxXceEfgGsp%", *p) || p - spec >= 16) {
+        return 0;
+    }
+    *conversion = *p;
+    return (size_t) (p - spec) + 1;
 }
 
-void nx_file_close(NXFile *nx_file) {
-    if (nx_file) {
-        if (nx_file->file) {
-            fclose(nx_file->file);
+/* Pulls the raw arguments out of args without formatting them. Strings are copied since the
+ * caller's buffer may be gone by the time the writer runs */
+static bool _nx_logger_capture(NXLogRecord *record, const char *format, va_list args) {
+    const char *p;
+    size_t      count = 0;
+    size_t      used  = 0;
+    size_t      stars, n;
+    char        length, conversion;
+
+    for (p = format; *p; p++) {
+        if (*p != '%') {
+            continue;
+        }
+        n = _nx_logger_parse_spec(p + 1, &stars, &length, &conversion);
+        if (n == 0) {
+            return false;
+        }
+        p += n;
+        if (conversion == '%') {
+            continue;
+        }
+        if (count + stars + 1 > NX_LOG_MAX_ARGS) {
+            return false;
+        }
+        while (stars--) {
+            record->args[count++].i = va_arg(args, int);
+        }
+
+        switch (conversion) {
+        case 'd':
+        case 'i':
+            record->args[count++].i = length == 'l' ? va_arg(args, long) : va_arg(args, int);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            record->args[count++].u =
+                length == 'l' ? va_arg(args, unsigned long) : va_arg(args, unsigned int);
+            break;
+        case 'c':
+            record->args[count++].i = va_arg(args, int);
+            break;
+        case 'p':
+            record->args[count++].p = va_arg(args, void *);
+            break;
+        case 's': {
+            const char *str = va_arg(args, const char *);
+            size_t      len = strlen(str ? str : "(null)");
+            /* An earlier string filled the buffer, format this record eagerly instead */
+            if (used >= sizeof(record->text)) {
+                return false;
+            }
+            len = nx_min(len, sizeof(record->text) - used - 1);
+            memcpy(record->text + used, str ? str : "(null)", len);
+            record->text[used + len] = '\0';
+            record->args[count++].offset = used;
+            used += len + 1;
+            break;
+        }
+        default:
+            if (length == 'L') {
+                record->args[count++].ld = va_arg(args, long double);
+            } else {
+                record->args[count++].d = va_arg(args, double);
+            }
+            break;
         }
-        nx_free(nx_file->filename);
-        nx_free(nx_file);
     }
+
+    record->format    = format;
+    record->arg_count = count;
+    return true;
 }
 
-char *nx_file_read_all(const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    char *buffer;
-    long  length;
-    if (!file) {
-        return NULL;
+/* Replays a deferred record conversion by conversion, star widths are inlined into the spec */
+static void _nx_logger_decode(NXLogRecord *record, NXStringBuilder *line) {
+    const char *p   = record->format;
+    size_t      arg = 0;
+    size_t      stars, n, i, spec_len;
+    char        length, conversion;
+    char        spec[64];
+
+    nx_string_builder_clear(line);
+    nx_string_builder_appendf(line, "[%s] ", NX_LOG_LEVEL_STRINGS[record->level]);
+
+    while (*p) {
+        const char *start = p;
+        while (*p && *p != '%') {
+            p++;
+        }
+        nx_string_builder_append_n(line, start, (size_t) (p - start));
+        if (!*p) {
+            break;
+        }
+
+        n = _nx_logger_parse_spec(p + 1, &stars, &length, &conversion);
+        spec[0]  = '%';
+        spec_len = 1;
+        for (i = 1; i <= n; i++) {
+            if (p[i] == '*') {
+                spec_len += (size_t) sprintf(spec + spec_len, "%ld", record->args[arg++].i);
+            } else {
+                spec[spec_len++] = p[i];
+            }
+        }
+        spec[spec_len] = '\0';
+        p += n + 1;
+
+        switch (conversion) {
+        case '%':
+            nx_string_builder_append_char(line, '%');
+            break;
+        case 'd':
+        case 'i':
+        case 'c':
+            if (length == 'l') {
+                nx_string_builder_appendf(line, spec, record->args[arg++].i);
+            } else {
+                nx_string_builder_appendf(line, spec, (int) record->args[arg++].i);
+            }
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            if (length == 'l') {
+                nx_string_builder_appendf(line, spec, record->args[arg++].u);
+            } else {
+                nx_string_builder_appendf(line, spec, (unsigned int) record->args[arg++].u);
+            }
+            break;
+        case 'p':
+            nx_string_builder_appendf(line, spec, record->args[arg++].p);
+            break;
+        case 's':
+            nx_string_builder_appendf(line, spec, record->text + record->args[arg++].offset);
+            break;
+        default:
+            if (length == 'L') {
+                nx_string_builder_appendf(line, spec, record->args[arg++].ld);
+            } else {
+                nx_string_builder_appendf(line, spec, record->args[arg++].d);
+            }
+            break;
+        }
     }
-    if (fseek(file, 0, SEEK_END) != 0) {
-        fclose(file);
-        return NULL;
+
+    /* Same limit as the records formatted eagerly by _nx_logger_format_record */
+    if (line->length > NX_LOG_RECORD_SIZE - 2) {
+        line->length               = NX_LOG_RECORD_SIZE - 2;
+        line->buffer[line->length] = '\0';
     }
-    length = ftell(file);
-    if (length == -1L) {
-        fclose(file);
-        return NULL;
+    nx_string_builder_append_char(line, '\n');
+}
+
+/* Vyukov style bounded queue, a slot is free for position p when its sequence equals p */
+static void _nx_logger_enqueue(NXLogger *logger, NXLogLevel level, const char *format,
+                               va_list args) {
+    NXLogRecord *record;
+    size_t       pos = nx_atomic_load(&logger->head);
+
+    for (;;) {
+        size_t sequence;
+        long   diff;
+
+        record   = &logger->records[pos & (NX_LOG_RING_SIZE - 1)];
+        sequence = nx_atomic_load(&record->sequence);
+        diff     = (long) (sequence - pos);
+        if (diff == 0) {
+            if (nx_atomic_cas(&logger->head, &pos, pos + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            if (logger->overflow == NX_LOG_OVERFLOW_DROP) {
+                nx_atomic_fetch_add(&logger->dropped, (size_t) 1);
+                return;
+            }
+            pthread_mutex_lock(&logger->lock);
+            if (nx_atomic_load(&record->sequence) == sequence) {
+                pthread_cond_signal(&logger->wake);
+                pthread_cond_wait(&logger->drained, &logger->lock);
+            }
+            pthread_mutex_unlock(&logger->lock);
+            pos = nx_atomic_load(&logger->head);
+        } else {
+            pos = nx_atomic_load(&logger->head);
+        }
     }
-    if (fseek(file, 0, SEEK_SET) != 0) {
-        fclose(file);
-        return NULL;
+
+    record->level = level;
+    if (logger->use_timestamps) {
+        _nx_logger_now(&record->time);
     }
-    buffer = (char *) nx_malloc((size_t) length + 1);
-    if (!buffer) {
-        fclose(file);
-        return NULL;
+    record->format = NULL;
+    if (logger->deferred) {
+        va_list copy;
+        bool    captured;
+
+        nx_va_copy(copy, args);
+        captured = _nx_logger_capture(record, format, copy);
+        va_end(copy);
+        if (!captured) {
+            record->format = NULL;
+        }
     }
-    if (fread(buffer, 1, (size_t) length, file) != (size_t) length) {
-        nx_free(buffer);
-        fclose(file);
-        return NULL;
+    if (!record->format) {
+        record->length =
+            _nx_logger_format_record(level, format, args, record->text, sizeof(record->text));
     }
-    buffer[length] = '\0';
-    fclose(file);
-    return buffer;
-}
 
-int nx_file_write_all(const char *filename, const char *data) {
-    FILE  *file = fopen(filename, "wb");
-    size_t data_len;
-    if (!file) {
-        return -1;
+    /* Sequentially consistent so that either this sees the writer asleep or the writer sees the
+     * record before it goes to sleep */
+    __atomic_store_n(&record->sequence, pos + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&logger->sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&logger->lock);
+        pthread_cond_signal(&logger->wake);
+        pthread_mutex_unlock(&logger->lock);
     }
-    data_len = strlen(data);
-    if (fwrite(data, 1, data_len, file) != data_len) {
-        fclose(file);
-        return -1;
-    }
-    fclose(file);
-    return 0;
 }
 
-int nx_file_exists(const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if (file) {
-        fclose(file);
-        return 1;
-    }
-    return 0;
+static bool _nx_logger_ring_ready(NXLogger *logger) {
+    NXLogRecord *record = &logger->records[logger->tail & (NX_LOG_RING_SIZE - 1)];
+    return __atomic_load_n(&record->sequence, __ATOMIC_SEQ_CST) == logger->tail + 1;
 }
 
-long nx_file_size(const char *filename) {
-    FILE *file = fopen(filename, "rb");
-    long  size;
-    if (!file) {
-        return -1;
-    }
-    if (fseek(file, 0, SEEK_END) != 0) {
-        fclose(file);
-        return -1;
+/* Copies every published record into one batch per sink and writes each batch at once */
+static size_t _nx_logger_drain(NXLogger *logger, NXStringBuilder *out, NXStringBuilder *file_out,
+                               NXStringBuilder *line) {
+    size_t      tail  = logger->tail;
+    size_t      count = 0;
+    NXLogLevel  level = NX_LOG_TRACE;
+    char        timestamp[48];
+    size_t      timestamp_len = 0;
+    const char *text;
+    size_t      text_len;
+
+    nx_string_builder_clear(out);
+    nx_string_builder_clear(file_out);
+
+    for (;;) {
+        NXLogRecord *record = &logger->records[tail & (NX_LOG_RING_SIZE - 1)];
+        if (nx_atomic_load(&record->sequence) != tail + 1) {
+            break;
+        }
+        if (logger->use_timestamps) {
+            timestamp_len = _nx_logger_timestamp(logger, &record->time, timestamp);
+        }
+        if (record->format) {
+            _nx_logger_decode(record, line);
+            text     = line->buffer;
+            text_len = line->length;
+        } else {
+            text     = record->text;
+            text_len = record->length;
+        }
+        if (logger->use_stdout) {
+            nx_string_builder_append(out, NX_LOG_LEVEL_COLORS[record->level]);
+            nx_string_builder_append_n(out, timestamp, timestamp_len);
+            nx_string_builder_append_n(out, text, text_len);
+            nx_string_builder_append(out, COLOR_RESET);
+        }
+        if (logger->file) {
+            nx_string_builder_append_n(file_out, timestamp, timestamp_len);
+            nx_string_builder_append_n(file_out, text, text_len);
+        }
+        level = nx_max(level, record->level);
+        nx_atomic_store(&record->sequence, tail + NX_LOG_RING_SIZE);
+        tail++;
+        count++;
     }
-    size = ftell(file);
-    fclose(file);
-    return size;
-}
-/* }}} */
-
-/* Logging {{{ */
-static void _nx_logger_format_message(NXLogger *logger, NXLogLevel level, const char *format,
-                                      va_list args) {
-    time_t current_time;
-    char   timestamp[32];
 
-    nx_string_builder_clear(logger->buffer);
-
-    /* Add timestamp if enabled */
-    if (logger->use_timestamps) {
-        current_time = time(NULL);
-        strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&current_time));
-        nx_string_builder_append(logger->buffer, "[");
-        nx_string_builder_append(logger->buffer, timestamp);
-        nx_string_builder_append(logger->buffer, "] ");
+    if (count > 0) {
+        bool flush = _nx_logger_should_flush(logger, level, count);
+        if (out->length > 0) {
+            fwrite(out->buffer, 1, out->length, stdout);
+            if (flush) {
+                fflush(stdout);
+            }
+        }
+        if (file_out->length > 0) {
+            fwrite(file_out->buffer, 1, file_out->length, logger->file->file);
+            if (flush) {
+                fflush(logger->file->file);
+            }
+        }
     }
+    nx_atomic_store(&logger->tail, tail);
+    return count;
+}
 
-    /* Add log level */
-    nx_string_builder_append(logger->buffer, "[");
-    nx_string_builder_append(logger->buffer, NX_LOG_LEVEL_STRINGS[level]);
-    nx_string_builder_append(logger->buffer, "] ");
+static void *_nx_logger_thread(void *arg) {
+    NXLogger        *logger   = (NXLogger *) arg;
+    NXStringBuilder *out      = nx_string_builder_create();
+    NXStringBuilder *file_out = nx_string_builder_create();
+    NXStringBuilder *line     = nx_string_builder_create();
+    bool             done     = false;
+
+    while (!done) {
+        if (_nx_logger_drain(logger, out, file_out, line) > 0) {
+            pthread_mutex_lock(&logger->lock);
+            pthread_cond_broadcast(&logger->drained);
+            pthread_mutex_unlock(&logger->lock);
+            continue;
+        }
 
-    /* Format the actual message */
-    {
-        char formatted_message[4096];
-        nx_vsnprintf(formatted_message, sizeof(formatted_message), format, args);
-        nx_string_builder_append(logger->buffer, formatted_message);
+        pthread_mutex_lock(&logger->lock);
+        __atomic_store_n(&logger->sleeping, 1, __ATOMIC_SEQ_CST);
+        while (!logger->stop && !_nx_logger_ring_ready(logger)) {
+            pthread_cond_wait(&logger->wake, &logger->lock);
+        }
+        __atomic_store_n(&logger->sleeping, 0, __ATOMIC_RELAXED);
+        done = logger->stop && !_nx_logger_ring_ready(logger);
+        pthread_cond_broadcast(&logger->drained);
+        pthread_mutex_unlock(&logger->lock);
     }
 
-    nx_string_builder_append(logger->buffer, "\n");
+    nx_string_builder_destroy(out);
+    nx_string_builder_destroy(file_out);
+    nx_string_builder_destroy(line);
+    return NULL;
 }
 
 static void _nx_logger_write(NXLogger *logger, NXLogLevel level) {
     const char *message = nx_string_builder_to_cstring(logger->buffer);
+    bool        flush   = _nx_logger_should_flush(logger, level, 1);
 
     if (logger->use_stdout) {
         fprintf(stdout, "%s%s%s", NX_LOG_LEVEL_COLORS[level], message, COLOR_RESET);
-        fflush(stdout);
+        if (flush) {
+            fflush(stdout);
+        }
     }
 
     if (logger->file) {
-        fprintf(logger->file->file, "%s", message);
-        fflush(logger->file->file);
+        fwrite(message, 1, logger->buffer->length, logger->file->file);
+        if (flush) {
+            fflush(logger->file->file);
+        }
     }
 }
 
@@ -1779,15 +5954,80 @@ NXLogger *nx_logger_create(const char *filename, bool use_stdout, bool use_times
         }
     }
 
-    logger->use_stdout     = use_stdout;
-    logger->use_timestamps = use_timestamps;
-    logger->min_level      = min_level;
+    logger->use_stdout      = use_stdout;
+    logger->use_timestamps  = use_timestamps;
+    logger->min_level       = min_level;
+    logger->time_precision  = NX_LOG_TIME_SECONDS;
+    logger->cached_second   = 0;
+    logger->cached_time_len = 0;
+    logger->flush_policy    = NX_LOG_FLUSH_ALWAYS;
+    logger->flush_every     = 0;
+    logger->pending_lines   = 0;
+    logger->records         = NULL;
+    logger->overflow        = NX_LOG_OVERFLOW_BLOCK;
+    logger->deferred        = false;
+    logger->head            = 0;
+    logger->tail            = 0;
+    logger->dropped         = 0;
+    logger->sleeping        = 0;
+    logger->stop            = false;
+    clock_gettime(CLOCK_MONOTONIC, &logger->last_flush);
+
+    return logger;
+}
+
+/* Log calls only format into a ring, a background thread writes the lines out in batches */
+NXLogger *nx_logger_create_async(const char *filename, bool use_stdout, bool use_timestamps,
+                                 NXLogLevel min_level, NXLogOverflow overflow) {
+    size_t    i;
+    NXLogger *logger = nx_logger_create(filename, use_stdout, use_timestamps, min_level);
+    if (!logger) {
+        return NULL;
+    }
+
+    logger->records = (NXLogRecord *) nx_malloc(NX_LOG_RING_SIZE * sizeof(NXLogRecord));
+    if (!logger->records) {
+        nx_logger_destroy(logger);
+        return NULL;
+    }
+    for (i = 0; i < NX_LOG_RING_SIZE; i++) {
+        logger->records[i].sequence = i;
+    }
+    logger->overflow = overflow;
+
+    pthread_mutex_init(&logger->lock, NULL);
+    pthread_cond_init(&logger->wake, NULL);
+    pthread_cond_init(&logger->drained, NULL);
+    if (pthread_create(&logger->thread, NULL, _nx_logger_thread, logger) != 0) {
+        pthread_mutex_destroy(&logger->lock);
+        pthread_cond_destroy(&logger->wake);
+        pthread_cond_destroy(&logger->drained);
+        nx_free(logger->records);
+        logger->records = NULL;
+        nx_logger_destroy(logger);
+        return NULL;
+    }
 
     return logger;
 }
 
 void nx_logger_destroy(NXLogger *logger) {
     if (logger) {
+        if (logger->records) {
+            pthread_mutex_lock(&logger->lock);
+            logger->stop = true;
+            pthread_cond_signal(&logger->wake);
+            pthread_mutex_unlock(&logger->lock);
+            pthread_join(logger->thread, NULL);
+
+            pthread_mutex_destroy(&logger->lock);
+            pthread_cond_destroy(&logger->wake);
+            pthread_cond_destroy(&logger->drained);
+            nx_free(logger->records);
+        }
+        if (logger->use_stdout) {
+            fflush(stdout);
+        }
         if (logger->file) {
             nx_file_close(logger->file);
         }
@@ -1797,7 +6037,16 @@ void nx_logger_destroy(NXLogger *logger) {
 }
 
 void nx_logger_log(NXLogger *logger, NXLogLevel level, const char *format, ...) {
-    if (level >= logger->min_level) {
+    if (level < logger->min_level) {
+        return;
+    }
+
+    if (logger->records) {
+        va_list args;
+        va_start(args, format);
+        _nx_logger_enqueue(logger, level, format, args);
+        va_end(args);
+    } else {
         va_list args;
         va_start(args, format);
         _nx_logger_format_message(logger, level, format, args);
@@ -1805,6 +6054,71 @@ void nx_logger_log(NXLogger *logger, NXLogLevel level, const char *format, ...)
         _nx_logger_write(logger, level);
     }
 }
+
+/* Both settings are read by the async writer thread, so change them before logging */
+void nx_logger_set_time_precision(NXLogger *logger, NXLogTimePrecision precision) {
+    logger->time_precision = precision;
+}
+
+void nx_logger_set_flush_policy(NXLogger *logger, NXLogFlushPolicy policy, size_t every) {
+    logger->flush_policy  = policy;
+    logger->flush_every   = every;
+    logger->pending_lines = 0;
+    clock_gettime(CLOCK_MONOTONIC, &logger->last_flush);
+}
+
+/* Async loggers only. Formatting then happens on the writer thread, so format strings must outlive
+ * the logger and %n is not supported */
+void nx_logger_set_deferred(NXLogger *logger, bool deferred) {
+    logger->deferred = deferred && logger->records != NULL;
+}
+
+/* Returns once every line logged before the call has been handed to the OS */
+void nx_logger_flush(NXLogger *logger) {
+    if (logger->records) {
+        size_t target = nx_atomic_load(&logger->head);
+
+        pthread_mutex_lock(&logger->lock);
+        while (nx_atomic_load(&logger->tail) < target) {
+            pthread_cond_signal(&logger->wake);
+            pthread_cond_wait(&logger->drained, &logger->lock);
+        }
+        pthread_mutex_unlock(&logger->lock);
+    }
+
+    if (logger->use_stdout) {
+        fflush(stdout);
+    }
+    if (logger->file) {
+        fflush(logger->file->file);
+    }
+}
+/* }}} */
+
+/* Stats {{{ */
+#ifdef NX_STATS
+NXStats nx_stats;
+
+void nx_stats_dump(NXLogger *logger) {
+    NXStats s;
+    memcpy(&s, &nx_stats, sizeof(s));
+
+    nx_logger_info3(logger, "hashmap: %lu lookups, %lu probes, max probe %lu",
+                    (unsigned long) s.hashmap_lookups, (unsigned long) s.hashmap_probes,
+                    (unsigned long) s.hashmap_max_probe);
+    nx_logger_info2(logger, "hashmap: %lu resizes in %lu us", (unsigned long) s.hashmap_resizes,
+                    (unsigned long) s.hashmap_resize_usec);
+    nx_logger_info2(logger, "arena: %lu blocks, %lu bytes reserved", (unsigned long) s.arena_blocks,
+                    (unsigned long) s.arena_bytes_reserved);
+    nx_logger_info2(logger, "string builder: %lu reallocs, %lu bytes reserved",
+                    (unsigned long) s.string_builder_reallocs,
+                    (unsigned long) s.string_builder_bytes_reserved);
+}
+
+void nx_stats_reset(void) {
+    memset(&nx_stats, 0, sizeof(nx_stats));
+}
+#endif /* NX_STATS */
 /* }}} */
 
 #endif /* NEXUS_IMPLEMENTATION */
@@ -39,6 +39,23 @@
  *        Disables the inclusion of glad.h. This is useful if you want to
  *        use your own OpenGL loader.
  *
+ *    #define NXUI_BATCH_SEGMENTS
+ *        Sets how many frames of geometry an NXUIBatch buffers before it
+ *        waits for the GPU to finish reading the oldest one. Default is 3.
+ *
+ *    #define NXUI_PROFILER_LATENCY
+ *        Sets how many frames an NXUIProfiler keeps its timer queries in
+ *        flight before it drops a frame whose results aren't ready.
+ *        Default is 4.
+ *
+ *    #define NXUI_PROFILER_MAX_PASSES
+ *        Sets how many passes per frame an NXUIProfiler times. Default is
+ *        16.
+ *
+ *    #define NXUI_PROFILER_HISTORY
+ *        Sets over how many frames nxui_profiler_percentile is computed.
+ *        Default is 128.
+ *
  * ===== VERSIONING =======================================================
  * Version: 0.0.2
  * Release Date: 05-04-2025
@@ -75,16 +92,70 @@
 
 #include "nexus.h"
 
+#include <limits.h>
 #include <stddef.h>
 
 #ifndef NXUI_NO_GLAD
 #include "glad/glad.h"
 #endif
 
+#ifndef NXUI_BATCH_SEGMENTS
+#define NXUI_BATCH_SEGMENTS 3
+#endif
+
+#ifndef NXUI_PROFILER_LATENCY
+#define NXUI_PROFILER_LATENCY 4
+#endif
+
+#ifndef NXUI_PROFILER_MAX_PASSES
+#define NXUI_PROFILER_MAX_PASSES 16
+#endif
+
+#ifndef NXUI_PROFILER_HISTORY
+#define NXUI_PROFILER_HISTORY 128
+#endif
+
+typedef struct {
+    const char *name; /* arrays are stored without their [0] suffix */
+    size_t      hash;
+    GLint       location;
+    GLint       size;
+    GLenum      type;
+} NXUIUniform;
+
+/* The active uniforms are queried once after linking, so the setters never ask the driver.
+ * Copies share the uniforms table, so delete only one of them */
 typedef struct {
-    GLuint program_id;
+    GLuint       program_id;
+    NXUIUniform *uniforms;
+    size_t       uniform_count;
+    GLuint       shaders[2]; /* vertex and fragment shader while a begun program is linking */
+    size_t       binary_key; /* set when nxui_shader_program_finish should store the binary */
 } NXUIShaderProgram;
 
+/* glGetProgramBinary and friends are GL 4.1, so they are loaded through the loader passed to
+ * nxui_shader_cache_create instead of glad. Without them every program is compiled */
+typedef void(APIENTRYP NXUIGetProgramBinaryProc)(GLuint program, GLsizei buf_size,
+                                                 GLsizei *length, GLenum *format, void *binary);
+typedef void(APIENTRYP NXUIProgramBinaryProc)(GLuint program, GLenum format, const void *binary,
+                                              GLsizei length);
+typedef void(APIENTRYP NXUIProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void(APIENTRYP NXUIMaxShaderCompilerThreadsProc)(GLuint count);
+
+/* Program binaries on disk, one file per program named after a hash of both sources and the GL
+ * vendor, renderer and version strings, so a driver update misses instead of loading a stale
+ * binary */
+typedef struct {
+    char                     *directory;
+    size_t                    driver_hash;
+    NXUIGetProgramBinaryProc  get_program_binary;
+    NXUIProgramBinaryProc     program_binary;
+    NXUIProgramParameteriProc program_parameteri;
+    bool                      parallel; /* KHR/ARB_parallel_shader_compile is available */
+    size_t                    hits;
+    size_t                    misses;
+} NXUIShaderCache;
+
 typedef struct {
     GLenum             mode;
     GLuint             vao;
@@ -92,13 +163,114 @@ typedef struct {
     GLuint             ebo;
     int                index_count;
     NXUIShaderProgram *shader;
+    GLuint             instance_vbo;   /* per-instance attributes, see nxui_mesh_set_instances */
+    GLsizei            instance_count; /* 0 draws the mesh once without instancing */
 } NXUIMesh;
 
+/* The sort key packs the program, VAO and texture names, a third of the bits each. Names that
+ * don't fit only sort less tightly, the renderer compares the real state before binding */
+#define NXUI_DRAW_KEY_BITS ((sizeof(unsigned long) * CHAR_BIT) / 3)
+
+typedef struct {
+    GLuint  program;
+    GLuint  vao;
+    GLuint  texture; /* bound to GL_TEXTURE_2D, 0 for none */
+    GLenum  mode;
+    GLsizei count;
+    size_t  first;     /* first index in the element buffer */
+    GLsizei instances; /* drawn with glDrawElementsInstanced when above 1 */
+} NXUIDrawItem;
+
+typedef struct {
+    unsigned long key;
+    size_t        item;
+} NXUIDrawSortEntry;
+
+/* Collects the draws of one frame, nxui_draw_list_render sorts them by state and clears the list.
+ * Items with equal state keep their submission order */
+typedef struct {
+    NXUIDrawItem      *items;
+    NXUIDrawSortEntry *entries;
+    NXUIDrawSortEntry *scratch;
+    size_t             count;
+    size_t             capacity;
+    size_t             draw_calls;    /* of the last render */
+    size_t             state_changes; /* program, VAO and texture binds of the last render */
+} NXUIDrawList;
+
+typedef enum {
+    NXUI_PROFILE_CPU_MS = 0, /* from nxui_profiler_begin_frame to nxui_profiler_end_frame */
+    NXUI_PROFILE_GPU_MS,     /* sum of the frame's passes */
+    NXUI_PROFILE_DRAW_CALLS,
+    NXUI_PROFILE_TRIANGLES,
+    NXUI_PROFILE_STATE_CHANGES,
+    NXUI_PROFILE_BUFFER_UPLOADS,
+    NXUI_PROFILE_METRIC_COUNT
+} NXUIProfileMetric;
+
+typedef struct {
+    const char *name;
+    GLuint      query;
+} NXUIProfilePass;
+
+typedef struct {
+    NXUIProfilePass passes[NXUI_PROFILER_MAX_PASSES];
+    size_t          pass_count;
+    double          values[NXUI_PROFILE_METRIC_COUNT];
+    bool            pending; /* recorded, but its query results haven't been read yet */
+} NXUIProfileFrame;
+
+typedef struct {
+    const char *name;
+    double      ms;
+} NXUIProfilePassTime;
+
+/* Times render passes with GL_TIME_ELAPSED queries from a ring of NXUI_PROFILER_LATENCY frames.
+ * Results are read NXUI_PROFILER_LATENCY - 1 frames late at most, and only once available, so
+ * profiling never stalls the pipeline */
+typedef struct {
+    NXUIProfileFrame    frames[NXUI_PROFILER_LATENCY];
+    size_t              frame; /* slot of the frame being recorded */
+    bool                in_pass;
+    struct timespec     cpu_start;
+    double              history[NXUI_PROFILE_METRIC_COUNT][NXUI_PROFILER_HISTORY];
+    size_t              history_count;
+    size_t              history_next;
+    NXUIProfilePassTime last_passes[NXUI_PROFILER_MAX_PASSES]; /* of the last collected frame */
+    size_t              last_pass_count;
+    size_t              dropped_frames;
+} NXUIProfiler;
+
+/* Shaders of a context are stored in chunks of this many, so they never move */
+#define NXUI_SHADER_CHUNK_SIZE 32
+#define NXUI_NO_SLOT           ((size_t) -1)
+
+/* Refers to a mesh of an NXUIContext. It goes stale once the mesh is removed, even when its slot
+ * is reused by a later mesh. A zeroed handle never refers to a mesh */
+typedef struct {
+    unsigned int index;
+    unsigned int generation;
+} NXUIMeshHandle;
+
+typedef struct {
+    size_t       index; /* into meshes while live, the next free slot otherwise */
+    unsigned int generation;
+} NXUIMeshSlot;
+
+/* Meshes are kept dense in meshes[0..mesh_count) and may move whenever one is added or removed,
+ * an NXUIMeshHandle stays valid until its own mesh is removed */
 typedef struct {
-    NXUIShaderProgram *shaders;
-    size_t             shader_count;
-    NXUIMesh          *meshes;
-    size_t             mesh_count;
+    NXUIShaderProgram **shader_chunks;
+    size_t              shader_chunk_capacity;
+    size_t              shader_count;
+    NXUIMesh           *meshes;
+    size_t             *mesh_slots; /* the slot of each mesh, parallel to meshes */
+    size_t              mesh_count;
+    size_t              mesh_capacity; /* of meshes, mesh_slots and slots */
+    NXUIMeshSlot       *slots;
+    size_t              slot_count;
+    size_t              free_slot; /* NXUI_NO_SLOT when no slot is free */
+    NXUIDrawList       *draw_list;
 } NXUIContext;
 
 typedef struct {
@@ -110,22 +282,103 @@ typedef struct {
     const void *offset;
 } NXUIAttribute;
 
-NXUIContext *nxui_context_init(void);
-void         nxui_context_add_shader(NXUIContext *context, NXUIShaderProgram shader);
-void         nxui_context_add_mesh(NXUIContext *context, NXUIMesh mesh);
-void         nxui_context_destroy(NXUIContext *context);
-void         nxui_render_ui(NXUIContext *context);
+/* The vertex layout of NXUIBatch: position at attribute 0, uv at 1 and color at 2 */
+typedef struct {
+    float position[2];
+    float uv[2];
+    float color[4];
+} NXUIVertex;
+
+/* Immediate-mode geometry streamed through one big vertex and index buffer. The buffers are split
+ * in NXUI_BATCH_SEGMENTS segments, each frame writes its own segment through an unsynchronized
+ * glMapBufferRange and fences it when it ends, so writing never waits on the GPU unless it was
+ * still reading the segment from NXUI_BATCH_SEGMENTS frames ago. Geometry sharing a program and
+ * texture goes out in a single draw */
+typedef struct {
+    GLuint        vao;
+    GLuint        vbo;
+    GLuint        ebo;
+    size_t        segment_vertices;
+    size_t        segment_indices;
+    size_t        segment;
+    GLsync        fences[NXUI_BATCH_SEGMENTS];
+    NXUIVertex   *vertices; /* mapped from draw_vertex to the end of the segment, or NULL */
+    unsigned int *indices;  /* mapped from draw_index to the end of the segment, or NULL */
+    size_t        vertex_used;
+    size_t        index_used;
+    size_t        draw_vertex; /* start of the geometry that has not been drawn yet */
+    size_t        draw_index;
+    GLuint        program;
+    GLuint        texture;
+    size_t        draw_calls; /* of the current frame */
+} NXUIBatch;
+
+NXUIContext       *nxui_context_init(void);
+NXUIShaderProgram *nxui_context_add_shader(NXUIContext *context, NXUIShaderProgram shader);
+void               nxui_context_add_shaders(NXUIContext *context, const NXUIShaderProgram *shaders,
+                                            size_t count, NXUIShaderProgram **added);
+NXUIShaderProgram *nxui_context_shader(const NXUIContext *context, size_t index);
+NXUIMeshHandle     nxui_context_add_mesh(NXUIContext *context, NXUIMesh mesh);
+void               nxui_context_add_meshes(NXUIContext *context, const NXUIMesh *meshes,
+                                           size_t count, NXUIMeshHandle *handles);
+NXUIMesh          *nxui_context_mesh(const NXUIContext *context, NXUIMeshHandle handle);
+bool               nxui_context_remove_mesh(NXUIContext *context, NXUIMeshHandle handle);
+void               nxui_context_destroy(NXUIContext *context);
+void               nxui_render_ui(NXUIContext *context);
+
+NXUIDrawList *nxui_draw_list_create(void);
+void          nxui_draw_list_destroy(NXUIDrawList *list);
+void          nxui_draw_list_clear(NXUIDrawList *list);
+void          nxui_draw_list_submit(NXUIDrawList *list, const NXUIShaderProgram *shader, GLuint vao,
+                                    GLuint texture, GLenum mode, GLsizei count, size_t first);
+void          nxui_draw_list_submit_instanced(NXUIDrawList *list, const NXUIShaderProgram *shader,
+                                              GLuint vao, GLuint texture, GLenum mode,
+                                              GLsizei count, size_t first, GLsizei instances);
+void          nxui_draw_list_submit_mesh(NXUIDrawList *list, const NXUIMesh *mesh, GLuint texture);
+void          nxui_draw_list_sort(NXUIDrawList *list);
+void          nxui_draw_list_render(NXUIDrawList *list);
 
 NXUIShaderProgram nxui_create_shader_program_from_files(const char *vertex_path,
                                                         const char *fragment_path);
 NXUIShaderProgram nxui_create_shader_program(const char *vertex_source,
                                              const char *fragment_source);
+NXUIShaderProgram nxui_shader_program_begin(NXUIShaderCache *cache, const char *vertex_source,
+                                            const char *fragment_source);
+bool              nxui_shader_program_ready(const NXUIShaderCache *cache,
+                                            const NXUIShaderProgram *shader);
+void              nxui_shader_program_finish(NXUIShaderCache *cache, NXUIShaderProgram *shader);
 void              nxui_use_shader_program(NXUIShaderProgram *shader);
 void              nxui_delete_shader_program(NXUIShaderProgram *shader);
 
+NXUIShaderCache  *nxui_shader_cache_create(const char *directory, GLADloadproc load);
+void              nxui_shader_cache_destroy(NXUIShaderCache *cache);
+NXUIShaderProgram nxui_create_shader_program_cached(NXUIShaderCache *cache,
+                                                    const char *vertex_source,
+                                                    const char *fragment_source);
+NXUIShaderProgram nxui_create_shader_program_from_files_cached(NXUIShaderCache *cache,
+                                                               const char *vertex_path,
+                                                               const char *fragment_path);
+
 NXUIMesh nxui_create_mesh(const void *vertex_data, size_t vertex_size, const unsigned int *indices,
                           size_t index_size, int attribute_count, const NXUIAttribute *attributes,
                           GLenum usage);
+void     nxui_mesh_set_instances(NXUIMesh *mesh, const void *instance_data, size_t instance_size,
+                                 GLsizei instance_count, int attribute_count,
+                                 const NXUIAttribute *attributes, GLenum usage);
+
+NXUIBatch *nxui_batch_create(size_t max_vertices, size_t max_indices);
+void       nxui_batch_destroy(NXUIBatch *batch);
+void       nxui_batch_set_state(NXUIBatch *batch, const NXUIShaderProgram *shader, GLuint texture);
+void       nxui_batch_push(NXUIBatch *batch, const NXUIVertex *vertices, size_t vertex_count,
+                           const unsigned int *indices, size_t index_count);
+void       nxui_batch_triangle(NXUIBatch *batch, const NXUIVertex vertices[3]);
+void       nxui_batch_quad(NXUIBatch *batch, const NXUIVertex vertices[4]);
+void       nxui_batch_rect(NXUIBatch *batch, float x, float y, float width, float height,
+                           const float color[4]);
+void       nxui_batch_flush(NXUIBatch *batch);
+size_t     nxui_batch_end(NXUIBatch *batch);
+
+GLint nxui_uniform_location(const NXUIShaderProgram *shader, const char *name);
 
 void nxui_set_uniform_float(NXUIShaderProgram *shader, const char *name, float value);
 void nxui_set_uniform_int(NXUIShaderProgram *shader, const char *name, int value);
@@ -134,10 +387,50 @@ void nxui_set_uniform_vec3(NXUIShaderProgram *shader, const char *name, float x,
 void nxui_set_uniform_vec4(NXUIShaderProgram *shader, const char *name, float x, float y, float z,
                            float w);
 
+/* Setters for a location from nxui_uniform_location, they apply to the program in use */
+void nxui_set_uniform_float_loc(GLint location, float value);
+void nxui_set_uniform_int_loc(GLint location, int value);
+void nxui_set_uniform_vec2_loc(GLint location, float x, float y);
+void nxui_set_uniform_vec3_loc(GLint location, float x, float y, float z);
+void nxui_set_uniform_vec4_loc(GLint location, float x, float y, float z, float w);
+
+NXUIProfiler *nxui_profiler_create(void);
+void          nxui_profiler_destroy(NXUIProfiler *profiler);
+void          nxui_profiler_begin_frame(NXUIProfiler *profiler);
+void          nxui_profiler_end_frame(NXUIProfiler *profiler);
+void          nxui_profiler_begin_pass(NXUIProfiler *profiler, const char *name);
+void          nxui_profiler_end_pass(NXUIProfiler *profiler);
+double        nxui_profiler_percentile(const NXUIProfiler *profiler, NXUIProfileMetric metric,
+                                       double percentile);
+void          nxui_profiler_log(const NXUIProfiler *profiler, NXLogger *logger);
+
 void nxui_clear(float r, float g, float b, float a);
 #endif /* NXUI_H */
 
 #ifdef NXUI_IMPLEMENTATION
+/* The profiler between nxui_profiler_begin_frame and nxui_profiler_end_frame, if any */
+static NXUIProfiler *_nxui_profiler = NULL;
+
+static void _nxui_profile_count(NXUIProfileMetric metric, double amount) {
+    if (_nxui_profiler) {
+        _nxui_profiler->frames[_nxui_profiler->frame].values[metric] += amount;
+    }
+}
+
+static void _nxui_profile_draw(GLenum mode, GLsizei count, GLsizei instances) {
+    double triangles = 0.0;
+    if (!_nxui_profiler) {
+        return;
+    }
+    if (mode == GL_TRIANGLES) {
+        triangles = (double) (count / 3);
+    } else if ((mode == GL_TRIANGLE_STRIP || mode == GL_TRIANGLE_FAN) && count > 2) {
+        triangles = (double) (count - 2);
+    }
+    _nxui_profile_count(NXUI_PROFILE_DRAW_CALLS, 1.0);
+    _nxui_profile_count(NXUI_PROFILE_TRIANGLES, triangles * (double) instances);
+}
+
 static char *_nxui_read_shader_source(const char *file_path) {
     char *source = nx_file_read_all(file_path);
     if (!source) {
@@ -146,13 +439,17 @@ static char *_nxui_read_shader_source(const char *file_path) {
     return source;
 }
 
+/* Status checks wait for the compile, so they are left to _nxui_check_shader */
 static GLuint _nxui_compile_shader(const char *source, GLenum shader_type) {
-    GLuint shader;
-    GLint  success;
-    char   infoLog[512];
-    shader = glCreateShader(shader_type);
+    GLuint shader = glCreateShader(shader_type);
     glShaderSource(shader, 1, &source, NULL);
     glCompileShader(shader);
+    return shader;
+}
+
+static void _nxui_check_shader(GLuint shader, GLenum shader_type) {
+    GLint success;
+    char  infoLog[512];
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success) {
         glGetShaderInfoLog(shader, 512, NULL, infoLog);
@@ -164,7 +461,6 @@ static GLuint _nxui_compile_shader(const char *source, GLenum shader_type) {
             nx_die1("Unknown shader type compilation failed:\n%s", infoLog);
         }
     }
-    return shader;
 }
 
 static GLuint _nxui_create_vao(void) {
@@ -185,6 +481,7 @@ static GLuint _nxui_create_vbo(const void *data, size_t size, GLenum usage) {
     }
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
     glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) size, data, usage);
+    _nxui_profile_count(NXUI_PROFILE_BUFFER_UPLOADS, 1.0);
     return vbo;
 }
 
@@ -196,41 +493,324 @@ static GLuint _nxui_create_ebo(const void *data, size_t size, GLenum usage) {
     }
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr) size, data, usage);
+    _nxui_profile_count(NXUI_PROFILE_BUFFER_UPLOADS, 1.0);
     return ebo;
 }
 
-NXUIShaderProgram nxui_create_shader_program(const char *vertex_source,
-                                             const char *fragment_source) {
+/* One allocation holds the table followed by the names. Uniforms without a location, like the
+ * members of uniform blocks, are left out */
+static void _nxui_query_uniforms(NXUIShaderProgram *shader) {
+    GLint  count, max_length, length, size;
+    GLenum type;
+    GLint  i;
+    char  *names;
+
+    shader->uniforms      = NULL;
+    shader->uniform_count = 0;
+
+    glGetProgramiv(shader->program_id, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(shader->program_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+    if (count <= 0 || max_length <= 0) {
+        return;
+    }
+
+    shader->uniforms = nx_malloc((size_t) count * (sizeof(NXUIUniform) + (size_t) max_length));
+    if (!shader->uniforms) {
+        nx_die("Failed to allocate memory for uniforms");
+    }
+    names = (char *) (shader->uniforms + count);
+
+    for (i = 0; i < count; i++) {
+        NXUIUniform *uniform = &shader->uniforms[shader->uniform_count];
+        length               = 0;
+        glGetActiveUniform(shader->program_id, (GLuint) i, max_length, &length, &size, &type,
+                           names);
+        uniform->location = glGetUniformLocation(shader->program_id, names);
+        if (uniform->location == -1) {
+            continue;
+        }
+        if (length > 3 && strcmp(names + length - 3, "[0]") == 0) {
+            length -= 3;
+            names[length] = '\0';
+        }
+        uniform->name = names;
+        uniform->hash = nx_hash_bytes(names, (size_t) length);
+        uniform->size = size;
+        uniform->type = type;
+        shader->uniform_count++;
+        names += length + 1;
+    }
+}
+
+#define NXUI_GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define NXUI_GL_PROGRAM_BINARY_LENGTH 0x8741
+#define NXUI_GL_COMPLETION_STATUS 0x91B1
+#define NXUI_GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+
+static void *_nxui_load_proc(GLADloadproc load, const char *name, const char *fallback) {
+    void *address = load(name);
+    return address ? address : load(fallback);
+}
+
+NXUIShaderCache *nxui_shader_cache_create(const char *directory, GLADloadproc load) {
+    NXUIShaderCache *cache = nx_malloc(sizeof(NXUIShaderCache));
+    NXStringBuilder *driver;
+    void            *address;
+    bool             binaries = false;
+    GLint            count    = 0;
+    GLint            major    = 0;
+    GLint            minor    = 0;
+    GLint            formats  = 0;
+    GLint            i;
+
+    if (!cache) {
+        nx_die("Failed to allocate NXUIShaderCache");
+    }
+    if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+        nx_die1("Failed to create shader cache directory: %s", directory);
+    }
+    cache->directory = nx_malloc(strlen(directory) + 1);
+    if (!cache->directory) {
+        nx_die("Failed to allocate NXUIShaderCache");
+    }
+    strcpy(cache->directory, directory);
+    cache->hits     = 0;
+    cache->misses   = 0;
+    cache->parallel = false;
+
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (i = 0; i < count; i++) {
+        const char *extension = (const char *) glGetStringi(GL_EXTENSIONS, (GLuint) i);
+        if (strcmp(extension, "GL_KHR_parallel_shader_compile") == 0 ||
+            strcmp(extension, "GL_ARB_parallel_shader_compile") == 0) {
+            cache->parallel = true;
+        } else if (strcmp(extension, "GL_ARB_get_program_binary") == 0) {
+            binaries = true;
+        }
+    }
+
+    /* GLX hands out stubs for any name, so a loaded proc alone says nothing about support */
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (binaries || major > 4 || (major == 4 && minor >= 1)) {
+        glGetIntegerv(NXUI_GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    }
+    cache->get_program_binary = NULL;
+    cache->program_binary     = NULL;
+    cache->program_parameteri = NULL;
+    if (formats > 0) {
+        /* memcpy because ISO C has no conversion from void * to a function pointer */
+        address = load("glGetProgramBinary");
+        memcpy(&cache->get_program_binary, &address, sizeof(address));
+        address = load("glProgramBinary");
+        memcpy(&cache->program_binary, &address, sizeof(address));
+        address = load("glProgramParameteri");
+        memcpy(&cache->program_parameteri, &address, sizeof(address));
+    }
+    if (cache->parallel) {
+        NXUIMaxShaderCompilerThreadsProc max_threads;
+        address = _nxui_load_proc(load, "glMaxShaderCompilerThreadsKHR",
+                                  "glMaxShaderCompilerThreadsARB");
+        memcpy(&max_threads, &address, sizeof(address));
+        if (max_threads) {
+            max_threads(0xFFFFFFFFu); /* let the driver pick */
+        }
+    }
+
+    driver = nx_string_builder_create();
+    nx_string_builder_append(driver, (const char *) glGetString(GL_VENDOR));
+    nx_string_builder_append_char(driver, '\n');
+    nx_string_builder_append(driver, (const char *) glGetString(GL_RENDERER));
+    nx_string_builder_append_char(driver, '\n');
+    nx_string_builder_append(driver, (const char *) glGetString(GL_VERSION));
+    cache->driver_hash = nx_hash_bytes(driver->buffer, driver->length);
+    nx_string_builder_destroy(driver);
+    return cache;
+}
+
+void nxui_shader_cache_destroy(NXUIShaderCache *cache) {
+    if (cache) {
+        nx_free(cache->directory);
+        nx_free(cache);
+    }
+}
+
+static size_t _nxui_shader_cache_key(const NXUIShaderCache *cache, const char *vertex_source,
+                                     const char *fragment_source) {
+    size_t key = cache->driver_hash;
+    key        = key * 31 + nx_hash_bytes(vertex_source, strlen(vertex_source));
+    key        = key * 31 + nx_hash_bytes(fragment_source, strlen(fragment_source));
+    return key ? key : 1;
+}
+
+static char *_nxui_shader_cache_path(const NXUIShaderCache *cache, size_t key) {
+    NXStringBuilder *path = nx_string_builder_create();
+    nx_string_builder_appendf(path, "%s/%lx.bin", cache->directory, (unsigned long) key);
+    return nx_string_builder_detach(path);
+}
+
+/* Files hold the binary format followed by the binary */
+static bool _nxui_shader_cache_load(NXUIShaderCache *cache, GLuint program, size_t key) {
+    NXFileMap *map;
+    char      *path;
+    GLenum     format;
+    GLint      success = 0;
+
+    if (!cache->program_binary) {
+        return false;
+    }
+    path = _nxui_shader_cache_path(cache, key);
+    map  = nx_file_map(path, 0);
+    nx_free(path);
+    if (!map) {
+        return false;
+    }
+    if (map->length > sizeof(GLenum)) {
+        memcpy(&format, map->data, sizeof(GLenum));
+        cache->program_binary(program, format, map->data + sizeof(GLenum),
+                              (GLsizei) (map->length - sizeof(GLenum)));
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+    }
+    nx_file_unmap(map);
+    return success != 0;
+}
+
+static void _nxui_shader_cache_store(NXUIShaderCache *cache, GLuint program, size_t key) {
+    NXFileBuffer buffers[2];
+    GLint        length  = 0;
+    GLsizei      written = 0;
+    GLenum       format  = 0;
+    char        *binary;
+    char        *path;
+
+    if (!cache->get_program_binary) {
+        return;
+    }
+    glGetProgramiv(program, NXUI_GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) {
+        return;
+    }
+    binary = nx_malloc((size_t) length);
+    if (!binary) {
+        return;
+    }
+    cache->get_program_binary(program, length, &written, &format, binary);
+    if (written > 0) {
+        buffers[0].data   = &format;
+        buffers[0].length = sizeof(format);
+        buffers[1].data   = binary;
+        buffers[1].length = (size_t) written;
+        path              = _nxui_shader_cache_path(cache, key);
+        nx_file_writev(path, buffers, 2, NX_FILE_WRITE_ATOMIC);
+        nx_free(path);
+    }
+    nx_free(binary);
+}
+
+/* Issues the compile and link without waiting on either, so the driver can work on several
+ * programs at once. A cache hit is linked from its binary right away. cache may be NULL */
+NXUIShaderProgram nxui_shader_program_begin(NXUIShaderCache *cache, const char *vertex_source,
+                                            const char *fragment_source) {
     NXUIShaderProgram shader_program;
-    GLuint            vertex_shader, fragment_shader;
-    GLint             success;
-    char              infoLog[512];
-    vertex_shader             = _nxui_compile_shader(vertex_source, GL_VERTEX_SHADER);
-    fragment_shader           = _nxui_compile_shader(fragment_source, GL_FRAGMENT_SHADER);
-    shader_program.program_id = glCreateProgram();
-    glAttachShader(shader_program.program_id, vertex_shader);
-    glAttachShader(shader_program.program_id, fragment_shader);
+
+    shader_program.program_id    = glCreateProgram();
+    shader_program.uniforms      = NULL;
+    shader_program.uniform_count = 0;
+    shader_program.shaders[0]    = 0;
+    shader_program.shaders[1]    = 0;
+    shader_program.binary_key    = 0;
+
+    if (cache) {
+        size_t key = _nxui_shader_cache_key(cache, vertex_source, fragment_source);
+        if (_nxui_shader_cache_load(cache, shader_program.program_id, key)) {
+            cache->hits++;
+            return shader_program;
+        }
+        cache->misses++;
+        shader_program.binary_key = key;
+        if (cache->program_parameteri && cache->get_program_binary) {
+            cache->program_parameteri(shader_program.program_id,
+                                      NXUI_GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+    }
+
+    shader_program.shaders[0] = _nxui_compile_shader(vertex_source, GL_VERTEX_SHADER);
+    shader_program.shaders[1] = _nxui_compile_shader(fragment_source, GL_FRAGMENT_SHADER);
+    glAttachShader(shader_program.program_id, shader_program.shaders[0]);
+    glAttachShader(shader_program.program_id, shader_program.shaders[1]);
     glLinkProgram(shader_program.program_id);
-    glGetProgramiv(shader_program.program_id, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(shader_program.program_id, 512, NULL, infoLog);
-        nx_die1("Shader program linking failed:\n%s", infoLog);
+    return shader_program;
+}
+
+/* Whether nxui_shader_program_finish would return without blocking. Always true without
+ * parallel shader compile, there is no way to ask then */
+bool nxui_shader_program_ready(const NXUIShaderCache *cache, const NXUIShaderProgram *shader) {
+    GLint done = GL_TRUE;
+    if (cache && cache->parallel && shader->shaders[0]) {
+        glGetProgramiv(shader->program_id, NXUI_GL_COMPLETION_STATUS, &done);
+    }
+    return done != GL_FALSE;
+}
+
+/* Waits for the link, dies on compile or link errors like nxui_create_shader_program and stores
+ * the binary of a cache miss */
+void nxui_shader_program_finish(NXUIShaderCache *cache, NXUIShaderProgram *shader) {
+    GLint success;
+    char  infoLog[512];
+
+    if (shader->shaders[0]) {
+        _nxui_check_shader(shader->shaders[0], GL_VERTEX_SHADER);
+        _nxui_check_shader(shader->shaders[1], GL_FRAGMENT_SHADER);
+        glGetProgramiv(shader->program_id, GL_LINK_STATUS, &success);
+        if (!success) {
+            glGetProgramInfoLog(shader->program_id, 512, NULL, infoLog);
+            nx_die1("Shader program linking failed:\n%s", infoLog);
+        }
+        glDetachShader(shader->program_id, shader->shaders[0]);
+        glDetachShader(shader->program_id, shader->shaders[1]);
+        glDeleteShader(shader->shaders[0]);
+        glDeleteShader(shader->shaders[1]);
+        shader->shaders[0] = 0;
+        shader->shaders[1] = 0;
+    }
+    if (cache && shader->binary_key) {
+        _nxui_shader_cache_store(cache, shader->program_id, shader->binary_key);
     }
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
+    shader->binary_key = 0;
+    _nxui_query_uniforms(shader);
+}
+
+NXUIShaderProgram nxui_create_shader_program_cached(NXUIShaderCache *cache,
+                                                    const char *vertex_source,
+                                                    const char *fragment_source) {
+    NXUIShaderProgram shader_program =
+        nxui_shader_program_begin(cache, vertex_source, fragment_source);
+    nxui_shader_program_finish(cache, &shader_program);
     return shader_program;
 }
 
-NXUIShaderProgram nxui_create_shader_program_from_files(const char *vertex_path,
-                                                        const char *fragment_path) {
+NXUIShaderProgram nxui_create_shader_program(const char *vertex_source,
+                                             const char *fragment_source) {
+    return nxui_create_shader_program_cached(NULL, vertex_source, fragment_source);
+}
+
+NXUIShaderProgram nxui_create_shader_program_from_files_cached(NXUIShaderCache *cache,
+                                                               const char *vertex_path,
+                                                               const char *fragment_path) {
     char             *vertex_source   = _nxui_read_shader_source(vertex_path);
     char             *fragment_source = _nxui_read_shader_source(fragment_path);
-    NXUIShaderProgram shader_program  = nxui_create_shader_program(vertex_source, fragment_source);
+    NXUIShaderProgram shader_program =
+        nxui_create_shader_program_cached(cache, vertex_source, fragment_source);
     nx_free(vertex_source);
     nx_free(fragment_source);
     return shader_program;
 }
 
+NXUIShaderProgram nxui_create_shader_program_from_files(const char *vertex_path,
+                                                        const char *fragment_path) {
+    return nxui_create_shader_program_from_files_cached(NULL, vertex_path, fragment_path);
+}
+
 void nxui_use_shader_program(NXUIShaderProgram *shader) {
     glUseProgram(shader->program_id);
 }
@@ -240,6 +820,9 @@ void nxui_delete_shader_program(NXUIShaderProgram *shader) {
         glDeleteProgram(shader->program_id);
         shader->program_id = 0;
     }
+    nx_free(shader->uniforms);
+    shader->uniforms      = NULL;
+    shader->uniform_count = 0;
 }
 
 NXUIMesh nxui_create_mesh(const void *vertex_data, size_t vertex_size, const unsigned int *indices,
@@ -285,7 +868,9 @@ NXUIMesh nxui_create_mesh(const void *vertex_data, size_t vertex_size, const uns
     }
 
     glBindVertexArray(0);
-    mesh.shader = NULL;
+    mesh.shader         = NULL;
+    mesh.instance_vbo   = 0;
+    mesh.instance_count = 0;
 
     if (auto_indices) {
         nx_free(auto_indices);
@@ -294,35 +879,412 @@ NXUIMesh nxui_create_mesh(const void *vertex_data, size_t vertex_size, const uns
     return mesh;
 }
 
+/* The first call creates the instance buffer and sets up its attributes with a divisor of 1, later
+ * calls orphan and refill it, the attributes are only used the first time */
+void nxui_mesh_set_instances(NXUIMesh *mesh, const void *instance_data, size_t instance_size,
+                             GLsizei instance_count, int attribute_count,
+                             const NXUIAttribute *attributes, GLenum usage) {
+    int i;
+
+    if (mesh->instance_vbo) {
+        glBindBuffer(GL_ARRAY_BUFFER, mesh->instance_vbo);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) instance_size, NULL, usage);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, (GLsizeiptr) instance_size, instance_data);
+        _nxui_profile_count(NXUI_PROFILE_BUFFER_UPLOADS, 1.0);
+    } else {
+        glBindVertexArray(mesh->vao);
+        mesh->instance_vbo = _nxui_create_vbo(instance_data, instance_size, usage);
+        for (i = 0; i < attribute_count; i++) {
+            glEnableVertexAttribArray(attributes[i].index);
+            glVertexAttribPointer(attributes[i].index, attributes[i].size, attributes[i].type,
+                                  attributes[i].normalized, attributes[i].stride,
+                                  attributes[i].offset);
+            glVertexAttribDivisor(attributes[i].index, 1);
+        }
+        glBindVertexArray(0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    mesh->instance_count = instance_count;
+}
+
+NXUIBatch *nxui_batch_create(size_t max_vertices, size_t max_indices) {
+    NXUIBatch *batch = nx_malloc(sizeof(NXUIBatch));
+    size_t     i;
+
+    if (!batch) {
+        nx_die("Failed to allocate NXUIBatch");
+    }
+
+    batch->segment_vertices = max_vertices;
+    batch->segment_indices  = max_indices;
+    batch->segment          = 0;
+    batch->vertices         = NULL;
+    batch->indices          = NULL;
+    batch->vertex_used      = 0;
+    batch->index_used       = 0;
+    batch->draw_vertex      = 0;
+    batch->draw_index       = 0;
+    batch->program          = 0;
+    batch->texture          = 0;
+    batch->draw_calls       = 0;
+    for (i = 0; i < NXUI_BATCH_SEGMENTS; i++) {
+        batch->fences[i] = NULL;
+    }
+
+    batch->vao = _nxui_create_vao();
+    batch->vbo = _nxui_create_vbo(NULL, NXUI_BATCH_SEGMENTS * max_vertices * sizeof(NXUIVertex),
+                                  GL_STREAM_DRAW);
+    batch->ebo = _nxui_create_ebo(NULL, NXUI_BATCH_SEGMENTS * max_indices * sizeof(unsigned int),
+                                  GL_STREAM_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(NXUIVertex), (void *) 0);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(NXUIVertex),
+                          (void *) (2 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(NXUIVertex),
+                          (void *) (4 * sizeof(float)));
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return batch;
+}
+
+static void _nxui_batch_unmap(NXUIBatch *batch) {
+    if (batch->vertices) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch->vbo);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, batch->ebo);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        batch->vertices = NULL;
+        batch->indices  = NULL;
+    }
+}
+
+void nxui_batch_destroy(NXUIBatch *batch) {
+    size_t i;
+    if (!batch) {
+        return;
+    }
+    _nxui_batch_unmap(batch);
+    for (i = 0; i < NXUI_BATCH_SEGMENTS; i++) {
+        if (batch->fences[i]) {
+            glDeleteSync(batch->fences[i]);
+        }
+    }
+    glDeleteVertexArrays(1, &batch->vao);
+    glDeleteBuffers(1, &batch->vbo);
+    glDeleteBuffers(1, &batch->ebo);
+    nx_free(batch);
+}
+
+/* GL_COPY_WRITE_BUFFER is used for mapping so the element buffer binding of whatever VAO happens
+ * to be bound is left alone. Nothing the GPU may still read is mapped, which is what makes
+ * GL_MAP_UNSYNCHRONIZED_BIT safe */
+static void _nxui_batch_map(NXUIBatch *batch) {
+    const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+                              GL_MAP_INVALIDATE_RANGE_BIT;
+    size_t           vertex_start = batch->segment * batch->segment_vertices + batch->draw_vertex;
+    size_t           index_start  = batch->segment * batch->segment_indices + batch->draw_index;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, batch->vbo);
+    batch->vertices = glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, (GLintptr) (vertex_start * sizeof(NXUIVertex)),
+        (GLsizeiptr) ((batch->segment_vertices - batch->draw_vertex) * sizeof(NXUIVertex)),
+        access);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, batch->ebo);
+    batch->indices = glMapBufferRange(
+        GL_COPY_WRITE_BUFFER, (GLintptr) (index_start * sizeof(unsigned int)),
+        (GLsizeiptr) ((batch->segment_indices - batch->draw_index) * sizeof(unsigned int)),
+        access);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    _nxui_profile_count(NXUI_PROFILE_BUFFER_UPLOADS, 2.0);
+
+    if (!batch->vertices || !batch->indices) {
+        nx_die("Failed to map the batch buffers");
+    }
+}
+
+/* Draws everything pushed since the last flush with the current program and texture */
+void nxui_batch_flush(NXUIBatch *batch) {
+    size_t index_count = batch->index_used - batch->draw_index;
+    size_t first_index = batch->segment * batch->segment_indices + batch->draw_index;
+
+    _nxui_batch_unmap(batch);
+    if (index_count == 0) {
+        return;
+    }
+
+    glUseProgram(batch->program);
+    glBindVertexArray(batch->vao);
+    _nxui_profile_count(NXUI_PROFILE_STATE_CHANGES, 2.0);
+    if (batch->texture) {
+        glBindTexture(GL_TEXTURE_2D, batch->texture);
+        _nxui_profile_count(NXUI_PROFILE_STATE_CHANGES, 1.0);
+    }
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES, (GLsizei) index_count, GL_UNSIGNED_INT,
+        (const void *) (first_index * sizeof(unsigned int)),
+        (GLint) (batch->segment * batch->segment_vertices + batch->draw_vertex));
+    _nxui_profile_draw(GL_TRIANGLES, (GLsizei) index_count, 1);
+    glBindVertexArray(0);
+
+    batch->draw_vertex = batch->vertex_used;
+    batch->draw_index  = batch->index_used;
+    batch->draw_calls++;
+}
+
+/* Fences the current segment and waits until the GPU is done with the next one */
+static void _nxui_batch_next_segment(NXUIBatch *batch) {
+    GLsync fence;
+
+    nxui_batch_flush(batch);
+    batch->fences[batch->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    batch->segment                = (batch->segment + 1) % NXUI_BATCH_SEGMENTS;
+
+    fence = batch->fences[batch->segment];
+    if (fence) {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) ==
+               GL_TIMEOUT_EXPIRED) {
+        }
+        glDeleteSync(fence);
+        batch->fences[batch->segment] = NULL;
+    }
+
+    batch->vertex_used = 0;
+    batch->index_used  = 0;
+    batch->draw_vertex = 0;
+    batch->draw_index  = 0;
+}
+
+/* Changing state flushes what was pushed with the previous one */
+void nxui_batch_set_state(NXUIBatch *batch, const NXUIShaderProgram *shader, GLuint texture) {
+    if (shader->program_id != batch->program || texture != batch->texture) {
+        nxui_batch_flush(batch);
+        batch->program = shader->program_id;
+        batch->texture = texture;
+    }
+}
+
+/* indices are relative to vertices */
+void nxui_batch_push(NXUIBatch *batch, const NXUIVertex *vertices, size_t vertex_count,
+                     const unsigned int *indices, size_t index_count) {
+    size_t base;
+    size_t i;
+
+    if (vertex_count > batch->segment_vertices || index_count > batch->segment_indices) {
+        nx_die("Geometry does not fit in a batch segment");
+    }
+    if (batch->vertex_used + vertex_count > batch->segment_vertices ||
+        batch->index_used + index_count > batch->segment_indices) {
+        _nxui_batch_next_segment(batch);
+    }
+    if (!batch->vertices) {
+        _nxui_batch_map(batch);
+    }
+
+    base = batch->vertex_used - batch->draw_vertex;
+    memcpy(batch->vertices + base, vertices, vertex_count * sizeof(NXUIVertex));
+    for (i = 0; i < index_count; i++) {
+        batch->indices[batch->index_used - batch->draw_index + i] =
+            (unsigned int) base + indices[i];
+    }
+    batch->vertex_used += vertex_count;
+    batch->index_used += index_count;
+}
+
+void nxui_batch_triangle(NXUIBatch *batch, const NXUIVertex vertices[3]) {
+    static const unsigned int indices[3] = {0, 1, 2};
+    nxui_batch_push(batch, vertices, 3, indices, 3);
+}
+
+/* vertices go around the quad */
+void nxui_batch_quad(NXUIBatch *batch, const NXUIVertex vertices[4]) {
+    static const unsigned int indices[6] = {0, 1, 2, 2, 3, 0};
+    nxui_batch_push(batch, vertices, 4, indices, 6);
+}
+
+void nxui_batch_rect(NXUIBatch *batch, float x, float y, float width, float height,
+                     const float color[4]) {
+    NXUIVertex vertices[4];
+    size_t     i;
+
+    for (i = 0; i < 4; i++) {
+        vertices[i].position[0] = (i == 1 || i == 2) ? x + width : x;
+        vertices[i].position[1] = (i >= 2) ? y + height : y;
+        vertices[i].uv[0]       = (i == 1 || i == 2) ? 1.0f : 0.0f;
+        vertices[i].uv[1]       = (i >= 2) ? 1.0f : 0.0f;
+        memcpy(vertices[i].color, color, sizeof(vertices[i].color));
+    }
+    nxui_batch_quad(batch, vertices);
+}
+
+/* Call once per frame after the last push. Returns the number of draws the frame took */
+size_t nxui_batch_end(NXUIBatch *batch) {
+    size_t draw_calls;
+
+    if (batch->vertex_used > 0) {
+        _nxui_batch_next_segment(batch);
+    }
+    draw_calls        = batch->draw_calls;
+    batch->draw_calls = 0;
+    return draw_calls;
+}
+
 NXUIContext *nxui_context_init(void) {
     NXUIContext *context = nx_malloc(sizeof(NXUIContext));
     if (!context) {
         nx_die("Failed to allocate NXUIContext");
     }
-    context->shaders      = NULL;
-    context->shader_count = 0;
-    context->meshes       = NULL;
-    context->mesh_count   = 0;
+    memset(context, 0, sizeof(NXUIContext));
+    context->free_slot = NXUI_NO_SLOT;
+    context->draw_list = nxui_draw_list_create();
     return context;
 }
 
-void nxui_context_add_shader(NXUIContext *context, NXUIShaderProgram shader) {
-    context->shaders =
-        nx_realloc(context->shaders, sizeof(NXUIShaderProgram) * (context->shader_count + 1));
-    if (!context->shaders) {
-        nx_die("Failed to allocate memory for shaders");
+/* Returns the stored copy, which stays at the same address until the context is destroyed.
+ * The context owns the shader from now on, do not delete the caller's copy */
+NXUIShaderProgram *nxui_context_add_shader(NXUIContext *context, NXUIShaderProgram shader) {
+    NXUIShaderProgram *added;
+    nxui_context_add_shaders(context, &shader, 1, &added);
+    return added;
+}
+
+static size_t _nxui_shader_chunk_count(size_t shader_count) {
+    return (shader_count + NXUI_SHADER_CHUNK_SIZE - 1) / NXUI_SHADER_CHUNK_SIZE;
+}
+
+/* added, if not NULL, receives the stored copy of each shader. As with nxui_context_add_shader
+ * the context takes ownership of the shaders */
+void nxui_context_add_shaders(NXUIContext *context, const NXUIShaderProgram *shaders,
+                              size_t count, NXUIShaderProgram **added) {
+    size_t chunks = _nxui_shader_chunk_count(context->shader_count + count);
+    size_t i;
+
+    if (chunks > context->shader_chunk_capacity) {
+        size_t capacity = nx_max(context->shader_chunk_capacity * 2, chunks);
+        context->shader_chunks =
+            nx_realloc(context->shader_chunks, capacity * sizeof(NXUIShaderProgram *));
+        if (!context->shader_chunks) {
+            nx_die("Failed to allocate memory for shaders");
+        }
+        context->shader_chunk_capacity = capacity;
+    }
+    for (i = _nxui_shader_chunk_count(context->shader_count); i < chunks; i++) {
+        context->shader_chunks[i] = nx_malloc(NXUI_SHADER_CHUNK_SIZE * sizeof(NXUIShaderProgram));
+        if (!context->shader_chunks[i]) {
+            nx_die("Failed to allocate memory for shaders");
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        context->shader_count++;
+        *nxui_context_shader(context, context->shader_count - 1) = shaders[i];
+        if (added) {
+            added[i] = nxui_context_shader(context, context->shader_count - 1);
+        }
+    }
+}
+
+/* Returns NULL when index is out of range */
+NXUIShaderProgram *nxui_context_shader(const NXUIContext *context, size_t index) {
+    if (index >= context->shader_count) {
+        return NULL;
+    }
+    return &context->shader_chunks[index / NXUI_SHADER_CHUNK_SIZE][index % NXUI_SHADER_CHUNK_SIZE];
+}
+
+NXUIMeshHandle nxui_context_add_mesh(NXUIContext *context, NXUIMesh mesh) {
+    NXUIMeshHandle handle;
+    nxui_context_add_meshes(context, &mesh, 1, &handle);
+    return handle;
+}
+
+/* handles, if not NULL, receives a handle for each mesh. Storage grows at most once per call */
+void nxui_context_add_meshes(NXUIContext *context, const NXUIMesh *meshes, size_t count,
+                             NXUIMeshHandle *handles) {
+    size_t i;
+
+    if (context->mesh_count + count > context->mesh_capacity) {
+        size_t capacity = nx_max(context->mesh_capacity * 2, context->mesh_count + count);
+        context->meshes     = nx_realloc(context->meshes, capacity * sizeof(NXUIMesh));
+        context->mesh_slots = nx_realloc(context->mesh_slots, capacity * sizeof(size_t));
+        context->slots      = nx_realloc(context->slots, capacity * sizeof(NXUIMeshSlot));
+        if (!context->meshes || !context->mesh_slots || !context->slots) {
+            nx_die("Failed to allocate memory for meshes");
+        }
+        context->mesh_capacity = capacity;
+    }
+
+    /* There are never more slots than meshes at their peak, so slots fit mesh_capacity */
+    for (i = 0; i < count; i++) {
+        size_t slot;
+        if (context->free_slot != NXUI_NO_SLOT) {
+            slot               = context->free_slot;
+            context->free_slot = context->slots[slot].index;
+        } else {
+            slot                            = context->slot_count++;
+            context->slots[slot].generation = 1;
+        }
+        context->slots[slot].index               = context->mesh_count;
+        context->meshes[context->mesh_count]     = meshes[i];
+        context->mesh_slots[context->mesh_count] = slot;
+        context->mesh_count++;
+        if (handles) {
+            handles[i].index      = (unsigned int) slot;
+            handles[i].generation = context->slots[slot].generation;
+        }
+    }
+}
+
+/* Returns NULL for a stale handle. The mesh moves when meshes are added or removed, so the
+ * pointer is only good until then */
+NXUIMesh *nxui_context_mesh(const NXUIContext *context, NXUIMeshHandle handle) {
+    if (handle.index >= context->slot_count ||
+        context->slots[handle.index].generation != handle.generation) {
+        return NULL;
     }
-    context->shaders[context->shader_count] = shader;
-    context->shader_count++;
+    return &context->meshes[context->slots[handle.index].index];
 }
 
-void nxui_context_add_mesh(NXUIContext *context, NXUIMesh mesh) {
-    context->meshes = nx_realloc(context->meshes, sizeof(NXUIMesh) * (context->mesh_count + 1));
-    if (!context->meshes) {
-        nx_die("Failed to allocate memory for meshes");
+static void _nxui_delete_mesh(NXUIMesh *mesh) {
+    glDeleteVertexArrays(1, &mesh->vao);
+    glDeleteBuffers(1, &mesh->vbo);
+    glDeleteBuffers(1, &mesh->ebo);
+    if (mesh->instance_vbo) {
+        glDeleteBuffers(1, &mesh->instance_vbo);
     }
-    context->meshes[context->mesh_count] = mesh;
-    context->mesh_count++;
+}
+
+/* Deletes the mesh's GL objects and moves the last mesh into its place. Returns false for a stale
+ * handle */
+bool nxui_context_remove_mesh(NXUIContext *context, NXUIMeshHandle handle) {
+    NXUIMesh *mesh = nxui_context_mesh(context, handle);
+    size_t    index, last;
+
+    if (!mesh) {
+        return false;
+    }
+    _nxui_delete_mesh(mesh);
+
+    index = context->slots[handle.index].index;
+    last  = context->mesh_count - 1;
+    if (index != last) {
+        context->meshes[index]                           = context->meshes[last];
+        context->mesh_slots[index]                       = context->mesh_slots[last];
+        context->slots[context->mesh_slots[index]].index = index;
+    }
+    context->mesh_count--;
+
+    /* Generation 0 is reserved for zeroed handles */
+    if (++context->slots[handle.index].generation == 0) {
+        context->slots[handle.index].generation = 1;
+    }
+    context->slots[handle.index].index = context->free_slot;
+    context->free_slot                 = handle.index;
+    return true;
 }
 
 void nxui_context_destroy(NXUIContext *context) {
@@ -331,74 +1293,463 @@ void nxui_context_destroy(NXUIContext *context) {
         return;
     }
     for (i = 0; i < context->shader_count; i++) {
-        nxui_delete_shader_program(&context->shaders[i]);
+        nxui_delete_shader_program(nxui_context_shader(context, i));
+    }
+    for (i = 0; i < _nxui_shader_chunk_count(context->shader_count); i++) {
+        nx_free(context->shader_chunks[i]);
     }
     for (i = 0; i < context->mesh_count; i++) {
-        glDeleteVertexArrays(1, &context->meshes[i].vao);
-        glDeleteBuffers(1, &context->meshes[i].vbo);
-        glDeleteBuffers(1, &context->meshes[i].ebo);
+        _nxui_delete_mesh(&context->meshes[i]);
     }
-    nx_free(context->shaders);
+    nxui_draw_list_destroy(context->draw_list);
+    nx_free(context->shader_chunks);
     nx_free(context->meshes);
+    nx_free(context->mesh_slots);
+    nx_free(context->slots);
     nx_free(context);
 }
 
+/* Draws every mesh that has a shader, grouped by program and VAO through the context's draw list.
+ * While a profiler frame without an open pass is recording, the draws are timed as a "ui" pass */
 void nxui_render_ui(NXUIContext *context) {
-    size_t i, j;
-    for (i = 0; i < context->shader_count; i++) {
-        nxui_use_shader_program(&context->shaders[i]);
-        for (j = 0; j < context->mesh_count; j++) {
-            if (context->meshes[j].shader == &context->shaders[i]) {
-                glBindVertexArray(context->meshes[j].vao);
-                glDrawElements(context->meshes[j].mode, context->meshes[j].index_count,
-                               GL_UNSIGNED_INT, 0);
-            }
+    NXUIProfiler *profiler = _nxui_profiler && !_nxui_profiler->in_pass ? _nxui_profiler : NULL;
+    size_t        i;
+
+    for (i = 0; i < context->mesh_count; i++) {
+        if (context->meshes[i].shader) {
+            nxui_draw_list_submit_mesh(context->draw_list, &context->meshes[i], 0);
+        }
+    }
+    if (profiler) {
+        nxui_profiler_begin_pass(profiler, "ui");
+    }
+    nxui_draw_list_render(context->draw_list);
+    if (profiler) {
+        nxui_profiler_end_pass(profiler);
+    }
+}
+
+NXUIDrawList *nxui_draw_list_create(void) {
+    NXUIDrawList *list = nx_malloc(sizeof(NXUIDrawList));
+    if (!list) {
+        nx_die("Failed to allocate NXUIDrawList");
+    }
+    list->items         = NULL;
+    list->entries       = NULL;
+    list->scratch       = NULL;
+    list->count         = 0;
+    list->capacity      = 0;
+    list->draw_calls    = 0;
+    list->state_changes = 0;
+    return list;
+}
+
+void nxui_draw_list_destroy(NXUIDrawList *list) {
+    if (!list) {
+        return;
+    }
+    nx_free(list->items);
+    nx_free(list->entries);
+    nx_free(list->scratch);
+    nx_free(list);
+}
+
+/* Keeps the storage, so a list reused every frame stops allocating once it reached its size */
+void nxui_draw_list_clear(NXUIDrawList *list) {
+    list->count = 0;
+}
+
+static unsigned long _nxui_draw_key(const NXUIDrawItem *item) {
+    unsigned long mask = (1UL << NXUI_DRAW_KEY_BITS) - 1;
+    return ((item->program & mask) << (2 * NXUI_DRAW_KEY_BITS)) |
+           ((item->vao & mask) << NXUI_DRAW_KEY_BITS) | (item->texture & mask);
+}
+
+void nxui_draw_list_submit(NXUIDrawList *list, const NXUIShaderProgram *shader, GLuint vao,
+                           GLuint texture, GLenum mode, GLsizei count, size_t first) {
+    nxui_draw_list_submit_instanced(list, shader, vao, texture, mode, count, first, 1);
+}
+
+void nxui_draw_list_submit_instanced(NXUIDrawList *list, const NXUIShaderProgram *shader,
+                                     GLuint vao, GLuint texture, GLenum mode, GLsizei count,
+                                     size_t first, GLsizei instances) {
+    NXUIDrawItem *item;
+
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity ? list->capacity * 2 : 64;
+        list->items     = nx_realloc(list->items, capacity * sizeof(NXUIDrawItem));
+        list->entries   = nx_realloc(list->entries, capacity * sizeof(NXUIDrawSortEntry));
+        list->scratch   = nx_realloc(list->scratch, capacity * sizeof(NXUIDrawSortEntry));
+        if (!list->items || !list->entries || !list->scratch) {
+            nx_die("Failed to allocate memory for draw items");
+        }
+        list->capacity = capacity;
+    }
+
+    item            = &list->items[list->count];
+    item->program   = shader->program_id;
+    item->vao       = vao;
+    item->texture   = texture;
+    item->mode      = mode;
+    item->count     = count;
+    item->first     = first;
+    item->instances = instances;
+
+    list->entries[list->count].key  = _nxui_draw_key(item);
+    list->entries[list->count].item = list->count;
+    list->count++;
+}
+
+void nxui_draw_list_submit_mesh(NXUIDrawList *list, const NXUIMesh *mesh, GLuint texture) {
+    nxui_draw_list_submit_instanced(list, mesh->shader, mesh->vao, texture, mesh->mode,
+                                    mesh->index_count, 0,
+                                    mesh->instance_count ? mesh->instance_count : 1);
+}
+
+/* LSD radix sort of the entries, a byte per pass. Passes above the highest set key bit and passes
+ * in which every key has the same byte are skipped, so a handful of programs and VAOs usually
+ * sorts in two or three passes */
+void nxui_draw_list_sort(NXUIDrawList *list) {
+    NXUIDrawSortEntry *src = list->entries;
+    NXUIDrawSortEntry *dst = list->scratch;
+    NXUIDrawSortEntry *tmp;
+    unsigned long      used = 0;
+    size_t             offsets[256];
+    size_t             shift, i, total;
+
+    for (i = 0; i < list->count; i++) {
+        used |= src[i].key;
+    }
+
+    for (shift = 0; shift < sizeof(unsigned long) * CHAR_BIT && (used >> shift) != 0; shift += 8) {
+        memset(offsets, 0, sizeof(offsets));
+        for (i = 0; i < list->count; i++) {
+            offsets[(src[i].key >> shift) & 0xFF]++;
+        }
+        if (offsets[(src[0].key >> shift) & 0xFF] == list->count) {
+            continue;
+        }
+
+        for (i = 0, total = 0; i < 256; i++) {
+            size_t count = offsets[i];
+            offsets[i]   = total;
+            total += count;
+        }
+        for (i = 0; i < list->count; i++) {
+            dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    list->entries = src;
+    list->scratch = dst;
+}
+
+/* Sorts the list, issues the draws binding each program, VAO and texture only when it changes and
+ * clears the list for the next frame */
+void nxui_draw_list_render(NXUIDrawList *list) {
+    GLuint program = 0, vao = 0, texture = 0;
+    size_t i;
+
+    list->draw_calls    = 0;
+    list->state_changes = 0;
+    if (list->count == 0) {
+        return;
+    }
+
+    nxui_draw_list_sort(list);
+
+    for (i = 0; i < list->count; i++) {
+        const NXUIDrawItem *item = &list->items[list->entries[i].item];
+        if (i == 0 || item->program != program) {
+            program = item->program;
+            glUseProgram(program);
+            list->state_changes++;
+        }
+        if (i == 0 || item->vao != vao) {
+            vao = item->vao;
+            glBindVertexArray(vao);
+            list->state_changes++;
+        }
+        if (item->texture != texture) {
+            texture = item->texture;
+            glBindTexture(GL_TEXTURE_2D, texture);
+            list->state_changes++;
+        }
+        if (item->instances > 1) {
+            glDrawElementsInstanced(item->mode, item->count, GL_UNSIGNED_INT,
+                                    (const void *) (item->first * sizeof(unsigned int)),
+                                    item->instances);
+        } else {
+            glDrawElements(item->mode, item->count, GL_UNSIGNED_INT,
+                           (const void *) (item->first * sizeof(unsigned int)));
         }
+        _nxui_profile_draw(item->mode, item->count, item->instances);
+        list->draw_calls++;
     }
+    _nxui_profile_count(NXUI_PROFILE_STATE_CHANGES, (double) list->state_changes);
+
     glBindVertexArray(0);
+    if (texture) {
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    list->count = 0;
 }
 
-void nxui_set_uniform_float(NXUIShaderProgram *shader, const char *name, float value) {
-    GLint location = glGetUniformLocation(shader->program_id, name);
-    if (location == -1) {
-        nx_die1("Uniform '%s' not found in shader program.", name);
+/* Returns -1 when the program has no such uniform. Names the cache doesn't know, like a single
+ * array element, are passed on to the driver */
+GLint nxui_uniform_location(const NXUIShaderProgram *shader, const char *name) {
+    size_t length = strlen(name);
+    size_t hash   = nx_hash_bytes(name, length);
+    size_t i;
+
+    for (i = 0; i < shader->uniform_count; i++) {
+        if (shader->uniforms[i].hash == hash && strcmp(shader->uniforms[i].name, name) == 0) {
+            return shader->uniforms[i].location;
+        }
     }
-    glUniform1f(location, value);
+    return glGetUniformLocation(shader->program_id, name);
 }
 
-void nxui_set_uniform_int(NXUIShaderProgram *shader, const char *name, int value) {
-    GLint location = glGetUniformLocation(shader->program_id, name);
+static GLint _nxui_require_uniform(const NXUIShaderProgram *shader, const char *name) {
+    GLint location = nxui_uniform_location(shader, name);
     if (location == -1) {
         nx_die1("Uniform '%s' not found in shader program.", name);
     }
-    glUniform1i(location, value);
+    return location;
+}
+
+void nxui_set_uniform_float(NXUIShaderProgram *shader, const char *name, float value) {
+    glUniform1f(_nxui_require_uniform(shader, name), value);
+}
+
+void nxui_set_uniform_int(NXUIShaderProgram *shader, const char *name, int value) {
+    glUniform1i(_nxui_require_uniform(shader, name), value);
 }
 
 void nxui_set_uniform_vec2(NXUIShaderProgram *shader, const char *name, float x, float y) {
-    GLint location = glGetUniformLocation(shader->program_id, name);
-    if (location == -1) {
-        nx_die1("Uniform '%s' not found in shader program.", name);
-    }
-    glUniform2f(location, x, y);
+    glUniform2f(_nxui_require_uniform(shader, name), x, y);
 }
 
 void nxui_set_uniform_vec3(NXUIShaderProgram *shader, const char *name, float x, float y, float z) {
-    GLint location = glGetUniformLocation(shader->program_id, name);
-    if (location == -1) {
-        nx_die1("Uniform '%s' not found in shader program.", name);
-    }
-    glUniform3f(location, x, y, z);
+    glUniform3f(_nxui_require_uniform(shader, name), x, y, z);
 }
 
 void nxui_set_uniform_vec4(NXUIShaderProgram *shader, const char *name, float x, float y, float z,
                            float w) {
-    GLint location = glGetUniformLocation(shader->program_id, name);
-    if (location == -1) {
-        nx_die1("Uniform '%s' not found in shader program.", name);
-    }
+    glUniform4f(_nxui_require_uniform(shader, name), x, y, z, w);
+}
+
+void nxui_set_uniform_float_loc(GLint location, float value) {
+    glUniform1f(location, value);
+}
+
+void nxui_set_uniform_int_loc(GLint location, int value) {
+    glUniform1i(location, value);
+}
+
+void nxui_set_uniform_vec2_loc(GLint location, float x, float y) {
+    glUniform2f(location, x, y);
+}
+
+void nxui_set_uniform_vec3_loc(GLint location, float x, float y, float z) {
+    glUniform3f(location, x, y, z);
+}
+
+void nxui_set_uniform_vec4_loc(GLint location, float x, float y, float z, float w) {
     glUniform4f(location, x, y, z, w);
 }
 
+NXUIProfiler *nxui_profiler_create(void) {
+    NXUIProfiler *profiler = nx_malloc(sizeof(NXUIProfiler));
+    GLuint        queries[NXUI_PROFILER_LATENCY * NXUI_PROFILER_MAX_PASSES];
+    size_t        i, j;
+
+    if (!profiler) {
+        nx_die("Failed to allocate NXUIProfiler");
+    }
+    memset(profiler, 0, sizeof(NXUIProfiler));
+
+    glGenQueries((GLsizei) nx_len(queries), queries);
+    for (i = 0; i < NXUI_PROFILER_LATENCY; i++) {
+        for (j = 0; j < NXUI_PROFILER_MAX_PASSES; j++) {
+            profiler->frames[i].passes[j].query = queries[i * NXUI_PROFILER_MAX_PASSES + j];
+        }
+    }
+    return profiler;
+}
+
+void nxui_profiler_destroy(NXUIProfiler *profiler) {
+    size_t i, j;
+    if (!profiler) {
+        return;
+    }
+    if (_nxui_profiler == profiler) {
+        _nxui_profiler = NULL;
+    }
+    for (i = 0; i < NXUI_PROFILER_LATENCY; i++) {
+        for (j = 0; j < NXUI_PROFILER_MAX_PASSES; j++) {
+            glDeleteQueries(1, &profiler->frames[i].passes[j].query);
+        }
+    }
+    nx_free(profiler);
+}
+
+static double _nxui_profiler_ms_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) * 1000.0 +
+           (double) (now.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* Moves a recorded frame into the history once all of its queries have a result. With drop set
+ * the frame's slot is about to be reused, so a frame that isn't done by then is thrown away
+ * instead of waited for */
+static void _nxui_profiler_collect(NXUIProfiler *profiler, NXUIProfileFrame *frame, bool drop) {
+    GLuint   available = GL_TRUE;
+    GLuint64 elapsed;
+    double   gpu_ms = 0.0;
+    size_t   i, metric;
+
+    if (!frame->pending) {
+        return;
+    }
+    for (i = 0; i < frame->pass_count && available; i++) {
+        glGetQueryObjectuiv(frame->passes[i].query, GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+    if (!available) {
+        if (drop) {
+            frame->pending = false;
+            profiler->dropped_frames++;
+        }
+        return;
+    }
+
+    for (i = 0; i < frame->pass_count; i++) {
+        glGetQueryObjectui64v(frame->passes[i].query, GL_QUERY_RESULT, &elapsed);
+        profiler->last_passes[i].name = frame->passes[i].name;
+        profiler->last_passes[i].ms   = (double) elapsed / 1000000.0;
+        gpu_ms += profiler->last_passes[i].ms;
+    }
+    profiler->last_pass_count          = frame->pass_count;
+    frame->values[NXUI_PROFILE_GPU_MS] = gpu_ms;
+    frame->pending                     = false;
+
+    for (metric = 0; metric < NXUI_PROFILE_METRIC_COUNT; metric++) {
+        profiler->history[metric][profiler->history_next] = frame->values[metric];
+    }
+    profiler->history_next = (profiler->history_next + 1) % NXUI_PROFILER_HISTORY;
+    if (profiler->history_count < NXUI_PROFILER_HISTORY) {
+        profiler->history_count++;
+    }
+}
+
+/* Starts recording a frame. Draws, triangles, state changes and buffer uploads made by nxui until
+ * nxui_profiler_end_frame are counted towards it */
+void nxui_profiler_begin_frame(NXUIProfiler *profiler) {
+    NXUIProfileFrame *frame = &profiler->frames[profiler->frame];
+    size_t            metric;
+
+    _nxui_profiler_collect(profiler, frame, true);
+    frame->pass_count = 0;
+    for (metric = 0; metric < NXUI_PROFILE_METRIC_COUNT; metric++) {
+        frame->values[metric] = 0.0;
+    }
+    profiler->in_pass = false;
+    _nxui_profiler    = profiler;
+    clock_gettime(CLOCK_MONOTONIC, &profiler->cpu_start);
+}
+
+/* Passes can't nest, beginning a pass ends the open one. name has to outlive the profiler's use
+ * of it, a string literal is the usual choice. Passes past NXUI_PROFILER_MAX_PASSES aren't timed */
+void nxui_profiler_begin_pass(NXUIProfiler *profiler, const char *name) {
+    NXUIProfileFrame *frame = &profiler->frames[profiler->frame];
+
+    nxui_profiler_end_pass(profiler);
+    if (frame->pass_count == NXUI_PROFILER_MAX_PASSES) {
+        return;
+    }
+    frame->passes[frame->pass_count].name = name;
+    glBeginQuery(GL_TIME_ELAPSED, frame->passes[frame->pass_count].query);
+    frame->pass_count++;
+    profiler->in_pass = true;
+}
+
+void nxui_profiler_end_pass(NXUIProfiler *profiler) {
+    if (profiler->in_pass) {
+        glEndQuery(GL_TIME_ELAPSED);
+        profiler->in_pass = false;
+    }
+}
+
+void nxui_profiler_end_frame(NXUIProfiler *profiler) {
+    NXUIProfileFrame *frame = &profiler->frames[profiler->frame];
+    NXUIProfileFrame *pending;
+    size_t            i;
+
+    nxui_profiler_end_pass(profiler);
+    frame->values[NXUI_PROFILE_CPU_MS] = _nxui_profiler_ms_since(&profiler->cpu_start);
+    frame->pending                     = true;
+    _nxui_profiler                     = NULL;
+
+    /* Oldest first, so the history stays in frame order */
+    profiler->frame = (profiler->frame + 1) % NXUI_PROFILER_LATENCY;
+    for (i = 0; i < NXUI_PROFILER_LATENCY; i++) {
+        pending = &profiler->frames[(profiler->frame + i) % NXUI_PROFILER_LATENCY];
+        _nxui_profiler_collect(profiler, pending, false);
+        if (pending->pending) {
+            break;
+        }
+    }
+}
+
+static int _nxui_compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile over the last NXUI_PROFILER_HISTORY collected frames, 0 without any */
+double nxui_profiler_percentile(const NXUIProfiler *profiler, NXUIProfileMetric metric,
+                                double percentile) {
+    double values[NXUI_PROFILER_HISTORY];
+    size_t rank;
+
+    if (profiler->history_count == 0) {
+        return 0.0;
+    }
+    memcpy(values, profiler->history[metric], profiler->history_count * sizeof(double));
+    qsort(values, profiler->history_count, sizeof(double), _nxui_compare_doubles);
+
+    rank = (size_t) (percentile / 100.0 * (double) profiler->history_count + 0.5);
+    rank = rank > 0 ? rank - 1 : 0;
+    return values[nx_min(rank, profiler->history_count - 1)];
+}
+
+void nxui_profiler_log(const NXUIProfiler *profiler, NXLogger *logger) {
+    static const char *names[NXUI_PROFILE_METRIC_COUNT] = {
+        "cpu ms", "gpu ms", "draw calls", "triangles", "state changes", "buffer uploads"};
+    size_t metric, i;
+
+    for (metric = 0; metric < NXUI_PROFILE_METRIC_COUNT; metric++) {
+        nx_logger_log(logger, NX_LOG_INFO, "%s: p50 %.3f, p95 %.3f, p99 %.3f", names[metric],
+                      nxui_profiler_percentile(profiler, (NXUIProfileMetric) metric, 50.0),
+                      nxui_profiler_percentile(profiler, (NXUIProfileMetric) metric, 95.0),
+                      nxui_profiler_percentile(profiler, (NXUIProfileMetric) metric, 99.0));
+    }
+    for (i = 0; i < profiler->last_pass_count; i++) {
+        nx_logger_info2(logger, "pass %s: %.3f ms", profiler->last_passes[i].name,
+                        profiler->last_passes[i].ms);
+    }
+    if (profiler->dropped_frames > 0) {
+        nx_logger_warn1(logger, "%lu frames dropped, their queries weren't ready in time",
+                        (unsigned long) profiler->dropped_frames);
+    }
+}
+
 void nxui_clear(float r, float g, float b, float a) {
     glClearColor(r, g, b, a);
     glClear(GL_COLOR_BUFFER_BIT);